@@ -26,7 +26,7 @@
                 }],
                 ['OS=="linux"', {
                     "include_dirs" : [
-                        "<!(python3-config --includes)"
+                        "<!(node ./scripts/pyconfig.js --includes)"
                     ],
                     "link_settings": {
                         "libraries": [
@@ -34,12 +34,12 @@
                             "<!(node ./scripts/rpaths.js)"
                         ]
                     },
-                    'cflags': ["<!(python3-config --cflags)", "-fexceptions"],
-                    'cflags_cc': ["<!(python3-config --cflags)", "-fexceptions"]
+                    'cflags': ["<!(node ./scripts/pyconfig.js --cflags)", "-fexceptions"],
+                    'cflags_cc': ["<!(node ./scripts/pyconfig.js --cflags)", "-fexceptions"]
                 }],
                 ['OS=="mac"', {
                     "include_dirs" : [
-                        "<!(python3-config --includes)"
+                        "<!(node ./scripts/pyconfig.js --includes)"
                     ],
                     "link_settings": {
                         "libraries": [
@@ -55,7 +55,9 @@
             ],
             "sources": [
                 "src/addon.cpp",
-                "src/pyinterpreter.cpp"
+                "src/pyinterpreter.cpp",
+                "src/wire.cpp",
+                "src/cachekey.cpp"
             ]
         }
     ]
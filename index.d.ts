@@ -10,17 +10,128 @@ export class PyObject
     private constructor();
 }
 
+export class PipelineStepResult
+{
+    private _type: 'PipelineStepResult';
+    private constructor();
+}
+
+export interface PipelineStep
+{
+    handler: PyModule | PyObject | PipelineStepResult;
+    func: string;
+    args?: any[];
+}
+
+export interface MemoryStats
+{
+    handles: number;
+    bytes: number;
+    allocatedBlocks: number;
+    tracemalloc?: { current: number, peak: number };
+}
+
+export interface CallBatchingOptions
+{
+    maxBatchSize?: number;
+    maxWaitUs?: number;
+    batchFunc?: string;
+}
+
+export interface MemoizeOptions
+{
+    maxEntries?: number;
+    maxBytes?: number;
+    ttl?: number;
+}
+
+export interface MemoizeStats
+{
+    hits: number;
+    misses: number;
+    evictions: number;
+    expirations: number;
+    entries: number;
+    bytes: number;
+}
+
+export interface AdaptiveDispatchOptions
+{
+    inlineUs?: number;
+    tailUs?: number;
+    minSamples?: number;
+}
+
+export interface DispatchStats
+{
+    samples: number;
+    ewmaUs: number;
+    tailUs: number;
+    inline: number;
+    offloaded: number;
+    mode: "inline" | "offload";
+}
+
+export interface ReimportOptions
+{
+    debounce?: number;
+    onReimport?: (error: Error | undefined, modules: string[], files: string[]) => void;
+}
+
+export interface Reimporter
+{
+    changed: (fileName: string) => void;
+    flush: () => void;
+    close: () => void;
+}
+
+export class PyError extends Error
+{
+    code: "py";
+    args: unknown[];
+    traceback: string;
+    [attribute: string]: unknown;
+}
+
+export interface ForkedInterpreter
+{
+    pid: number;
+
+    call: (module: PyModule | PyObject, functionName: string, ...args: any[]) => Promise<unknown>;
+    callSync: (module: PyModule | PyObject, functionName: string, ...args: any[]) => unknown;
+
+    create: (module: PyModule | PyObject, className: string, ...args: any[]) => Promise<PyObject>;
+    createSync: (module: PyModule | PyObject, className: string, ...args: any[]) => PyObject;
+
+    release: (object?: PyObject) => void;
+}
+
 export interface Interpreter
 {
     import: (filename: string, allowReimport: boolean) => Promise<PyModule>;
     importSync: (filename: string, allowReimport: boolean) => PyModule;
 
+    preload: (modules: string[]) => Promise<Record<string, number>>;
+    preloaded: Promise<Record<string, number>>;
+
     create: (module: PyModule, className: string, ...args: any[]) => Promise<PyObject>;
     createSync: (module: PyModule, className: string, ...args: any[]) => PyObject;
 
     call: (module: PyModule | PyObject, functionName: string, ...args: any[]) => Promise<unknown>;
     callSync: (module: PyModule | PyObject, functionName: string, ...args: any[]) => unknown;
 
+    callBinary: (module: PyModule | PyObject, functionName: string, ...args: any[]) => Promise<unknown>;
+    callBinarySync: (module: PyModule | PyObject, functionName: string, ...args: any[]) => unknown;
+
+    callLazy: (module: PyModule | PyObject, functionName: string, ...args: any[]) => Promise<PyObject & any>;
+    callLazySync: (module: PyModule | PyObject, functionName: string, ...args: any[]) => PyObject & any;
+
+    materialize: (object: PyObject, key?: string | number) => unknown;
+
+    step: (index: number) => PipelineStepResult;
+    pipeline: (steps: PipelineStep[], outputs?: number[]) => Promise<unknown>;
+    pipelineSync: (steps: PipelineStep[], outputs?: number[]) => unknown;
+
     exec: (module: PyModule | PyObject, codeToRun: string) => Promise<unknown>;
     execSync: (module: PyModule | PyObject, codeToRun: string) => unknown;
 
@@ -29,15 +140,42 @@ export interface Interpreter
 
     fixlink: (fileName: string) => void;
 
-    reimport: (directory: string) => void;
+    reimport: (directory: string) => string[];
+    reimportAsync: (paths: string | string[]) => Promise<string[]>;
 
     addImportPath: (path: string) => void;
 
-    developmentMode: (paths: string[]) => void;
+    setModuleIndex: (enabled: boolean) => void;
+
+    buildBundle: (directory: string, bundle: string, options?: { namespacePackages?: boolean }) => number;
+    addBundle: (bundle: string) => void;
+
+    createReimporter: (options?: ReimportOptions) => Reimporter;
+    developmentMode: (paths: string | string[], options?: ReimportOptions) => { close: () => Promise<void> };
+
+    setSyncJsAndPyInCallback: (syncJsAndPy: boolean, awaitable?: boolean) => void;
 
-    setSyncJsAndPyInCallback: (syncJsAndPy: boolean) => void;
+    setCallbackBatching: (batch: boolean, asArray?: boolean) => void;
+
+    setLazyArguments: (lazy: boolean) => void;
+
+    setPreserveReferences: (preserve: boolean) => void;
+
+    setCallBatching: (handler: PyModule | PyObject, func: string, options: CallBatchingOptions | null) => void;
+
+    memoize: (handler: PyModule | PyObject, func: string, options?: MemoizeOptions | null) => void;
+    memoizeStats: (handler: PyModule | PyObject, func: string) => MemoizeStats | undefined;
+
+    setAdaptiveDispatch: (enabled: boolean, options?: AdaptiveDispatchOptions) => void;
+    dispatchStats: (handler: PyModule | PyObject, func: string) => DispatchStats | undefined;
 
     setPythonExecutable: (executable: string) => void;
+
+    registerCallback: (callback: (...args: any[]) => any) => PyObject;
+    release: (object: PyModule | PyObject) => void;
+    memoryStats: () => MemoryStats;
+
+    fork: () => ForkedInterpreter;
 }
 
 export const interpreter: Interpreter;
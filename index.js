@@ -1,12 +1,470 @@
 const { execSync } = require("child_process");
 const fs = require("fs");
+const os = require("os");
 const path = require("path");
+const crypto = require("crypto");
 const nodecallspython = require("./build/Release/nodecallspython");
 const chokidar = require("chokidar");
+const msgpack = require("./msgpack");
+const { pythonConfig } = require("./scripts/pyconfig");
+
+const lazyResults = new WeakMap();
+// the properties of a lazy result which are not looked up in python: the methods every object inherits, and then so it is not taken for a promise
+const LAZY_WRAPPER_KEYS = new Set(["then", ...Object.getOwnPropertyNames(Object.prototype)]);
+
+class StepResult
+{
+    constructor(index)
+    {
+        this.index = index;
+    }
+}
+
+function preparePipeline(steps)
+{
+    return steps.map(step => {
+        const args = unwrapLazy((step.args || []).slice());
+        const refs = [];
+        let pos = 0;
+        for (let i = 0; i < args.length; ++i)
+        {
+            if (args[i] instanceof StepResult)
+            {
+                refs.push(pos, args[i].index);
+                args[i] = undefined;
+            }
+
+            if (!(args[i] && args[i].__kwargs === true))
+                ++pos;
+        }
+
+        const handler = step.handler instanceof StepResult ? step.handler.index : unwrapHandler(step.handler);
+        return [handler, step.func, args, refs];
+    });
+}
+
+function unwrapHandler(handler)
+{
+    return lazyResults.get(handler) || handler;
+}
+
+function unwrapLazy(args)
+{
+    for (let i = 0; i < args.length; ++i)
+    {
+        const handler = lazyResults.get(args[i]);
+        if (handler)
+            args[i] = handler;
+    }
+    return args;
+}
+
+// collects concurrent calls of the same function and passes them to a batch-aware python function in a single call
+class CallBatcher
+{
+    constructor(interpreter, handler, options)
+    {
+        this.interpreter = interpreter;
+        this.handler = handler;
+        this.func = options.batchFunc;
+        this.maxBatchSize = options.maxBatchSize || 32;
+        this.maxWaitUs = options.maxWaitUs === undefined ? 1000 : options.maxWaitUs;
+        this.pending = [];
+        this.timer = null;
+    }
+
+    push(args)
+    {
+        return new Promise(function(resolve, reject) {
+            this.pending.push({ args, resolve, reject });
+
+            if (this.pending.length >= this.maxBatchSize)
+                this.flush();
+            else if (!this.timer)
+            {
+                // timers have millisecond resolution, shorter waits end after the current event loop iteration
+                if (this.maxWaitUs < 1000)
+                    this.timer = setImmediate(() => this.flush());
+                else
+                    this.timer = setTimeout(() => this.flush(), Math.round(this.maxWaitUs / 1000));
+            }
+        }.bind(this));
+    }
+
+    flush()
+    {
+        if (this.timer)
+        {
+            clearImmediate(this.timer);
+            clearTimeout(this.timer);
+            this.timer = null;
+        }
+
+        const batch = this.pending;
+        this.pending = [];
+        if (batch.length === 0)
+            return;
+
+        // every positional argument is passed as the list of its values in the batch
+        const columns = [];
+        for (let i = 0; i < batch.length; ++i)
+        {
+            for (let j = 0; j < batch[i].args.length; ++j)
+            {
+                if (!columns[j])
+                    columns[j] = new Array(batch.length);
+                columns[j][i] = batch[i].args[j];
+            }
+        }
+
+        const rejectAll = error => batch.forEach(call => call.reject(error));
+
+        try
+        {
+            this.interpreter.startAsync("call", [this.handler, this.func, ...columns], function(result, error) {
+                if (error)
+                    rejectAll(error);
+                else if (!result || result.length !== batch.length)
+                    rejectAll(new Error("Batch function " + this.func + " returned " + (result ? result.length : 0) + " results for " + batch.length + " calls"));
+                else
+                    batch.forEach((call, i) => call.resolve(result[i]));
+            }.bind(this));
+        }
+        catch(e)
+        {
+            rejectAll(e);
+        }
+    }
+}
+
+// collects the changed python files of a burst and reimports them together on the thread pool, the changes made meanwhile after it
+class Reimporter
+{
+    constructor(py, options)
+    {
+        this.py = py;
+        this.debounce = options.debounce === undefined ? 100 : options.debounce;
+        this.onReimport = options.onReimport || ((error) => { if (error) console.error(error); });
+        this.changedFiles = new Set();
+        this.timer = null;
+        this.running = false;
+        this.closed = false;
+    }
+
+    changed(fileName)
+    {
+        if (this.closed)
+            return;
+
+        this.changedFiles.add(path.resolve(fileName));
+        clearTimeout(this.timer);
+        this.timer = setTimeout(() => this.flush(), this.debounce);
+    }
+
+    flush()
+    {
+        clearTimeout(this.timer);
+        this.timer = null;
+        if (this.running || this.changedFiles.size === 0)
+            return;
+
+        const files = [...this.changedFiles];
+        this.changedFiles = new Set();
+        this.running = true;
+        this.py.reimportAsync(files).then(modules => this.onReimport(undefined, modules, files), error => this.onReimport(error, [], files)).finally(() => {
+            this.running = false;
+            if (this.changedFiles.size > 0 && !this.timer && !this.closed)
+                this.timer = setTimeout(() => this.flush(), this.debounce);
+        });
+    }
+
+    // drops the pending changes, a reimport already running still completes
+    close()
+    {
+        clearTimeout(this.timer);
+        this.timer = null;
+        this.closed = true;
+        this.changedFiles.clear();
+    }
+}
+
+// rough size of a converted result, used for the maxBytes limit of the memoization cache
+function estimateSize(value, seen = new Set())
+{
+    if (typeof value === "string")
+        return 2 * value.length;
+    else if (ArrayBuffer.isView(value) || value instanceof ArrayBuffer)
+        return value.byteLength;
+    else if (value && typeof value === "object")
+    {
+        // shared and cyclic results of setPreserveReferences are counted once
+        if (seen.has(value))
+            return 8;
+        seen.add(value);
+
+        if (Array.isArray(value))
+            return value.reduce((size, item) => size + estimateSize(item, seen), 16);
+        return Object.entries(value).reduce((size, [key, item]) => size + 2 * key.length + estimateSize(item, seen), 16);
+    }
+    return 8;
+}
+
+// a copy of a cached result, so callers modifying their result do not change the later hits
+// python objects and other class instances are shared, like the handlers of the same python object
+function copyResult(value, copies = new Map())
+{
+    if (!value || typeof value !== "object")
+        return value;
+    if (copies.has(value))
+        return copies.get(value);
+
+    let copy = value;
+    if (Array.isArray(value))
+    {
+        copy = new Array(value.length);
+        copies.set(value, copy);
+        for (let i = 0; i < value.length; ++i)
+            copy[i] = copyResult(value[i], copies);
+    }
+    else if (Buffer.isBuffer(value))
+        copy = Buffer.from(value);
+    else if (value instanceof DataView)
+        copy = new DataView(value.buffer.slice(value.byteOffset, value.byteOffset + value.byteLength));
+    else if (ArrayBuffer.isView(value) || value instanceof ArrayBuffer)
+        copy = value.slice(0);
+    else if (Object.getPrototypeOf(value) === Object.prototype)
+    {
+        copy = {};
+        copies.set(value, copy);
+        for (const key of Object.keys(value))
+            Object.defineProperty(copy, key, { value: copyResult(value[key], copies), writable: true, enumerable: true, configurable: true });
+    }
+
+    copies.set(value, copy);
+    return copy;
+}
+
+// LRU cache of the results of a pure python function, keyed by the native encoding of the arguments
+// the cached values are never handed out, every caller gets its own copy
+class Memoizer
+{
+    constructor(options)
+    {
+        this.maxEntries = options.maxEntries || 1000;
+        this.maxBytes = options.maxBytes || Infinity;
+        this.ttl = options.ttl || 0;
+        this.entries = new Map();
+        this.bytes = 0;
+        this.stats = { hits: 0, misses: 0, evictions: 0, expirations: 0 };
+    }
+
+    get(key)
+    {
+        const entry = this.entries.get(key);
+        if (!entry)
+            return undefined;
+
+        if (this.ttl && entry.expires < Date.now())
+        {
+            this.delete(key, entry);
+            ++this.stats.expirations;
+            return undefined;
+        }
+
+        // keep the Map in LRU order
+        this.entries.delete(key);
+        this.entries.set(key, entry);
+        return entry;
+    }
+
+    set(key, entry)
+    {
+        const old = this.entries.get(key);
+        if (old)
+            this.delete(key, old);
+
+        entry.size = entry.pending ? key.length : key.length + estimateSize(entry.value);
+        entry.expires = this.ttl ? Date.now() + this.ttl : 0;
+        this.entries.set(key, entry);
+        this.bytes += entry.size;
+
+        for (const [oldest, value] of this.entries)
+        {
+            if (this.entries.size <= this.maxEntries && this.bytes <= this.maxBytes)
+                break;
+
+            this.delete(oldest, value);
+            ++this.stats.evictions;
+        }
+    }
+
+    delete(key, entry)
+    {
+        if (this.entries.get(key) === entry)
+        {
+            this.entries.delete(key);
+            this.bytes -= entry.size;
+        }
+    }
+
+    call(key, callAsync)
+    {
+        const entry = this.get(key);
+        if (entry)
+        {
+            ++this.stats.hits;
+            return entry.pending ? entry.promise.then(value => copyResult(value)) : Promise.resolve(copyResult(entry.value));
+        }
+
+        ++this.stats.misses;
+
+        // concurrent calls with the same arguments share the pending python call
+        const pending = { pending: true };
+        pending.promise = callAsync().then(value => {
+            this.delete(key, pending);
+            this.set(key, { value });
+            return value;
+        }, error => {
+            this.delete(key, pending);
+            throw error;
+        });
+        this.set(key, pending);
+        return pending.promise.then(value => copyResult(value));
+    }
+
+    callSync(key, callSync)
+    {
+        const entry = this.get(key);
+        if (entry && !entry.pending)
+        {
+            ++this.stats.hits;
+            return copyResult(entry.value);
+        }
+
+        ++this.stats.misses;
+        const value = callSync();
+        if (!this.entries.has(key))
+            this.set(key, { value });
+        return copyResult(value);
+    }
+
+    getStats()
+    {
+        return { ...this.stats, entries: this.entries.size, bytes: this.bytes };
+    }
+}
+
+// latency statistics of a function for the adaptive dispatch of async calls
+class Latency
+{
+    constructor()
+    {
+        this.samples = 0;
+        this.ewmaUs = 0;
+        this.tailUs = 0;
+        this.inline = 0;
+        this.offloaded = 0;
+        this.coroutine = false;
+    }
+
+    add(us, inline)
+    {
+        if (inline)
+            ++this.inline;
+        else
+            ++this.offloaded;
+
+        // coroutines report no time, they are never run inline
+        if (us === undefined)
+        {
+            this.coroutine = true;
+            return;
+        }
+
+        this.ewmaUs = this.samples ? this.ewmaUs + 0.2 * (us - this.ewmaUs) : us;
+        // a decaying maximum, one slow call keeps the function offloaded for a while
+        this.tailUs = Math.max(us, this.tailUs * 0.95);
+        ++this.samples;
+    }
+
+    isFast(options)
+    {
+        return !this.coroutine && this.samples >= options.minSamples && this.ewmaUs <= options.inlineUs && this.tailUs <= options.tailUs;
+    }
+
+    getStats(options)
+    {
+        return {
+            samples: this.samples,
+            ewmaUs: this.ewmaUs,
+            tailUs: this.tailUs,
+            inline: this.inline,
+            offloaded: this.offloaded,
+            mode: options && this.isFast(options) ? "inline" : "offload"
+        };
+    }
+}
+
+class ForkedInterpreter
+{
+    constructor(interpreter, pid)
+    {
+        this.interpreter = interpreter;
+        this.py = interpreter.py;
+        this.pid = pid;
+    }
+
+    callImpl(isFunc, handler, func, args)
+    {
+        return new Promise(function(resolve, reject) {
+            try
+            {
+                this.interpreter.startAsync("forkCall", [this.pid, isFunc, handler, func, ...unwrapLazy(args)], function(result, error) {
+                    if (error)
+                        reject(error);
+                    else
+                        resolve(result);
+                });
+            }
+            catch(e)
+            {
+                reject(e);
+            }
+        }.bind(this));
+    }
+
+    call(handler, func, ...args)
+    {
+        return this.callImpl(true, unwrapHandler(handler), func, args);
+    }
+
+    callSync(handler, func, ...args)
+    {
+        return this.py.forkCallSync(this.pid, true, unwrapHandler(handler), func, ...unwrapLazy(args));
+    }
+
+    create(handler, func, ...args)
+    {
+        return this.callImpl(false, unwrapHandler(handler), func, args);
+    }
+
+    createSync(handler, func, ...args)
+    {
+        return this.py.forkCallSync(this.pid, false, unwrapHandler(handler), func, ...unwrapLazy(args));
+    }
+
+    // releases an object created in the forked process, or the process itself without a handler
+    release(handler)
+    {
+        if (handler !== undefined)
+            return this.py.release(handler);
+        return this.py.releaseFork(this.pid);
+    }
+}
 
 class Interpreter
 {
-    loadPython(dir)
+    loadPython(dir, libs)
     {
         const debug = process.env.NODECALLSPYTHON_DEBUG !== undefined;
         if (debug)
@@ -25,6 +483,7 @@ class Interpreter
                             console.log("Running fixlink on " + filename);
 
                         this.fixlink(filename);
+                        libs.push(filename);
                         found = true;
                     }
                     catch(e)
@@ -61,42 +520,186 @@ class Interpreter
             return this.getPythonExecutableImpl("which python3");
     }
 
-    constructor()
+    getStartupCacheDir()
     {
-        this.py = new nodecallspython.PyInterpreter();
+        // a per-user directory, the cached libraries are loaded into the process so nobody else may write them
+        const base = process.platform === "win32" ? (process.env.LOCALAPPDATA || path.join(os.homedir(), "AppData", "Local")) : (process.env.XDG_CACHE_HOME || path.join(os.homedir(), ".cache"));
+        const dir = path.join(base, "node-calls-python");
+        fs.mkdirSync(dir, { recursive: true, mode: 0o700 });
+        if (!this.isPrivate(fs.statSync(dir)))
+            return undefined;
+        return dir;
+    }
+
+    // owned by the current user and not writable by others, always true on windows
+    isPrivate(stat)
+    {
+        if (process.platform === "win32" || !process.getuid)
+            return true;
+        return stat.uid === process.getuid() && (stat.mode & 0o022) === 0;
+    }
+
+    getStartupCacheFile()
+    {
+        if (process.env.NODE_CALLS_PYTHON_CACHE === "0")
+            return undefined;
+
+        if (process.env.NODE_CALLS_PYTHON_CACHE)
+            return process.env.NODE_CALLS_PYTHON_CACHE;
+
+        try
+        {
+            const dir = this.getStartupCacheDir();
+            if (!dir)
+                return undefined;
+
+            // the probed paths depend on the environment and on the python the addon was built against
+            const addon = require.resolve("./build/Release/nodecallspython");
+            const key = [process.env.PATH, process.env.PYTHONHOME, process.env.CONDA_PREFIX, pythonConfig, addon, fs.statSync(addon).mtimeMs].join("\n");
+            const hash = crypto.createHash("sha1").update(key).digest("hex").substring(0, 16);
+            return path.join(dir, "startup-" + hash + ".json");
+        }
+        catch(e)
+        {
+            return undefined;
+        }
+    }
+
+    readStartupCache(cacheFile)
+    {
+        let fd;
+        try
+        {
+            // the file is checked after opening it, so it cannot be swapped in between
+            fd = fs.openSync(cacheFile, fs.constants.O_RDONLY | (fs.constants.O_NOFOLLOW || 0));
+            if (!this.isPrivate(fs.fstatSync(fd)))
+                return undefined;
+
+            const cache = JSON.parse(fs.readFileSync(fd).toString());
+            if (cache.libs.every(lib => fs.existsSync(lib)) && (!cache.executable || fs.existsSync(cache.executable)))
+                return cache;
+        }
+        catch(e)
+        {
+        }
+        finally
+        {
+            if (fd !== undefined)
+                fs.closeSync(fd);
+        }
+        return undefined;
+    }
+
+    writeStartupCache(cacheFile, cache)
+    {
+        const tmp = cacheFile + "." + process.pid;
+        try
+        {
+            fs.writeFileSync(tmp, JSON.stringify(cache), { flag: "wx", mode: 0o600 });
+            fs.renameSync(tmp, cacheFile);
+        }
+        catch(e)
+        {
+            fs.rmSync(tmp, { force: true });
+        }
+    }
+
+    probePython()
+    {
+        const libs = [];
         if (process.platform === "linux")
         {
-            const stdout = execSync("python3-config --configdir");
+            const stdout = execSync(pythonConfig + " --configdir");
             let found = false;
             if (stdout)
             {
                 const dir = stdout.toString().trim();
-                const res = this.loadPython(dir);
+                const res = this.loadPython(dir, libs);
                 if (res)
                     found = true;
             }
 
             if (!found)
             {
-                const stdout = execSync("python3-config --ldflags");
+                const stdout = execSync(pythonConfig + " --ldflags");
                 if (stdout)
                 {
                     const split = stdout.toString().trim().split(" ");
                     split.forEach(s => {
                         if (s.startsWith("-L"))
-                            this.loadPython(s.substring(2));
+                            this.loadPython(s.substring(2), libs);
                     });
                 }
             }
         }
 
+        let executable;
         try
         {
-            this.setPythonExecutable(this.getPythonExecutable());
+            executable = this.getPythonExecutable();
         }
         catch(e)
         {
         }
+
+        return { libs: [...new Set(libs)], executable };
+    }
+
+    constructor()
+    {
+        this.py = new nodecallspython.PyInterpreter();
+        this.batchers = new WeakMap();
+        this.memoizers = new WeakMap();
+        this.latencies = new WeakMap();
+        this.adaptive = null;
+        this.pendingCalls = 0;
+
+        const cacheFile = this.getStartupCacheFile();
+        let startup = cacheFile && this.readStartupCache(cacheFile);
+        if (startup)
+            startup.libs.forEach(lib => this.fixlink(lib));
+        else
+        {
+            startup = this.probePython();
+            if (cacheFile)
+                this.writeStartupCache(cacheFile, startup);
+        }
+
+        try
+        {
+            this.setPythonExecutable(startup.executable);
+        }
+        catch(e)
+        {
+        }
+
+        // bundles are added before preloading, so the preloaded modules come from them too
+        const bundles = process.env.NODE_CALLS_PYTHON_BUNDLE;
+        if (bundles)
+            bundles.split(path.delimiter).filter(b => b).forEach(b => this.addBundle(b));
+
+        const preload = process.env.NODE_CALLS_PYTHON_PRELOAD;
+        this.preloaded = preload ? this.preload(preload.split(",").map(m => m.trim()).filter(m => m)) : Promise.resolve({});
+        this.preloaded.catch(() => {});
+    }
+
+    preload(modules)
+    {
+        return Promise.all(modules.map(module => new Promise(function(resolve, reject) {
+            try
+            {
+                this.startAsync("import", [module, false], function(handler, error, time) {
+                    if (handler)
+                        resolve([module, time]);
+                    else
+                        reject(error);
+                });
+            }
+            catch(e)
+            {
+                reject(e);
+            }
+        }.bind(this)))).then(times => Object.fromEntries(times));
     }
 
     import(filename, allowReimport = false)
@@ -104,7 +707,7 @@ class Interpreter
         return new Promise(function(resolve, reject) {
             try
             {
-                this.py.import(filename, allowReimport, function(handler, error) {
+                this.startAsync("import", [filename, allowReimport], function(handler, error) {
                     if (handler)
                         resolve(handler);
                     else
@@ -125,15 +728,65 @@ class Interpreter
 
     call(handler, func, ...args)
     {
+        handler = unwrapHandler(handler);
+        const memoizer = this.getMemoizer(handler, func);
+        if (memoizer)
+        {
+            const key = this.py.cacheKey(...unwrapLazy(args));
+            if (key !== undefined)
+                return memoizer.call(key, () => this.callUncached(handler, func, args));
+        }
+
+        return this.callUncached(handler, func, args);
+    }
+
+    // the async methods of the native interpreter go through here, calls only run inline while none of them is in flight
+    startAsync(method, args, callback)
+    {
+        this.py[method](...args, function(...results) {
+            --this.pendingCalls;
+            callback(...results);
+        }.bind(this));
+        ++this.pendingCalls;
+    }
+
+    callUncached(handler, func, args)
+    {
+        const batchers = this.batchers.get(handler);
+        const batcher = batchers && batchers.get(func);
+        if (batcher && !args.some(arg => arg && arg.__kwargs === true))
+            return batcher.push(unwrapLazy(args));
+
+        const latency = this.adaptive && this.getLatency(handler, func);
+        if (latency && this.pendingCalls === 0 && latency.isFast(this.adaptive) && !args.some(arg => typeof arg === "function"))
+        {
+            // running inline is cheaper than the threadpool hop, the result is still delivered asynchronously
+            const start = process.hrtime.bigint();
+            try
+            {
+                const result = this.py.callSync(handler, func, ...unwrapLazy(args));
+                latency.add(Number(process.hrtime.bigint() - start) / 1000, true);
+                return Promise.resolve(result);
+            }
+            catch(e)
+            {
+                latency.add(Number(process.hrtime.bigint() - start) / 1000, true);
+                return Promise.reject(e);
+            }
+        }
+
         return new Promise(function(resolve, reject) {
             try
             {
-                this.py.call(handler, func, ...args, function(result, error) {
+                this.startAsync("call", [handler, func, ...unwrapLazy(args)], function(result, error, time) {
+                    if (latency && !error)
+                        latency.add(time, false);
+
                     if (error)
                         reject(error);
                     else
                         resolve(result);
-                });
+                }.bind(this));
             }
             catch(e)
             {
@@ -144,15 +797,115 @@ class Interpreter
 
     callSync(handler, func, ...args)
     {
-        return this.py.callSync(handler, func, ...args);
+        handler = unwrapHandler(handler);
+        const memoizer = this.getMemoizer(handler, func);
+        if (memoizer)
+        {
+            const key = this.py.cacheKey(...unwrapLazy(args));
+            if (key !== undefined)
+                return memoizer.callSync(key, () => this.py.callSync(handler, func, ...args));
+        }
+
+        return this.py.callSync(handler, func, ...unwrapLazy(args));
+    }
+
+    callBinary(handler, func, ...args)
+    {
+        handler = unwrapHandler(handler);
+        return new Promise(function(resolve, reject) {
+            try
+            {
+                this.startAsync("callBinary", [handler, func, msgpack.encodeArguments(args)], function(result, error) {
+                    if (error)
+                        reject(error);
+                    else
+                        resolve(msgpack.decode(result));
+                });
+            }
+            catch(e)
+            {
+                reject(e);
+            }
+        }.bind(this));
+    }
+
+    callBinarySync(handler, func, ...args)
+    {
+        return msgpack.decode(this.py.callBinarySync(unwrapHandler(handler), func, msgpack.encodeArguments(args)));
+    }
+
+    callLazy(handler, func, ...args)
+    {
+        return this.create(handler, func, ...args).then(result => this.lazy(result));
+    }
+
+    callLazySync(handler, func, ...args)
+    {
+        return this.lazy(this.createSync(handler, func, ...args));
+    }
+
+    lazy(handler)
+    {
+        const py = this.py;
+        const cache = new Map();
+        const result = new Proxy(handler, {
+            get(target, prop, receiver)
+            {
+                // keys like handler are read from python, the methods of the interpreter unwrap the proxy themselves
+                if (typeof prop === "symbol" || LAZY_WRAPPER_KEYS.has(prop))
+                    return Reflect.get(target, prop, receiver);
+
+                if (!cache.has(prop))
+                    cache.set(prop, py.materialize(target, /^\d+$/.test(prop) ? Number(prop) : prop));
+                return cache.get(prop);
+            }
+        });
+        lazyResults.set(result, handler);
+        return result;
+    }
+
+    materialize(handler, key)
+    {
+        handler = unwrapHandler(handler);
+        return key === undefined ? this.py.materialize(handler) : this.py.materialize(handler, key);
+    }
+
+    step(index)
+    {
+        return new StepResult(index);
+    }
+
+    pipeline(steps, outputs)
+    {
+        return new Promise(function(resolve, reject) {
+            try
+            {
+                this.startAsync("pipeline", [preparePipeline(steps), outputs], function(result, error) {
+                    if (error)
+                        reject(error);
+                    else
+                        resolve(result);
+                });
+            }
+            catch(e)
+            {
+                reject(e);
+            }
+        }.bind(this));
+    }
+
+    pipelineSync(steps, outputs)
+    {
+        return this.py.pipelineSync(preparePipeline(steps), outputs);
     }
 
     create(handler, func, ...args)
     {
+        handler = unwrapHandler(handler);
         return new Promise(function(resolve, reject) {
             try
             {
-                this.py.create(handler, func, ...args, function(result, error) {
+                this.startAsync("create", [handler, func, ...unwrapLazy(args)], function(result, error) {
                     if (error)
                         reject(error);
                     else
@@ -168,7 +921,7 @@ class Interpreter
 
     createSync(handler, func, ...args)
     {
-        return this.py.createSync(handler, func, ...args);
+        return this.py.createSync(unwrapHandler(handler), func, ...unwrapLazy(args));
     }
 
     fixlink(filename)
@@ -181,12 +934,32 @@ class Interpreter
         return this.py.reimport(directory);
     }
 
+    reimportAsync(paths)
+    {
+        return new Promise(function(resolve, reject) {
+            try
+            {
+                this.startAsync("reimport", [paths], function(modules, error) {
+                    if (error)
+                        reject(error);
+                    else
+                        resolve(modules);
+                });
+            }
+            catch(e)
+            {
+                reject(e);
+            }
+        }.bind(this));
+    }
+
     exec(handler, code)
     {
+        handler = unwrapHandler(handler);
         return new Promise(function(resolve, reject) {
             try
             {
-                this.py.exec(handler, code, function(result, error) {
+                this.startAsync("exec", [handler, code], function(result, error) {
                     if (error)
                         reject(error);
                     else
@@ -202,15 +975,16 @@ class Interpreter
 
     execSync(handler, code)
     {
-        return this.py.execSync(handler, code);
+        return this.py.execSync(unwrapHandler(handler), code);
     }
 
     eval(handler, code)
     {
+        handler = unwrapHandler(handler);
         return new Promise(function(resolve, reject) {
             try
             {
-                this.py.eval(handler, code, function(result, error) {
+                this.startAsync("eval", [handler, code], function(result, error) {
                     if (error)
                         reject(error);
                     else
@@ -226,7 +1000,7 @@ class Interpreter
 
     evalSync(handler, code)
     {
-        return this.py.evalSync(handler, code);
+        return this.py.evalSync(unwrapHandler(handler), code);
     }
 
     addImportPath(path)
@@ -234,9 +1008,129 @@ class Interpreter
         return this.py.addImportPath(path);
     }
 
-    setSyncJsAndPyInCallback(syncJsAndPy)
+    setModuleIndex(enabled)
     {
-        return this.py.setSyncJsAndPyInCallback(syncJsAndPy);
+        return this.py.setModuleIndex(enabled);
+    }
+
+    buildBundle(directory, bundle, options = {})
+    {
+        return this.py.buildBundle(path.resolve(directory), path.resolve(bundle), !!options.namespacePackages);
+    }
+
+    addBundle(bundle)
+    {
+        return this.py.addBundle(path.resolve(bundle));
+    }
+
+    setSyncJsAndPyInCallback(syncJsAndPy, awaitable = false)
+    {
+        return this.py.setSyncJsAndPyInCallback(syncJsAndPy, awaitable);
+    }
+
+    setLazyArguments(lazy)
+    {
+        return this.py.setLazyArguments(lazy);
+    }
+
+    setPreserveReferences(preserve)
+    {
+        return this.py.setPreserveReferences(preserve);
+    }
+
+    setCallbackBatching(batch, asArray = false)
+    {
+        return this.py.setCallbackBatching(batch, asArray);
+    }
+
+    setCallBatching(handler, func, options)
+    {
+        handler = unwrapHandler(handler);
+        let batchers = this.batchers.get(handler);
+        if (batchers && batchers.has(func))
+        {
+            batchers.get(func).flush();
+            batchers.delete(func);
+        }
+
+        if (!options)
+            return;
+
+        if (!batchers)
+        {
+            batchers = new Map();
+            this.batchers.set(handler, batchers);
+        }
+
+        batchers.set(func, new CallBatcher(this, handler, { batchFunc: func, ...options }));
+    }
+
+    memoize(handler, func, options = {})
+    {
+        handler = unwrapHandler(handler);
+        let memoizers = this.memoizers.get(handler);
+        if (!options)
+        {
+            if (memoizers)
+                memoizers.delete(func);
+            return;
+        }
+
+        if (!memoizers)
+        {
+            memoizers = new Map();
+            this.memoizers.set(handler, memoizers);
+        }
+
+        memoizers.set(func, new Memoizer(options));
+    }
+
+    getMemoizer(handler, func)
+    {
+        const memoizers = this.memoizers.get(handler);
+        return memoizers && memoizers.get(func);
+    }
+
+    memoizeStats(handler, func)
+    {
+        handler = unwrapHandler(handler);
+        const memoizer = this.getMemoizer(handler, func);
+        return memoizer ? memoizer.getStats() : undefined;
+    }
+
+    setAdaptiveDispatch(enabled, options = {})
+    {
+        this.adaptive = enabled ? { inlineUs: 50, tailUs: 1000, minSamples: 8, ...options } : null;
+    }
+
+    getLatency(handler, func)
+    {
+        handler = unwrapHandler(handler);
+        let latencies = this.latencies.get(handler);
+        if (!latencies)
+        {
+            if (!handler || typeof handler !== "object")
+                return undefined;
+
+            latencies = new Map();
+            this.latencies.set(handler, latencies);
+        }
+
+        let latency = latencies.get(func);
+        if (!latency)
+        {
+            latency = new Latency();
+            latencies.set(func, latency);
+        }
+        return latency;
+    }
+
+    dispatchStats(handler, func)
+    {
+        handler = unwrapHandler(handler);
+        const latencies = this.latencies.get(handler);
+        const latency = latencies && latencies.get(func);
+        return latency ? latency.getStats(this.adaptive) : undefined;
     }
 
     setPythonExecutable(executable)
@@ -245,8 +1139,34 @@ class Interpreter
         this.py.execSync({}, 'import multiprocessing; multiprocessing.set_executable(\'' + escaped + '\');');
     }
 
-    developmentMode(paths)
+    registerCallback(callback)
+    {
+        return this.py.registerCallback(callback);
+    }
+
+    release(handler)
     {
+        return this.py.release(unwrapHandler(handler));
+    }
+
+    memoryStats()
+    {
+        return this.py.memoryStats();
+    }
+
+    fork()
+    {
+        return new ForkedInterpreter(this, this.py.fork());
+    }
+
+    createReimporter(options = {})
+    {
+        return new Reimporter(this, options);
+    }
+
+    developmentMode(paths, options = {})
+    {
+        const reimporter = this.createReimporter(options);
         const watcher = chokidar.watch(paths, {
             persistent: true,
             ignoreInitial: true,
@@ -254,13 +1174,22 @@ class Interpreter
         watcher.on("change", (fileName) => {
             const ext = path.extname(fileName);
             if (ext == ".py" || ext == "py")
-                this.reimport(fileName);
+                reimporter.changed(fileName);
         });
+
+        // closing the watcher also cancels a debounced reimport
+        const close = watcher.close.bind(watcher);
+        watcher.close = () => {
+            reimporter.close();
+            return close();
+        };
+        return watcher;
     }
 }
 
 let py = new Interpreter();
 
 module.exports = {
-    interpreter: py
+    interpreter: py,
+    PyError: nodecallspython.PyError
 }
@@ -2,4 +2,6 @@ import cjs from './index.js';
 
 export const interpreter = cjs.interpreter;
 
+export const PyError = cjs.PyError;
+
 export default cjs.interpreter;
@@ -0,0 +1,337 @@
+// MessagePack based binary format used by callBinary/callBinarySync, the native side lives in src/wire.cpp
+// typed arrays are sent as ext types, the ext type is the index of the typed array in TYPED_ARRAYS
+
+const TYPED_ARRAYS = [
+    Int8Array,
+    Uint8Array,
+    Uint8ClampedArray,
+    Int16Array,
+    Uint16Array,
+    Int32Array,
+    Uint32Array,
+    Float32Array,
+    Float64Array,
+    BigInt64Array,
+    BigUint64Array
+];
+
+class Encoder
+{
+    constructor()
+    {
+        this.buffer = Buffer.allocUnsafe(4096);
+        this.view = new DataView(this.buffer.buffer, this.buffer.byteOffset, this.buffer.byteLength);
+        this.pos = 0;
+    }
+
+    ensure(size)
+    {
+        if (this.pos + size <= this.buffer.length)
+            return;
+
+        const buffer = Buffer.allocUnsafe(Math.max(this.buffer.length * 2, this.pos + size));
+        this.buffer.copy(buffer, 0, 0, this.pos);
+        this.buffer = buffer;
+        this.view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+    }
+
+    byte(value)
+    {
+        this.ensure(1);
+        this.buffer[this.pos++] = value;
+    }
+
+    header(size, fix, fixMax, type8, type16, type32)
+    {
+        this.ensure(5);
+        if (fix !== undefined && size <= fixMax)
+            this.buffer[this.pos++] = fix | size;
+        else if (type8 !== undefined && size <= 0xff)
+        {
+            this.buffer[this.pos++] = type8;
+            this.buffer[this.pos++] = size;
+        }
+        else if (size <= 0xffff)
+        {
+            this.buffer[this.pos++] = type16;
+            this.view.setUint16(this.pos, size);
+            this.pos += 2;
+        }
+        else
+        {
+            this.buffer[this.pos++] = type32;
+            this.view.setUint32(this.pos, size);
+            this.pos += 4;
+        }
+    }
+
+    number(value)
+    {
+        this.ensure(9);
+        if (Number.isSafeInteger(value))
+        {
+            if (value >= 0 && value <= 0x7f)
+                this.buffer[this.pos++] = value;
+            else if (value < 0 && value >= -32)
+                this.buffer[this.pos++] = value & 0xff;
+            else if (value >= -0x80000000 && value <= 0x7fffffff)
+            {
+                this.buffer[this.pos++] = 0xd2;
+                this.view.setInt32(this.pos, value);
+                this.pos += 4;
+            }
+            else
+            {
+                this.buffer[this.pos++] = 0xd3;
+                this.view.setBigInt64(this.pos, BigInt(value));
+                this.pos += 8;
+            }
+        }
+        else
+        {
+            this.buffer[this.pos++] = 0xcb;
+            this.view.setFloat64(this.pos, value);
+            this.pos += 8;
+        }
+    }
+
+    string(value)
+    {
+        const max = value.length * 3;
+        this.ensure(max + 5);
+
+        // reserve the largest header needed and move the bytes if a shorter one is enough
+        const headerSize = max <= 31 ? 1 : max <= 0xff ? 2 : max <= 0xffff ? 3 : 5;
+        const start = this.pos;
+        const size = this.buffer.write(value, start + headerSize, "utf8");
+
+        if (size <= 31)
+            this.buffer[start] = 0xa0 | size;
+        else if (size <= 0xff)
+        {
+            this.buffer[start] = 0xd9;
+            this.buffer[start + 1] = size;
+        }
+        else if (size <= 0xffff)
+        {
+            this.buffer[start] = 0xda;
+            this.view.setUint16(start + 1, size);
+        }
+        else
+        {
+            this.buffer[start] = 0xdb;
+            this.view.setUint32(start + 1, size);
+        }
+
+        const needed = size <= 31 ? 1 : size <= 0xff ? 2 : size <= 0xffff ? 3 : 5;
+        if (needed !== headerSize)
+            this.buffer.copy(this.buffer, start + needed, start + headerSize, start + headerSize + size);
+
+        this.pos = start + needed + size;
+    }
+
+    bytes(value, ext)
+    {
+        const data = Buffer.from(value.buffer, value.byteOffset, value.byteLength);
+        this.header(data.length, undefined, 0, 0xc4 + ext, 0xc5 + ext, 0xc6 + ext);
+        if (ext)
+            this.byte(TYPED_ARRAYS.indexOf(value.constructor));
+
+        this.ensure(data.length);
+        data.copy(this.buffer, this.pos);
+        this.pos += data.length;
+    }
+
+    value(value)
+    {
+        switch (typeof value)
+        {
+        case "number":
+            return this.number(value);
+        case "string":
+            return this.string(value);
+        case "boolean":
+            return this.byte(value ? 0xc3 : 0xc2);
+        case "undefined":
+            return this.byte(0xc0);
+        case "bigint":
+            this.ensure(9);
+            this.buffer[this.pos++] = value < 0 ? 0xd3 : 0xcf;
+            if (value < 0)
+                this.view.setBigInt64(this.pos, value);
+            else
+                this.view.setBigUint64(this.pos, value);
+            this.pos += 8;
+            return;
+        case "object":
+            if (value === null)
+                return this.byte(0xc0);
+
+            if (Array.isArray(value))
+            {
+                this.header(value.length, 0x90, 15, undefined, 0xdc, 0xdd);
+                for (let i = 0; i < value.length; ++i)
+                    this.value(value[i]);
+                return;
+            }
+
+            if (ArrayBuffer.isView(value))
+                return this.bytes(value, Buffer.isBuffer(value) || value instanceof DataView ? 0 : 3);
+
+            if (value instanceof ArrayBuffer)
+                return this.bytes(new Uint8Array(value), 0);
+
+            const keys = Object.keys(value);
+            this.header(keys.length, 0x80, 15, undefined, 0xde, 0xdf);
+            for (const key of keys)
+            {
+                this.string(key);
+                this.value(value[key]);
+            }
+            return;
+        default:
+            throw new Error("Cannot encode " + typeof value + " in binary mode");
+        }
+    }
+}
+
+const encoder = new Encoder();
+
+// encodes the arguments of a call as [args, kwargs], the result is only valid until the next call
+function encodeArguments(args)
+{
+    encoder.pos = 0;
+    let kwargs;
+    const positional = [];
+    for (const arg of args)
+    {
+        if (arg && arg.__kwargs === true)
+        {
+            kwargs = Object.assign({}, arg);
+            delete kwargs.__kwargs;
+        }
+        else
+            positional.push(arg);
+    }
+
+    encoder.value([positional, kwargs]);
+    return encoder.buffer.subarray(0, encoder.pos);
+}
+
+class Decoder
+{
+    constructor(buffer)
+    {
+        this.buffer = buffer;
+        this.view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+        this.pos = 0;
+    }
+
+    string(size)
+    {
+        const value = this.buffer.toString("utf8", this.pos, this.pos + size);
+        this.pos += size;
+        return value;
+    }
+
+    bytes(size)
+    {
+        const start = this.buffer.byteOffset + this.pos;
+        this.pos += size;
+        return this.buffer.buffer.slice(start, start + size);
+    }
+
+    ext(size)
+    {
+        const type = TYPED_ARRAYS[this.buffer[this.pos++]];
+        if (!type)
+            throw new Error("Invalid binary payload: unknown typed array");
+        return new type(this.bytes(size));
+    }
+
+    array(size)
+    {
+        const result = new Array(size);
+        for (let i = 0; i < size; ++i)
+            result[i] = this.value();
+        return result;
+    }
+
+    map(size)
+    {
+        const result = {};
+        for (let i = 0; i < size; ++i)
+        {
+            const key = this.value();
+            const value = this.value();
+            // assigning __proto__ would replace the prototype instead of adding the key
+            if (key === "__proto__")
+                Object.defineProperty(result, key, { value, writable: true, enumerable: true, configurable: true });
+            else
+                result[key] = value;
+        }
+        return result;
+    }
+
+    uint8() { return this.buffer[this.pos++]; }
+    uint16() { const value = this.view.getUint16(this.pos); this.pos += 2; return value; }
+    uint32() { const value = this.view.getUint32(this.pos); this.pos += 4; return value; }
+
+    value()
+    {
+        const type = this.buffer[this.pos++];
+        if (type <= 0x7f)
+            return type;
+        if (type >= 0xe0)
+            return type - 0x100;
+        if (type >= 0xa0 && type <= 0xbf)
+            return this.string(type & 0x1f);
+        if (type >= 0x90 && type <= 0x9f)
+            return this.array(type & 0x0f);
+        if (type >= 0x80 && type <= 0x8f)
+            return this.map(type & 0x0f);
+
+        let value;
+        switch (type)
+        {
+        case 0xc0: return undefined;
+        case 0xc2: return false;
+        case 0xc3: return true;
+        case 0xc4: return this.bytes(this.uint8());
+        case 0xc5: return this.bytes(this.uint16());
+        case 0xc6: return this.bytes(this.uint32());
+        case 0xc7: return this.ext(this.uint8());
+        case 0xc8: return this.ext(this.uint16());
+        case 0xc9: return this.ext(this.uint32());
+        case 0xca: value = this.view.getFloat32(this.pos); this.pos += 4; return value;
+        case 0xcb: value = this.view.getFloat64(this.pos); this.pos += 8; return value;
+        case 0xcc: return this.uint8();
+        case 0xcd: return this.uint16();
+        case 0xce: return this.uint32();
+        case 0xcf: value = Number(this.view.getBigUint64(this.pos)); this.pos += 8; return value;
+        case 0xd0: value = this.view.getInt8(this.pos); this.pos += 1; return value;
+        case 0xd1: value = this.view.getInt16(this.pos); this.pos += 2; return value;
+        case 0xd2: value = this.view.getInt32(this.pos); this.pos += 4; return value;
+        case 0xd3: value = Number(this.view.getBigInt64(this.pos)); this.pos += 8; return value;
+        case 0xd9: return this.string(this.uint8());
+        case 0xda: return this.string(this.uint16());
+        case 0xdb: return this.string(this.uint32());
+        case 0xdc: return this.array(this.uint16());
+        case 0xdd: return this.array(this.uint32());
+        case 0xde: return this.map(this.uint16());
+        case 0xdf: return this.map(this.uint32());
+        default:
+            throw new Error("Invalid binary payload: unknown type " + type);
+        }
+    }
+}
+
+function decode(buffer)
+{
+    return new Decoder(buffer).value();
+}
+
+module.exports = {
+    encodeArguments,
+    decode
+};
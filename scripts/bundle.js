@@ -0,0 +1,17 @@
+const fs = require("fs");
+
+// compiles the python files of a directory into a bundle with the linked python, so its bytecode can be loaded by addBundle
+// usage: node scripts/bundle.js [--namespace-packages] <directory> <bundle>
+if (require.main === module)
+{
+    const namespacePackages = process.argv.includes("--namespace-packages");
+    const args = process.argv.slice(2).filter(arg => arg !== "--namespace-packages");
+    if (args.length != 2)
+    {
+        console.error("Usage: node bundle.js [--namespace-packages] <directory> <bundle>");
+        process.exit(1);
+    }
+
+    const count = require("..").interpreter.buildBundle(args[0], args[1], { namespacePackages });
+    console.log(`${args[1]}: ${count} modules, ${fs.statSync(args[1]).size} bytes`);
+}
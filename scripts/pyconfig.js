@@ -0,0 +1,9 @@
+const { execSync } = require("child_process");
+
+// runs python3-config, or the config script of another python (e.g. python3.13t-config for free-threaded python) set in NODE_CALLS_PYTHON_CONFIG
+const pythonConfig = process.env.NODE_CALLS_PYTHON_CONFIG || "python3-config";
+
+if (require.main === module)
+    console.log(execSync(pythonConfig + " " + process.argv.slice(2).join(" ")).toString().trim());
+
+module.exports = { pythonConfig };
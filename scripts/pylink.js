@@ -1,14 +1,15 @@
 const { execSync } = require("child_process");
 const path = require('path');
+const { pythonConfig } = require("./pyconfig");
 
 let stdout;
 try
 {
-    stdout = execSync("python3-config --ldflags --embed");
+    stdout = execSync(pythonConfig + " --ldflags --embed");
 }
 catch(e)
 {
-    stdout = execSync("python3-config --ldflags");
+    stdout = execSync(pythonConfig + " --ldflags");
 }
 
 let linkerLine = stdout.toString().trim();
@@ -3,11 +3,15 @@
 #include <sstream>
 #include <iostream>
 #include <tuple>
+#include <chrono>
 #ifndef WIN32
 #include <dlfcn.h>
 #endif
 #include "cpyobject.h"
 #include "pyinterpreter.h"
+#include "pool.h"
+#include "wire.h"
+#include "cachekey.h"
 
 #define DECLARE_NAPI_METHOD(name, func) { name, 0, func, 0, 0, 0, napi_default, 0 }
 #define CHECK(func) { if (func != napi_ok) { napi_throw_error(env, "error", #func); return; } }
@@ -18,16 +22,47 @@ namespace nodecallspython
 {
     struct BaseTask
     {
-        napi_async_work m_work;
-        napi_ref m_callback;
-        PyInterpreter* m_py;
-        napi_env m_env;
+        napi_async_work m_work = nullptr;
+        napi_ref m_callback = nullptr;
+        PyInterpreter* m_py = nullptr;
+        napi_env m_env = nullptr;
         std::string m_error;
+        std::shared_ptr<PyError> m_pyError;
+
+        // must be called from the catch block of e, the addon is built without RTTI so python exceptions are found by rethrowing
+        void setError(const std::exception& e)
+        {
+            m_error = e.what();
+
+            try
+            {
+                throw;
+            }
+            catch(const PyError& pyError)
+            {
+                m_pyError = std::make_shared<PyError>(pyError);
+            }
+            catch(...)
+            {
+            }
+        }
+
+        void reset()
+        {
+            if (m_callback)
+                napi_delete_reference(m_env, m_callback);
+            if (m_work)
+                napi_delete_async_work(m_env, m_work);
+
+            m_callback = nullptr;
+            m_work = nullptr;
+            m_error.clear();
+            m_pyError.reset();
+        }
 
         ~BaseTask()
         {
-            napi_delete_reference(m_env, m_callback);
-            napi_delete_async_work(m_env, m_work);
+            reset();
         }
     };
 
@@ -35,63 +70,259 @@ namespace nodecallspython
     {
         std::string m_name;
         std::string m_handler;
-        bool m_allowReimport;
+        bool m_allowReimport = false;
+        double m_time = 0;
+
+        void reset()
+        {
+            m_name.clear();
+            m_handler.clear();
+            m_allowReimport = false;
+            m_time = 0;
+            BaseTask::reset();
+        }
+
+        ~ImportTask()
+        {
+            reset();
+        }
     };
 
+    using ImportTaskPool = Pool<ImportTask>;
+
     struct CallTask : public BaseTask
     {
         std::string m_handler;
         std::string m_func;
         bool m_isFunc;
-        
+        std::shared_ptr<ForkedInterpreter> m_fork;
+        bool m_binary = false;
+        std::string m_payload;
+
+        // the time spent in python in microseconds, reported to the callback of the call
+        double m_time = 0;
+
         CPyObject m_args;
         CPyObject m_kwargs;
         CPyObject m_result;
 
+        // keeps the capacity of the strings, so a pooled task does not allocate in steady state, except for large binary payloads
+        void reset()
+        {
+            if (m_args || m_kwargs || m_result)
+            {
+                GIL gil;
+                m_args = CPyObject();
+                m_kwargs = CPyObject();
+                m_result = CPyObject();
+            }
+
+            m_handler.clear();
+            m_func.clear();
+            m_fork.reset();
+            m_binary = false;
+            if (m_payload.capacity() > 1024 * 1024)
+                std::string().swap(m_payload);
+            else
+                m_payload.clear();
+            m_time = 0;
+            BaseTask::reset();
+        }
+
         ~CallTask()
         {
-            GIL gil;
-            m_args = CPyObject();
-            m_kwargs = CPyObject();
-            m_result = CPyObject();
+            reset();
+        }
+    };
+
+    using CallTaskPool = Pool<CallTask>;
+
+    struct PipelineTask : public BaseTask
+    {
+        std::vector<PipelineStep> m_steps;
+        std::vector<size_t> m_outputs;
+        bool m_hasOutputs = false;
+
+        std::vector<CPyObject> m_results;
+
+        // keeps the capacity of the vectors, the steps and results hold python objects so they are cleared with the GIL
+        void reset()
+        {
+            if (!m_steps.empty() || !m_results.empty())
+            {
+                GIL gil;
+                m_steps.clear();
+                m_results.clear();
+            }
+
+            m_outputs.clear();
+            m_hasOutputs = false;
+            BaseTask::reset();
+        }
+
+        ~PipelineTask()
+        {
+            reset();
         }
     };
 
+    using PipelineTaskPool = Pool<PipelineTask>;
+
     struct ExecTask : public BaseTask
     {
         std::string m_handler;
         std::string m_code;
-        bool m_eval;
+        bool m_eval = false;
 
         CPyObject m_result;
 
+        void reset()
+        {
+            if (m_result)
+            {
+                GIL gil;
+                m_result = CPyObject();
+            }
+
+            m_handler.clear();
+            m_code.clear();
+            m_eval = false;
+            BaseTask::reset();
+        }
+
         ~ExecTask()
         {
-            GIL gil;
-            m_result = CPyObject();
+            reset();
+        }
+    };
+
+    using ExecTaskPool = Pool<ExecTask>;
+
+    struct ReimportTask : public BaseTask
+    {
+        std::vector<std::string> m_paths;
+        std::vector<std::string> m_modules;
+    };
+
+    // arguments of a napi callback, short argument lists are kept on the stack
+    class ArgumentBuffer
+    {
+        static const size_t STACK_SIZE = 16;
+        napi_value m_stack[STACK_SIZE];
+        std::vector<napi_value> m_heap;
+
+    public:
+        ArgumentBuffer(size_t size)
+        {
+            if (size > STACK_SIZE)
+                m_heap.resize(size);
+        }
+
+        napi_value* data()
+        {
+            return m_heap.empty() ? m_stack : m_heap.data();
         }
     };
 
     class Handler
     {
-        PyInterpreter* m_py;
+        // the handler may be finalized after the interpreter, e.g. when a worker thread exits
+        std::weak_ptr<PyInterpreter> m_py;
         std::string m_handler;
+        int64_t m_size;
     
     public:
-        Handler(PyInterpreter* py, const std::string& handler) : m_py(py), m_handler(handler) {}
+        Handler(PyInterpreter* py, const std::string& handler, int64_t size) : m_py(py->weak_from_this()), m_handler(handler), m_size(size)
+        {
+            py->trackHandlerMemory(m_size);
+        }
 
         ~Handler()
         {
-            GIL gil;
-            m_py->release(m_handler);
+            if (auto py = m_py.lock())
+                py->trackHandlerMemory(-m_size);
+        }
+
+        void adjustExternalMemory(napi_env env)
+        {
+            int64_t adjusted;
+            napi_adjust_external_memory(env, -m_size, &adjusted);
+        }
+
+        // explicit release, the python object is freed immediately
+        void release(napi_env env)
+        {
+            adjustExternalMemory(env);
+
+            if (auto py = m_py.lock())
+            {
+                GIL gil;
+                py->release(m_handler);
+            }
+        }
+
+        // the finalizer must not wait for the GIL, the handler is queued and released in the background
+        static void Destructor(napi_env env, void* nativeObject, void* finalize_hint)
+        {
+            std::unique_ptr<Handler> handler(reinterpret_cast<Handler*>(nativeObject));
+            handler->adjustExternalMemory(env);
+
+            if (auto py = handler->m_py.lock())
+                py->deferRelease(handler->m_handler);
+        }
+    };
+
+    // a python object created in a forked interpreter, it is released in the child with the next request to it
+    struct ForkHandler
+    {
+        std::weak_ptr<ForkedInterpreter> m_fork;
+        std::string m_handler;
+
+        ForkHandler(const std::shared_ptr<ForkedInterpreter>& fork, const std::string& handler) : m_fork(fork), m_handler(handler)
+        {
+        }
+
+        void release()
+        {
+            if (auto fork = m_fork.lock())
+                fork->deferRelease(m_handler);
         }
 
         static void Destructor(napi_env env, void* nativeObject, void* finalize_hint)
         {
-            delete reinterpret_cast<Handler*>(nativeObject);
+            std::unique_ptr<ForkHandler> handler(reinterpret_cast<ForkHandler*>(nativeObject));
+            handler->release();
         }
     };
 
+    napi_value createForkHandler(napi_env env, const std::shared_ptr<ForkedInterpreter>& fork, PyObject* result)
+    {
+        auto utf8 = PyUnicode_Check(result) ? PyUnicode_AsUTF8(result) : nullptr;
+        if (!utf8)
+        {
+            PyErr_Clear();
+            throw std::runtime_error("Invalid handler from the forked interpreter");
+        }
+        std::string stringhandler = utf8;
+
+        napi_value handler;
+        CHECKNULL(napi_create_string_utf8(env, stringhandler.c_str(), NAPI_AUTO_LENGTH, &handler));
+
+        napi_value obj;
+        CHECKNULL(napi_create_object(env, &obj));
+        CHECKNULL(napi_set_named_property(env, obj, "handler", handler));
+        CHECKNULL(napi_type_tag_object(env, obj, &FORK_HANDLER_TYPE_TAG));
+
+        auto native = new ForkHandler(fork, stringhandler);
+        auto status = napi_wrap(env, obj, native, ForkHandler::Destructor, nullptr, nullptr);
+        if (status != napi_ok)
+        {
+            delete native;
+            CHECKNULL(status);
+        }
+        return obj;
+    }
+
     napi_value createHandler(napi_env env, PyInterpreter* py, const std::string& stringhandler)
     {
         napi_value key;
@@ -105,7 +336,19 @@ namespace nodecallspython
 
         CHECKNULL(napi_set_property(env, result, key, handler));
 
-        CHECKNULL(napi_add_finalizer(env, result, new Handler(py, stringhandler), Handler::Destructor, nullptr, nullptr));
+        CHECKNULL(napi_type_tag_object(env, result, &HANDLER_TYPE_TAG));
+
+        // let V8 know how much memory is kept alive by the handler, so it is collected in time
+        int64_t size = 0;
+        {
+            GIL gil;
+            size = py->getSize(stringhandler);
+        }
+
+        CHECKNULL(napi_wrap(env, result, new Handler(py, stringhandler, size), Handler::Destructor, nullptr, nullptr));
+
+        int64_t adjusted;
+        CHECKNULL(napi_adjust_external_memory(env, size, &adjusted));
 
         return result;
     }
@@ -122,14 +365,44 @@ namespace nodecallspython
         GIL gil;
         try
         {
-            if (task->m_isFunc)
+            if (task->m_binary)
+            {
+                std::tie(task->m_args, task->m_kwargs) = wire::decodeArguments(task->m_payload.data(), task->m_payload.size());
+
+                auto result = task->m_py->call(task->m_handler, task->m_func, task->m_args, task->m_kwargs);
+                if (task->m_py->isCoroutine(result))
+                    result = task->m_py->runCoroutineSync(result);
+
+                wire::encode(*result, task->m_payload);
+            }
+            else if (task->m_fork)
+                task->m_result = task->m_py->forkCall(task->m_fork, task->m_isFunc, task->m_handler, task->m_func, task->m_args, task->m_kwargs);
+            else if (task->m_isFunc)
+            {
+                auto start = std::chrono::steady_clock::now();
                 task->m_result = task->m_py->call(task->m_handler, task->m_func, task->m_args, task->m_kwargs);
+                task->m_time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            }
             else
                 task->m_handler = task->m_py->create(task->m_handler, task->m_func, task->m_args, task->m_kwargs);
         }
         catch(const std::exception& e)
         {
-            task->m_error = e.what();
+            task->setError(e);
+        }
+    }
+
+    static void PipelineAsync(napi_env env, void* data)
+    {
+        auto task = static_cast<PipelineTask*>(data);
+        GIL gil;
+        try
+        {
+            task->m_results = task->m_py->pipeline(task->m_steps);
+        }
+        catch(const std::exception& e)
+        {
+            task->setError(e);
         }
     }
 
@@ -143,7 +416,7 @@ namespace nodecallspython
         }
         catch(const std::exception& e)
         {
-            task->m_error = e.what();
+            task->setError(e);
         }
     }
 
@@ -151,23 +424,80 @@ namespace nodecallspython
     {
         auto task = static_cast<ImportTask*>(data);
         GIL gil;
+        // the wait for the GIL is not part of the import time, parallel preloads would report each other's imports
+        auto start = std::chrono::steady_clock::now();
         try
         {
             task->m_handler = task->m_py->import(task->m_name, task->m_allowReimport);
+            task->m_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
         } catch(const std::exception& e)
         {
-            task->m_error = e.what();
+            task->setError(e);
+        }
+    }
+
+    static void ReimportAsync(napi_env env, void* data)
+    {
+        auto task = static_cast<ReimportTask*>(data);
+        GIL gil;
+        try
+        {
+            task->m_modules = task->m_py->reimport(task->m_paths);
+        }
+        catch(const std::exception& e)
+        {
+            task->setError(e);
         }
     }
 
+    // must be called from the catch block of e like BaseTask::setError, python exceptions are thrown as JS errors, the rest of the errors as before
+    void throwError(napi_env env, const std::exception& e)
+    {
+        napi_value error = nullptr;
+        try
+        {
+            throw;
+        }
+        catch(const PyError& pyError)
+        {
+            try
+            {
+                error = createJsError(env, pyError);
+            }
+            catch(const std::exception&)
+            {
+            }
+        }
+        catch(...)
+        {
+        }
+
+        if (error)
+            napi_throw(env, error);
+        else
+            napi_throw_error(env, "py", e.what());
+    }
+
     void handleError(napi_env env, const BaseTask& task)
     {
         napi_value undefined;
         CHECK(napi_get_undefined(env, &undefined));
 
-        napi_value error;
+        napi_value error = nullptr;
+        if (task.m_pyError)
+        {
+            try
+            {
+                error = createJsError(env, *task.m_pyError);
+            }
+            catch(const std::exception&)
+            {
+            }
+        }
+
         const std::string unknownError("Unknown python error");
-        CHECK(napi_create_string_utf8(env, task.m_error.empty() ? unknownError.c_str() : task.m_error.c_str(), NAPI_AUTO_LENGTH, &error));
+        if (!error)
+            CHECK(napi_create_string_utf8(env, task.m_error.empty() ? unknownError.c_str() : task.m_error.c_str(), NAPI_AUTO_LENGTH, &error));
 
         napi_value args[] = {undefined, error};
 
@@ -183,7 +513,7 @@ namespace nodecallspython
 
     static void ImportComplete(napi_env env, napi_status status, void* data)
     {
-        std::unique_ptr<ImportTask> task(static_cast<ImportTask*>(data));
+        ImportTaskPool::Ptr task(static_cast<ImportTask*>(data));
         task->m_env = env;
 
         if (!task->m_error.empty())
@@ -193,19 +523,82 @@ namespace nodecallspython
             napi_value global;
             CHECK(napi_get_global(env, &global));
 
-            auto handler = createHandler(env, task.get());
+            napi_value args[3];
+            args[0] = createHandler(env, task.get());
+            CHECK(napi_get_undefined(env, &args[1]));
+            CHECK(napi_create_double(env, task->m_time, &args[2]));
+
+            napi_value callback;
+            CHECK(napi_get_reference_value(env, task->m_callback, &callback));
+
+            napi_value result;
+            CHECK(napi_call_function(env, global, callback, 3, args, &result));
+        }
+    }
+
+    static void CoroutineComplete(napi_env env, napi_value jsCallback, void* context, void* data)
+    {
+        // the task is leaked if the environment is torn down before the coroutine finishes
+        if (!env)
+            return;
+
+        CallTaskPool::Ptr task(static_cast<CallTask*>(context));
+
+        napi_value args;
+        {
+            GIL gil;
+            CPyObject future(reinterpret_cast<PyObject*>(data));
+            try
+            {
+                task->m_result = task->m_py->getCoroutineResult(*future);
+                args = task->m_py->convert(env, *task->m_result);
+            }
+            catch(const std::exception& e)
+            {
+                task->setError(e);
+            }
+        }
+
+        if (!task->m_error.empty())
+            handleError(env, *task);
+        else
+        {
+            napi_value global;
+            CHECK(napi_get_global(env, &global));
 
             napi_value callback;
             CHECK(napi_get_reference_value(env, task->m_callback, &callback));
 
             napi_value result;
-            CHECK(napi_call_function(env, global, callback, 1, &handler, &result));
+            CHECK(napi_call_function(env, global, callback, 1, &args, &result));
+        }
+    }
+
+    // must be called holding the GIL, the task is released by CoroutineComplete once the coroutine is done
+    void scheduleCoroutine(napi_env env, CallTaskPool::Ptr& task)
+    {
+        napi_value workName;
+        CHECK(napi_create_string_utf8(env, "Python::coroutine", NAPI_AUTO_LENGTH, &workName));
+
+        napi_threadsafe_function tsfn;
+        CHECK(napi_create_threadsafe_function(env, nullptr, nullptr, workName, 0, 1, nullptr, nullptr, task.get(), CoroutineComplete, &tsfn));
+
+        try
+        {
+            task->m_py->runCoroutine(task->m_result, tsfn);
+            task.release();
+        }
+        catch(const std::exception& e)
+        {
+            napi_release_threadsafe_function(tsfn, napi_tsfn_abort);
+            task->setError(e);
+            handleError(env, *task);
         }
     }
 
     static void CallComplete(napi_env env, napi_status status, void* data)
     {
-        std::unique_ptr<CallTask> task(static_cast<CallTask*>(data));
+        CallTaskPool::Ptr task(static_cast<CallTask*>(data));
         task->m_env = env;
 
         if (!task->m_error.empty())
@@ -216,9 +609,24 @@ namespace nodecallspython
             CHECK(napi_get_global(env, &global));
 
             napi_value args;
-            if (task->m_isFunc)
+            if (task->m_binary)
+            {
+                CHECK(napi_create_buffer_copy(env, task->m_payload.size(), task->m_payload.data(), nullptr, &args));
+            }
+            else if (task->m_fork)
             {
                 GIL gil;
+                args = task->m_isFunc ? task->m_py->convert(env, *task->m_result) : createForkHandler(env, task->m_fork, *task->m_result);
+            }
+            else if (task->m_isFunc)
+            {
+                GIL gil;
+                if (task->m_py->isCoroutine(task->m_result))
+                {
+                    scheduleCoroutine(env, task);
+                    return;
+                }
+
                 args = task->m_py->convert(env, *task->m_result);
             }
             else
@@ -229,14 +637,44 @@ namespace nodecallspython
             napi_value callback;
             CHECK(napi_get_reference_value(env, task->m_callback, &callback));
 
+            napi_value params[3] = { args };
+            CHECK(napi_get_undefined(env, &params[1]));
+            CHECK(napi_create_double(env, task->m_time, &params[2]));
+
             napi_value result;
-            CHECK(napi_call_function(env, global, callback, 1, &args, &result));
+            CHECK(napi_call_function(env, global, callback, 3, params, &result));
         }
     }
 
-    static void ExecComplete(napi_env env, napi_status status, void* data)
+    napi_value convertPipelineResults(napi_env env, PyInterpreter& py, std::vector<CPyObject>& results, const std::vector<size_t>& outputs, bool hasOutputs)
+    {
+        napi_value result;
+        if (!hasOutputs)
+        {
+            if (results.empty())
+            {
+                CHECKNULL(napi_get_undefined(env, &result));
+            }
+            else
+                result = py.convert(env, *results.back());
+            return result;
+        }
+
+        CHECKNULL(napi_create_array_with_length(env, outputs.size(), &result));
+        for (auto i=0u;i<outputs.size();++i)
+        {
+            if (outputs[i] >= results.size())
+                throw std::runtime_error("Invalid pipeline output: " + std::to_string(outputs[i]));
+
+            CHECKNULL(napi_set_element(env, result, i, py.convert(env, *results[outputs[i]])));
+        }
+
+        return result;
+    }
+
+    static void PipelineComplete(napi_env env, napi_status status, void* data)
     {
-        std::unique_ptr<ExecTask> task(static_cast<ExecTask*>(data));
+        PipelineTaskPool::Ptr task(static_cast<PipelineTask*>(data));
         task->m_env = env;
 
         if (!task->m_error.empty())
@@ -247,8 +685,17 @@ namespace nodecallspython
             CHECK(napi_get_global(env, &global));
 
             napi_value args;
-            GIL gil;
-            args = task->m_py->convert(env, *task->m_result);
+            try
+            {
+                GIL gil;
+                args = convertPipelineResults(env, *task->m_py, task->m_results, task->m_outputs, task->m_hasOutputs);
+            }
+            catch(const std::exception& e)
+            {
+                task->setError(e);
+                handleError(env, *task);
+                return;
+            }
 
             napi_value callback;
             CHECK(napi_get_reference_value(env, task->m_callback, &callback));
@@ -257,15 +704,78 @@ namespace nodecallspython
             CHECK(napi_call_function(env, global, callback, 1, &args, &result));
         }
     }
-    
-    class Python
+
+    static void ExecComplete(napi_env env, napi_status status, void* data)
     {
-        napi_env m_env;
-        napi_ref m_wrapper;
-        static napi_ref constructor;
+        ExecTaskPool::Ptr task(static_cast<ExecTask*>(data));
+        task->m_env = env;
 
-    public:
-        static napi_value Init(napi_env env, napi_value exports)
+        if (!task->m_error.empty())
+            handleError(env, *task);
+        else
+        {
+            napi_value global;
+            CHECK(napi_get_global(env, &global));
+
+            napi_value args;
+            GIL gil;
+            args = task->m_py->convert(env, *task->m_result);
+
+            napi_value callback;
+            CHECK(napi_get_reference_value(env, task->m_callback, &callback));
+
+            napi_value result;
+            CHECK(napi_call_function(env, global, callback, 1, &args, &result));
+        }
+    }
+    
+    static napi_value createStringArray(napi_env env, const std::vector<std::string>& strings)
+    {
+        napi_value array;
+        CHECKNULL(napi_create_array_with_length(env, strings.size(), &array));
+
+        for (size_t i = 0; i < strings.size(); ++i)
+        {
+            napi_value item;
+            CHECKNULL(napi_create_string_utf8(env, strings[i].c_str(), strings[i].size(), &item));
+            CHECKNULL(napi_set_element(env, array, i, item));
+        }
+
+        return array;
+    }
+
+    static void ReimportComplete(napi_env env, napi_status status, void* data)
+    {
+        std::unique_ptr<ReimportTask> task(static_cast<ReimportTask*>(data));
+        task->m_env = env;
+
+        if (!task->m_error.empty())
+            handleError(env, *task);
+        else
+        {
+            napi_value global;
+            CHECK(napi_get_global(env, &global));
+
+            napi_value args = createStringArray(env, task->m_modules);
+            if (!args)
+                return;
+
+            napi_value callback;
+            CHECK(napi_get_reference_value(env, task->m_callback, &callback));
+
+            napi_value result;
+            CHECK(napi_call_function(env, global, callback, 1, &args, &result));
+        }
+    }
+
+    class Python
+    {
+        napi_env m_env;
+        napi_ref m_wrapper;
+        static napi_ref constructor;
+
+    public:
+        static napi_value Init(napi_env env, napi_value exports)
         {
             napi_property_descriptor properties[] = 
             {
@@ -273,6 +783,8 @@ namespace nodecallspython
                 DECLARE_NAPI_METHOD("importSync", importSync),
                 DECLARE_NAPI_METHOD("call", call),
                 DECLARE_NAPI_METHOD("callSync", callSync),
+                DECLARE_NAPI_METHOD("callBinary", callBinary),
+                DECLARE_NAPI_METHOD("callBinarySync", callBinarySync),
                 DECLARE_NAPI_METHOD("create", newClass),
                 DECLARE_NAPI_METHOD("createSync", newClassSync),
                 DECLARE_NAPI_METHOD("fixlink", fixlink),
@@ -282,16 +794,43 @@ namespace nodecallspython
                 DECLARE_NAPI_METHOD("evalSync", evalSync),
                 DECLARE_NAPI_METHOD("addImportPath", addImportPath),
                 DECLARE_NAPI_METHOD("reimport", reimport),
-                DECLARE_NAPI_METHOD("setSyncJsAndPyInCallback", setSyncJsAndPyInCallback)
+                DECLARE_NAPI_METHOD("setSyncJsAndPyInCallback", setSyncJsAndPyInCallback),
+                DECLARE_NAPI_METHOD("setCallbackBatching", setCallbackBatching),
+                DECLARE_NAPI_METHOD("setLazyArguments", setLazyArguments),
+                DECLARE_NAPI_METHOD("setPreserveReferences", setPreserveReferences),
+                DECLARE_NAPI_METHOD("setModuleIndex", setModuleIndex),
+                DECLARE_NAPI_METHOD("buildBundle", buildBundle),
+                DECLARE_NAPI_METHOD("addBundle", addBundle),
+                DECLARE_NAPI_METHOD("materialize", materialize),
+                DECLARE_NAPI_METHOD("pipeline", pipeline),
+                DECLARE_NAPI_METHOD("pipelineSync", pipelineSync),
+                DECLARE_NAPI_METHOD("fork", fork),
+                DECLARE_NAPI_METHOD("forkCall", forkCall),
+                DECLARE_NAPI_METHOD("forkCallSync", forkCallSync),
+                DECLARE_NAPI_METHOD("releaseFork", releaseFork),
+                DECLARE_NAPI_METHOD("registerCallback", registerCallback),
+                DECLARE_NAPI_METHOD("cacheKey", cacheKey),
+                DECLARE_NAPI_METHOD("release", release),
+                DECLARE_NAPI_METHOD("memoryStats", memoryStats)
             };
 
             napi_value cons;
-            CHECKNULL(napi_define_class(env, "PyInterpreter", NAPI_AUTO_LENGTH, create, nullptr, 14, properties, &cons));
+            CHECKNULL(napi_define_class(env, "PyInterpreter", NAPI_AUTO_LENGTH, create, nullptr, sizeof(properties) / sizeof(properties[0]), properties, &cons));
 
             CHECKNULL(napi_create_reference(env, cons, 1, &constructor));
 
             CHECKNULL(napi_set_named_property(env, exports, "PyInterpreter", cons));
 
+            try
+            {
+                CHECKNULL(napi_set_named_property(env, exports, "PyError", getPyErrorClass(env)));
+            }
+            catch(const std::exception& e)
+            {
+                napi_throw_error(env, "py", e.what());
+                return nullptr;
+            }
+
             return exports;
         }
 
@@ -305,9 +844,12 @@ namespace nodecallspython
             try
             {
                 napi_value jsthis;
-                size_t argc = 100;
-                napi_value args[100];
-                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+                size_t argc = 0;
+                CHECKNULL(napi_get_cb_info(env, info, &argc, nullptr, nullptr, nullptr));
+
+                ArgumentBuffer buffer(argc);
+                auto args = buffer.data();
+                CHECKNULL(napi_get_cb_info(env, info, &argc, args, &jsthis, nullptr));
 
                 if (argc < 2)
                 {
@@ -326,30 +868,36 @@ namespace nodecallspython
 
                 if (handlerT == napi_object && funcT == napi_string)
                 {
-                    napi_value key;
-                    CHECKNULL(napi_create_string_utf8(env, "handler", NAPI_AUTO_LENGTH, &key));
-
                     napi_value value;
-                    CHECKNULL(napi_get_property(env, args[0], key, &value));
+                    CHECKNULL(napi_get_named_property(env, args[0], "handler", &value));
 
-                    auto handler = convertString(env, value);
-                    auto func = convertString(env, args[1]);
+                    // the strings of a pooled task are reused, so the call does not allocate in steady state
+                    CallTaskPool::Ptr task(CallTaskPool::acquire());
+                    convertString(env, value, task->m_handler);
+                    convertString(env, args[1], task->m_func);
+
+                    auto& handler = task->m_handler;
+                    auto& func = task->m_func;
 
-                    std::vector<napi_value> napiargs;
-                    napiargs.reserve(argc - 2);
-                    for (auto i=2u;i<argc - (sync ? 0 : 1);++i)
-                        napiargs.push_back(args[i]);
+                    auto end = sync ? argc : argc - 1;
+                    auto napiargc = end > 2 ? end - 2 : 0;
 
                     if (sync)
                     {
                         GIL gil;
+                        // lazy arguments must not outlive the call, objects created by createSync would keep them
                         auto& py = obj->getInterpreter();
-                        auto pyArgs = py.convert(env, napiargs, true);
+                        auto lazy = isFunc && py.lazyArguments() && !py.isCoroutineFunction(handler, func);
+                        std::unique_ptr<ProxyScope> proxies(lazy ? new ProxyScope : nullptr);
+                        auto pyArgs = py.convert(env, args + 2, napiargc, true);
 
                         napi_value result;
                         if (isFunc)
                         {
                             auto pyres = py.call(handler, func, pyArgs.first, pyArgs.second);
+                            if (py.isCoroutine(pyres))
+                                pyres = py.runCoroutineSync(pyres);
+
                             if (pyres)
                                 result = py.convert(env, *pyres);
                             else
@@ -370,11 +918,7 @@ namespace nodecallspython
 
                         if (callbackT == napi_function)
                         {
-                            CallTask* task = new CallTask;
                             task->m_py = &(obj->getInterpreter());
-
-                            task->m_handler = convertString(env, value);
-                            task->m_func = convertString(env, args[1]);
                             task->m_isFunc = isFunc;
 
                             napi_value optname;
@@ -382,13 +926,15 @@ namespace nodecallspython
 
                             {
                                 GIL gil;
-                                std::tie(task->m_args, task->m_kwargs) = obj->getInterpreter().convert(env, napiargs, false);
+                                std::tie(task->m_args, task->m_kwargs) = obj->getInterpreter().convert(env, args + 2, napiargc, false);
                             }
 
+                            task->m_env = env;
                             CHECKNULL(napi_create_reference(env, args[argc - 1], 1, &task->m_callback));
 
-                            CHECKNULL(napi_create_async_work(env, args[1], optname, CallAsync, CallComplete, task, &task->m_work));
+                            CHECKNULL(napi_create_async_work(env, args[1], optname, CallAsync, CallComplete, task.get(), &task->m_work));
                             CHECKNULL(napi_queue_async_work(env, task->m_work));
+                            task.release();
                         }
                     }
                 }
@@ -399,22 +945,22 @@ namespace nodecallspython
             }
             catch(const std::exception& e)
             {
-                napi_throw_error(env, "py", e.what());
+                throwError(env, e);
             }
 
             return nullptr;
         }
 
-        static napi_value execImpl(napi_env env, napi_callback_info info, bool eval, bool sync)
+        static napi_value callBinaryImpl(napi_env env, napi_callback_info info, bool sync)
         {
             try
             {
                 napi_value jsthis;
-                size_t argc = 3;
-                napi_value args[3];
+                size_t argc = 4;
+                napi_value args[4];
                 CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
 
-                if (argc < 2)
+                if (argc != (sync ? 3u : 4u))
                 {
                     napi_throw_error(env, "args", "Wrong number of arguments");
                     return nullptr;
@@ -426,51 +972,62 @@ namespace nodecallspython
                 napi_valuetype handlerT;
                 CHECKNULL(napi_typeof(env, args[0], &handlerT));
 
-                napi_valuetype codeToExecT;
-                CHECKNULL(napi_typeof(env, args[1], &codeToExecT));
+                napi_valuetype funcT;
+                CHECKNULL(napi_typeof(env, args[1], &funcT));
 
-                if (handlerT == napi_object && codeToExecT == napi_string)
+                bool isBuffer = false;
+                CHECKNULL(napi_is_buffer(env, args[2], &isBuffer));
+
+                napi_valuetype callbackT = napi_function;
+                if (!sync)
+                    CHECKNULL(napi_typeof(env, args[3], &callbackT));
+
+                if (handlerT == napi_object && funcT == napi_string && isBuffer && callbackT == napi_function)
                 {
-                    napi_value key;
-                    CHECKNULL(napi_create_string_utf8(env, "handler", NAPI_AUTO_LENGTH, &key));
+                    void* data = nullptr;
+                    size_t length = 0;
+                    CHECKNULL(napi_get_buffer_info(env, args[2], &data, &length));
 
                     napi_value value;
-                    CHECKNULL(napi_get_property(env, args[0], key, &value));
+                    CHECKNULL(napi_get_named_property(env, args[0], "handler", &value));
+
+                    CallTaskPool::Ptr task(CallTaskPool::acquire());
+                    task->m_py = &(obj->getInterpreter());
+                    task->m_binary = true;
+                    task->m_isFunc = true;
+                    task->m_payload.assign(static_cast<const char*>(data), length);
+                    convertString(env, value, task->m_handler);
+                    convertString(env, args[1], task->m_func);
 
                     if (sync)
                     {
-                        GIL gil;
-                        auto& py = obj->getInterpreter();
-                        auto pyres = py.exec(convertString(env, value), convertString(env, args[1]), eval);
+                        {
+                            GIL gil;
+                            auto& py = *task->m_py;
+                            std::tie(task->m_args, task->m_kwargs) = wire::decodeArguments(task->m_payload.data(), task->m_payload.size());
+
+                            auto result = py.call(task->m_handler, task->m_func, task->m_args, task->m_kwargs);
+                            if (py.isCoroutine(result))
+                                result = py.runCoroutineSync(result);
+
+                            wire::encode(*result, task->m_payload);
+                        }
+
                         napi_value result;
-                        if (pyres)
-                            result = py.convert(env, *pyres);
-                        else
-                            CHECKNULL(napi_get_undefined(env, &result));
+                        CHECKNULL(napi_create_buffer_copy(env, task->m_payload.size(), task->m_payload.data(), nullptr, &result));
                         return result;
                     }
                     else
                     {
-                        napi_valuetype callbackT;
-                        CHECKNULL(napi_typeof(env, args[argc - 1], &callbackT));
-
-                        if (callbackT == napi_function)
-                        {
-                            ExecTask* task = new ExecTask;
-                            task->m_py = &(obj->getInterpreter());
-
-                            task->m_handler = convertString(env, value);
-                            task->m_code = convertString(env, args[1]);
-                            task->m_eval = eval;
-
-                            napi_value optname;
-                            napi_create_string_utf8(env, "Python::exec", NAPI_AUTO_LENGTH, &optname);
+                        napi_value optname;
+                        CHECKNULL(napi_create_string_utf8(env, "Python::callBinary", NAPI_AUTO_LENGTH, &optname));
 
-                            CHECKNULL(napi_create_reference(env, args[argc - 1], 1, &task->m_callback));
+                        task->m_env = env;
+                        CHECKNULL(napi_create_reference(env, args[3], 1, &task->m_callback));
 
-                            CHECKNULL(napi_create_async_work(env, args[1], optname, ExecAsync, ExecComplete, task, &task->m_work));
-                            CHECKNULL(napi_queue_async_work(env, task->m_work));
-                        }
+                        CHECKNULL(napi_create_async_work(env, args[1], optname, CallAsync, CallComplete, task.get(), &task->m_work));
+                        CHECKNULL(napi_queue_async_work(env, task->m_work));
+                        task.release();
                     }
                 }
                 else
@@ -480,22 +1037,25 @@ namespace nodecallspython
             }
             catch(const std::exception& e)
             {
-                napi_throw_error(env, "py", e.what());
+                throwError(env, e);
             }
 
             return nullptr;
         }
 
-        static napi_value importImpl(napi_env env, napi_callback_info info, bool sync) 
+        static napi_value forkCallImpl(napi_env env, napi_callback_info info, bool sync)
         {
             try
             {
                 napi_value jsthis;
-                size_t argc = 3;
-                napi_value args[3];
-                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+                size_t argc = 0;
+                CHECKNULL(napi_get_cb_info(env, info, &argc, nullptr, nullptr, nullptr));
 
-                if (argc != 2 && argc != 3)
+                ArgumentBuffer buffer(argc);
+                auto args = buffer.data();
+                CHECKNULL(napi_get_cb_info(env, info, &argc, args, &jsthis, nullptr));
+
+                if (argc < 4)
                 {
                     napi_throw_error(env, "args", "Wrong number of arguments");
                     return nullptr;
@@ -504,45 +1064,73 @@ namespace nodecallspython
                 Python* obj;
                 CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
 
-                napi_valuetype moduleT;
-                CHECKNULL(napi_typeof(env, args[0], &moduleT));
+                napi_valuetype pidT;
+                CHECKNULL(napi_typeof(env, args[0], &pidT));
 
-                napi_valuetype allowReimportT;
-                CHECKNULL(napi_typeof(env, args[1], &allowReimportT));
+                napi_valuetype isFuncT;
+                CHECKNULL(napi_typeof(env, args[1], &isFuncT));
 
-                if (moduleT == napi_string && allowReimportT == napi_boolean)
+                napi_valuetype handlerT;
+                CHECKNULL(napi_typeof(env, args[2], &handlerT));
+
+                napi_valuetype funcT;
+                CHECKNULL(napi_typeof(env, args[3], &funcT));
+
+                if (pidT == napi_number && isFuncT == napi_boolean && handlerT == napi_object && funcT == napi_string)
                 {
-                    auto allowReimport = false;
-                    CHECKNULL(napi_get_value_bool(env, args[1], &allowReimport));
+                    int pid = 0;
+                    CHECKNULL(napi_get_value_int32(env, args[0], &pid));
+
+                    bool isFunc = false;
+                    CHECKNULL(napi_get_value_bool(env, args[1], &isFunc));
 
+                    napi_value value;
+                    CHECKNULL(napi_get_named_property(env, args[2], "handler", &value));
+
+                    auto handler = convertString(env, value);
+                    auto func = convertString(env, args[3]);
+
+                    auto end = sync ? argc : argc - 1;
+                    auto napiargc = end > 4 ? end - 4 : 0;
+
+                    auto& py = obj->getInterpreter();
                     if (sync)
                     {
                         GIL gil;
-                        auto name = convertString(env, args[0]);
-                        auto& py = obj->getInterpreter();
-
-                        auto handler = py.import(name, allowReimport);
-                        return createHandler(env, &py, handler);
+                        auto pyArgs = py.convert(env, args + 4, napiargc, true);
+                        auto fork = py.findFork(pid);
+                        auto pyres = py.forkCall(fork, isFunc, handler, func, pyArgs.first, pyArgs.second);
+                        return isFunc ? py.convert(env, *pyres) : createForkHandler(env, fork, *pyres);
                     }
                     else
                     {
                         napi_valuetype callbackT;
-                        CHECKNULL(napi_typeof(env, args[2], &callbackT));
+                        CHECKNULL(napi_typeof(env, args[argc - 1], &callbackT));
 
                         if (callbackT == napi_function)
                         {
-                            ImportTask* task = new ImportTask;
-                            task->m_py = &(obj->getInterpreter());
-                            task->m_name = convertString(env, args[0]);
-                            task->m_allowReimport = allowReimport;
+                            CallTaskPool::Ptr task(CallTaskPool::acquire());
+                            task->m_py = &py;
+                            // the fork is resolved now, so a release before the call runs does not fail it
+                            task->m_fork = py.findFork(pid);
+                            task->m_handler = handler;
+                            task->m_func = func;
+                            task->m_isFunc = isFunc;
+
+                            {
+                                GIL gil;
+                                std::tie(task->m_args, task->m_kwargs) = py.convert(env, args + 4, napiargc, false);
+                            }
 
                             napi_value optname;
-                            napi_create_string_utf8(env, "Python::import", NAPI_AUTO_LENGTH, &optname);
+                            CHECKNULL(napi_create_string_utf8(env, "Python::forkCall", NAPI_AUTO_LENGTH, &optname));
 
-                            CHECKNULL(napi_create_reference(env, args[2], 1, &task->m_callback));
+                            task->m_env = env;
+                            CHECKNULL(napi_create_reference(env, args[argc - 1], 1, &task->m_callback));
 
-                            CHECKNULL(napi_create_async_work(env, args[2], optname, ImportAsync, ImportComplete, task, &task->m_work));
+                            CHECKNULL(napi_create_async_work(env, args[3], optname, CallAsync, CallComplete, task.get(), &task->m_work));
                             CHECKNULL(napi_queue_async_work(env, task->m_work));
+                            task.release();
                         }
                     }
                 }
@@ -553,195 +1141,946 @@ namespace nodecallspython
             }
             catch(const std::exception& e)
             {
-                napi_throw_error(env, "py", e.what());
+                throwError(env, e);
             }
 
             return nullptr;
         }
 
-    private:
-        std::unique_ptr<PyInterpreter> m_py;
-        
-        Python(napi_env env) : m_env(env), m_wrapper(nullptr)
-        {
-            m_py = std::make_unique<PyInterpreter>();
-        }
-
-        ~Python()
-        {
-            napi_delete_reference(m_env, m_wrapper);
-        }
-
-        PyInterpreter& getInterpreter() { return *m_py; }
-        
-        static napi_value create(napi_env env, napi_callback_info info) 
+        static napi_value fork(napi_env env, napi_callback_info info)
         {
-            napi_value target;
-            CHECKNULL(napi_get_new_target(env, info, &target));
-            auto isConstructor = target != nullptr;
-
-            if (isConstructor) 
+            try
             {
                 napi_value jsthis;
-                CHECKNULL(napi_get_cb_info(env, info, nullptr, 0, &jsthis, nullptr));
+                CHECKNULL(napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr));
 
-                Python* obj = new Python(env);
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
 
-                CHECKNULL(napi_wrap(env, jsthis, reinterpret_cast<void*>(obj), Python::Destructor, nullptr, &obj->m_wrapper));
+                int pid = 0;
+                {
+                    GIL gil;
+                    pid = obj->getInterpreter().fork();
+                }
 
-                return jsthis;
-            } 
-            else 
+                napi_value result;
+                CHECKNULL(napi_create_int32(env, pid, &result));
+                return result;
+            }
+            catch(const std::exception& e)
             {
-                napi_value jsthis;
-                CHECKNULL(napi_get_cb_info(env, info, nullptr, 0, &jsthis, nullptr));
-
-                napi_value cons;
-                CHECKNULL(napi_get_reference_value(env, constructor, &cons));
-
-                napi_value instance;
-                CHECKNULL(napi_new_instance(env, cons, 0, nullptr, &instance));
-
-                return instance;
+                throwError(env, e);
             }
-        }
 
-        static std::string convertString(napi_env env, napi_value value)
-        {
-            size_t length = 0;
-            napi_get_value_string_utf8(env, value, NULL, 0, &length);
-            std::string result(length, ' ');
-            napi_get_value_string_utf8(env, value, &result[0], length + 1, &length);
-            return result;
+            return nullptr;
         }
 
-        static napi_value import(napi_env env, napi_callback_info info) 
+        static napi_value releaseFork(napi_env env, napi_callback_info info)
         {
-            return importImpl(env, info, false); 
-        }
+            napi_value jsthis;
+            size_t argc = 1;
+            napi_value args[1];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
 
-        static napi_value importSync(napi_env env, napi_callback_info info) 
-        {
-            return importImpl(env, info, true); 
-        }
+            if (argc != 1)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
+            }
 
-        static napi_value call(napi_env env, napi_callback_info info) 
-        {
-            return callImpl(env, info, true, false); 
-        }
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
 
-        static napi_value callSync(napi_env env, napi_callback_info info) 
-        {
-            return callImpl(env, info, true, true); 
-        }
+            napi_valuetype pidT;
+            CHECKNULL(napi_typeof(env, args[0], &pidT));
 
-        static napi_value exec(napi_env env, napi_callback_info info)
-        {
-            return execImpl(env, info, false, false);
-        }
+            if (pidT == napi_number)
+            {
+                int pid = 0;
+                CHECKNULL(napi_get_value_int32(env, args[0], &pid));
 
-        static napi_value execSync(napi_env env, napi_callback_info info)
-        {
-            return execImpl(env, info, false, true);
-        }
+                obj->getInterpreter().releaseFork(pid);
+            }
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
 
-        static napi_value eval(napi_env env, napi_callback_info info)
-        {
-            return execImpl(env, info, true, false);
+            return nullptr;
         }
 
-        static napi_value evalSync(napi_env env, napi_callback_info info)
+        static napi_value execImpl(napi_env env, napi_callback_info info, bool eval, bool sync)
+        {
+            try
+            {
+                napi_value jsthis;
+                size_t argc = 3;
+                napi_value args[3];
+                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+                if (argc < 2)
+                {
+                    napi_throw_error(env, "args", "Wrong number of arguments");
+                    return nullptr;
+                }
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                napi_valuetype handlerT;
+                CHECKNULL(napi_typeof(env, args[0], &handlerT));
+
+                napi_valuetype codeToExecT;
+                CHECKNULL(napi_typeof(env, args[1], &codeToExecT));
+
+                if (handlerT == napi_object && codeToExecT == napi_string)
+                {
+                    napi_value key;
+                    CHECKNULL(napi_create_string_utf8(env, "handler", NAPI_AUTO_LENGTH, &key));
+
+                    napi_value value;
+                    CHECKNULL(napi_get_property(env, args[0], key, &value));
+
+                    if (sync)
+                    {
+                        GIL gil;
+                        auto& py = obj->getInterpreter();
+                        auto pyres = py.exec(convertString(env, value), convertString(env, args[1]), eval);
+                        napi_value result;
+                        if (pyres)
+                            result = py.convert(env, *pyres);
+                        else
+                            CHECKNULL(napi_get_undefined(env, &result));
+                        return result;
+                    }
+                    else
+                    {
+                        napi_valuetype callbackT;
+                        CHECKNULL(napi_typeof(env, args[argc - 1], &callbackT));
+
+                        if (callbackT == napi_function)
+                        {
+                            ExecTaskPool::Ptr task(ExecTaskPool::acquire());
+                            task->m_py = &(obj->getInterpreter());
+
+                            task->m_handler = convertString(env, value);
+                            task->m_code = convertString(env, args[1]);
+                            task->m_eval = eval;
+
+                            napi_value optname;
+                            napi_create_string_utf8(env, "Python::exec", NAPI_AUTO_LENGTH, &optname);
+
+                            task->m_env = env;
+                            CHECKNULL(napi_create_reference(env, args[argc - 1], 1, &task->m_callback));
+
+                            CHECKNULL(napi_create_async_work(env, args[1], optname, ExecAsync, ExecComplete, task.get(), &task->m_work));
+                            CHECKNULL(napi_queue_async_work(env, task->m_work));
+                            task.release();
+                        }
+                    }
+                }
+                else
+                {
+                    napi_throw_error(env, "args", "Wrong type of arguments");
+                }
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+        static void convertPipeline(napi_env env, PyInterpreter& py, napi_value steps, napi_value outputs, bool sync, std::vector<PipelineStep>& pySteps, std::vector<size_t>& pyOutputs, bool& hasOutputs)
+        {
+            // the steps are built by index.js, a failing napi call means they were passed in some other way
+            auto check = [](napi_status status) {
+                if (status != napi_ok)
+                    throw std::runtime_error("Wrong type of arguments");
+            };
+
+            uint32_t length = 0;
+            check(napi_get_array_length(env, steps, &length));
+
+            pySteps.resize(length);
+            for (auto i=0u;i<length;++i)
+            {
+                auto& pyStep = pySteps[i];
+
+                napi_value step;
+                napi_value stepItems[4];
+                check(napi_get_element(env, steps, i, &step));
+
+                for (auto j=0u;j<4;++j)
+                    check(napi_get_element(env, step, j, &stepItems[j]));
+
+                napi_valuetype handlerT;
+                check(napi_typeof(env, stepItems[0], &handlerT));
+                if (handlerT == napi_number)
+                {
+                    uint32_t handlerStep = 0;
+                    check(napi_get_value_uint32(env, stepItems[0], &handlerStep));
+                    pyStep.handlerStep = handlerStep;
+                }
+                else if (handlerT == napi_object)
+                {
+                    napi_value handler;
+                    check(napi_get_named_property(env, stepItems[0], "handler", &handler));
+                    pyStep.handler = convertString(env, handler);
+                }
+                else
+                    throw std::runtime_error("Wrong type of arguments");
+
+                napi_valuetype funcT;
+                check(napi_typeof(env, stepItems[1], &funcT));
+                if (funcT != napi_string)
+                    throw std::runtime_error("Wrong type of arguments");
+                pyStep.func = convertString(env, stepItems[1]);
+
+                uint32_t argc = 0;
+                check(napi_get_array_length(env, stepItems[2], &argc));
+                std::vector<napi_value> napiargs(argc);
+                for (auto j=0u;j<argc;++j)
+                    check(napi_get_element(env, stepItems[2], j, &napiargs[j]));
+
+                std::tie(pyStep.args, pyStep.kwargs) = py.convert(env, napiargs, sync);
+
+                uint32_t refc = 0;
+                check(napi_get_array_length(env, stepItems[3], &refc));
+                for (auto j=0u;j + 1<refc;j+=2)
+                {
+                    napi_value pos, ref;
+                    check(napi_get_element(env, stepItems[3], j, &pos));
+                    check(napi_get_element(env, stepItems[3], j + 1, &ref));
+
+                    uint32_t posValue = 0, refValue = 0;
+                    check(napi_get_value_uint32(env, pos, &posValue));
+                    check(napi_get_value_uint32(env, ref, &refValue));
+                    pyStep.refs.push_back({ posValue, refValue });
+                }
+            }
+
+            bool isarray = false;
+            check(napi_is_array(env, outputs, &isarray));
+            hasOutputs = isarray;
+            if (isarray)
+            {
+                uint32_t outputc = 0;
+                check(napi_get_array_length(env, outputs, &outputc));
+                for (auto i=0u;i<outputc;++i)
+                {
+                    napi_value output;
+                    check(napi_get_element(env, outputs, i, &output));
+
+                    uint32_t outputValue = 0;
+                    check(napi_get_value_uint32(env, output, &outputValue));
+                    pyOutputs.push_back(outputValue);
+                }
+            }
+        }
+
+        static napi_value pipelineImpl(napi_env env, napi_callback_info info, bool sync)
+        {
+            try
+            {
+                napi_value jsthis;
+                size_t argc = 3;
+                napi_value args[3];
+                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+                if (argc != (sync ? 2 : 3))
+                {
+                    napi_throw_error(env, "args", "Wrong number of arguments");
+                    return nullptr;
+                }
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                auto& py = obj->getInterpreter();
+
+                if (sync)
+                {
+                    GIL gil;
+                    std::vector<PipelineStep> steps;
+                    std::vector<size_t> outputs;
+                    bool hasOutputs = false;
+                    convertPipeline(env, py, args[0], args[1], true, steps, outputs, hasOutputs);
+
+                    auto results = py.pipeline(steps);
+                    return convertPipelineResults(env, py, results, outputs, hasOutputs);
+                }
+                else
+                {
+                    napi_valuetype callbackT;
+                    CHECKNULL(napi_typeof(env, args[2], &callbackT));
+
+                    if (callbackT == napi_function)
+                    {
+                        PipelineTaskPool::Ptr task(PipelineTaskPool::acquire());
+                        task->m_py = &py;
+                        task->m_env = env;
+
+                        {
+                            GIL gil;
+                            convertPipeline(env, py, args[0], args[1], false, task->m_steps, task->m_outputs, task->m_hasOutputs);
+                        }
+
+                        napi_value optname;
+                        napi_create_string_utf8(env, "Python::pipeline", NAPI_AUTO_LENGTH, &optname);
+
+                        CHECKNULL(napi_create_reference(env, args[2], 1, &task->m_callback));
+
+                        CHECKNULL(napi_create_async_work(env, args[2], optname, PipelineAsync, PipelineComplete, task.get(), &task->m_work));
+                        CHECKNULL(napi_queue_async_work(env, task->m_work));
+                        task.release();
+                    }
+                    else
+                    {
+                        napi_throw_error(env, "args", "Wrong type of arguments");
+                    }
+                }
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+        static napi_value importImpl(napi_env env, napi_callback_info info, bool sync) 
+        {
+            try
+            {
+                napi_value jsthis;
+                size_t argc = 3;
+                napi_value args[3];
+                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+                if (argc != 2 && argc != 3)
+                {
+                    napi_throw_error(env, "args", "Wrong number of arguments");
+                    return nullptr;
+                }
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                napi_valuetype moduleT;
+                CHECKNULL(napi_typeof(env, args[0], &moduleT));
+
+                napi_valuetype allowReimportT;
+                CHECKNULL(napi_typeof(env, args[1], &allowReimportT));
+
+                if (moduleT == napi_string && allowReimportT == napi_boolean)
+                {
+                    auto allowReimport = false;
+                    CHECKNULL(napi_get_value_bool(env, args[1], &allowReimport));
+
+                    if (sync)
+                    {
+                        GIL gil;
+                        auto name = convertString(env, args[0]);
+                        auto& py = obj->getInterpreter();
+
+                        auto handler = py.import(name, allowReimport);
+                        return createHandler(env, &py, handler);
+                    }
+                    else
+                    {
+                        napi_valuetype callbackT;
+                        CHECKNULL(napi_typeof(env, args[2], &callbackT));
+
+                        if (callbackT == napi_function)
+                        {
+                            ImportTaskPool::Ptr task(ImportTaskPool::acquire());
+                            task->m_py = &(obj->getInterpreter());
+                            task->m_name = convertString(env, args[0]);
+                            task->m_allowReimport = allowReimport;
+
+                            napi_value optname;
+                            napi_create_string_utf8(env, "Python::import", NAPI_AUTO_LENGTH, &optname);
+
+                            task->m_env = env;
+                            CHECKNULL(napi_create_reference(env, args[2], 1, &task->m_callback));
+
+                            CHECKNULL(napi_create_async_work(env, args[2], optname, ImportAsync, ImportComplete, task.get(), &task->m_work));
+                            CHECKNULL(napi_queue_async_work(env, task->m_work));
+                            task.release();
+                        }
+                    }
+                }
+                else
+                {
+                    napi_throw_error(env, "args", "Wrong type of arguments");
+                }
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+    private:
+        std::shared_ptr<PyInterpreter> m_py;
+        
+        Python(napi_env env) : m_env(env), m_wrapper(nullptr)
+        {
+            m_py = std::make_shared<PyInterpreter>();
+        }
+
+        ~Python()
+        {
+            napi_delete_reference(m_env, m_wrapper);
+        }
+
+        PyInterpreter& getInterpreter() { return *m_py; }
+        
+        static napi_value create(napi_env env, napi_callback_info info) 
+        {
+            napi_value target;
+            CHECKNULL(napi_get_new_target(env, info, &target));
+            auto isConstructor = target != nullptr;
+
+            if (isConstructor) 
+            {
+                napi_value jsthis;
+                CHECKNULL(napi_get_cb_info(env, info, nullptr, 0, &jsthis, nullptr));
+
+                Python* obj = new Python(env);
+
+                CHECKNULL(napi_wrap(env, jsthis, reinterpret_cast<void*>(obj), Python::Destructor, nullptr, &obj->m_wrapper));
+
+                return jsthis;
+            } 
+            else 
+            {
+                napi_value jsthis;
+                CHECKNULL(napi_get_cb_info(env, info, nullptr, 0, &jsthis, nullptr));
+
+                napi_value cons;
+                CHECKNULL(napi_get_reference_value(env, constructor, &cons));
+
+                napi_value instance;
+                CHECKNULL(napi_new_instance(env, cons, 0, nullptr, &instance));
+
+                return instance;
+            }
+        }
+
+        static void convertString(napi_env env, napi_value value, std::string& result)
+        {
+            size_t length = 0;
+            napi_get_value_string_utf8(env, value, NULL, 0, &length);
+            result.resize(length);
+            napi_get_value_string_utf8(env, value, &result[0], length + 1, &length);
+        }
+
+        static std::string convertString(napi_env env, napi_value value)
+        {
+            size_t length = 0;
+            napi_get_value_string_utf8(env, value, NULL, 0, &length);
+            std::string result(length, ' ');
+            napi_get_value_string_utf8(env, value, &result[0], length + 1, &length);
+            return result;
+        }
+
+        static napi_value import(napi_env env, napi_callback_info info) 
+        {
+            return importImpl(env, info, false); 
+        }
+
+        static napi_value importSync(napi_env env, napi_callback_info info) 
+        {
+            return importImpl(env, info, true); 
+        }
+
+        static napi_value call(napi_env env, napi_callback_info info) 
+        {
+            return callImpl(env, info, true, false); 
+        }
+
+        static napi_value callSync(napi_env env, napi_callback_info info) 
+        {
+            return callImpl(env, info, true, true); 
+        }
+
+        static napi_value pipeline(napi_env env, napi_callback_info info)
+        {
+            return pipelineImpl(env, info, false);
+        }
+
+        static napi_value pipelineSync(napi_env env, napi_callback_info info)
+        {
+            return pipelineImpl(env, info, true);
+        }
+
+        static napi_value exec(napi_env env, napi_callback_info info)
+        {
+            return execImpl(env, info, false, false);
+        }
+
+        static napi_value execSync(napi_env env, napi_callback_info info)
+        {
+            return execImpl(env, info, false, true);
+        }
+
+        static napi_value eval(napi_env env, napi_callback_info info)
+        {
+            return execImpl(env, info, true, false);
+        }
+
+        static napi_value evalSync(napi_env env, napi_callback_info info)
         {
             return execImpl(env, info, true, true);
         }
 
-        static napi_value newClass(napi_env env, napi_callback_info info) 
+        static napi_value callBinary(napi_env env, napi_callback_info info)
+        {
+            return callBinaryImpl(env, info, false);
+        }
+
+        static napi_value callBinarySync(napi_env env, napi_callback_info info)
+        {
+            return callBinaryImpl(env, info, true);
+        }
+
+        static napi_value forkCall(napi_env env, napi_callback_info info)
+        {
+            return forkCallImpl(env, info, false);
+        }
+
+        static napi_value forkCallSync(napi_env env, napi_callback_info info)
+        {
+            return forkCallImpl(env, info, true);
+        }
+
+        static napi_value newClass(napi_env env, napi_callback_info info) 
+        {
+            return callImpl(env, info, false, false); 
+        }
+
+        static napi_value newClassSync(napi_env env, napi_callback_info info) 
+        {
+            return callImpl(env, info, false, true); 
+        }
+
+        static std::pair<std::string, Python*> getStringArgument(napi_env env, napi_callback_info info)
+        {
+            napi_value jsthis;
+            size_t argc = 1;
+            napi_value args[1];
+            CHECKNONE(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1)
+            {
+                napi_throw_error(env, "args", "Must have 1 arguments");
+                return {};
+            }
+
+            Python* obj;
+            CHECKNONE(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype valuetype;
+            CHECKNONE(napi_typeof(env, args[0], &valuetype));
+
+            if (valuetype == napi_string)
+                return { convertString(env, args[0]), obj };
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
+
+            return {};
+        }
+
+        static napi_value fixlink(napi_env env, napi_callback_info info)
+        {
+#ifdef WIN32
+            return nullptr;
+#else
+            std::string filename;
+            Python* obj = nullptr;
+            std::tie(filename, obj) = getStringArgument(env, info);
+            if (filename.empty() || !obj)
+                return nullptr;
+
+            auto result = dlopen(filename.c_str(), RTLD_LAZY | RTLD_GLOBAL);
+            if (!result)
+            {
+                auto error = dlerror();
+                if (error)
+                    napi_throw_error(env, "args", error);
+                else
+                    napi_throw_error(env, "args", "Unknown error of dlopen");
+            }
+            
+            return nullptr;
+#endif
+        }
+
+        // reimport(paths) reloads on the JS thread, reimport(paths, callback) on the thread pool, paths is a string or an array of strings
+        static napi_value reimport(napi_env env, napi_callback_info info)
+        {
+            napi_value jsthis;
+            size_t argc = 2;
+            napi_value args[2];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1 && argc != 2)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
+            }
+
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            std::vector<std::string> paths;
+            napi_valuetype pathsT;
+            CHECKNULL(napi_typeof(env, args[0], &pathsT));
+
+            bool isArray = false;
+            CHECKNULL(napi_is_array(env, args[0], &isArray));
+
+            if (pathsT == napi_string)
+                paths.push_back(convertString(env, args[0]));
+            else if (isArray)
+            {
+                uint32_t length = 0;
+                CHECKNULL(napi_get_array_length(env, args[0], &length));
+                for (uint32_t i = 0; i < length; ++i)
+                {
+                    napi_value item;
+                    CHECKNULL(napi_get_element(env, args[0], i, &item));
+
+                    napi_valuetype itemT;
+                    CHECKNULL(napi_typeof(env, item, &itemT));
+                    if (itemT != napi_string)
+                    {
+                        napi_throw_error(env, "args", "Wrong type of arguments");
+                        return nullptr;
+                    }
+                    paths.push_back(convertString(env, item));
+                }
+            }
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+                return nullptr;
+            }
+
+            auto& py = obj->getInterpreter();
+            if (argc == 1)
+            {
+                try
+                {
+                    GIL gil;
+                    return createStringArray(env, py.reimport(paths));
+                }
+                catch(const std::exception& e)
+                {
+                    throwError(env, e);
+                }
+                return nullptr;
+            }
+
+            napi_valuetype callbackT;
+            CHECKNULL(napi_typeof(env, args[1], &callbackT));
+            if (callbackT != napi_function)
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+                return nullptr;
+            }
+
+            auto task = new ReimportTask;
+            task->m_py = &py;
+            task->m_paths = std::move(paths);
+
+            napi_value optname;
+            napi_create_string_utf8(env, "Python::reimport", NAPI_AUTO_LENGTH, &optname);
+
+            task->m_env = env;
+            CHECKNULL(napi_create_reference(env, args[1], 1, &task->m_callback));
+
+            CHECKNULL(napi_create_async_work(env, args[1], optname, ReimportAsync, ReimportComplete, task, &task->m_work));
+            CHECKNULL(napi_queue_async_work(env, task->m_work));
+
+            return nullptr;
+        }
+
+        static napi_value addImportPath(napi_env env, napi_callback_info info)
+        {
+            std::string path;
+            Python* obj = nullptr;
+            std::tie(path, obj) = getStringArgument(env, info);
+            if (path.empty() || !obj)
+                return nullptr;
+
+            auto& py = obj->getInterpreter();
+            try
+            {
+                GIL gil;
+                py.addImportPath(path);
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+        static napi_value setSyncJsAndPyInCallback(napi_env env, napi_callback_info info)
+        {
+            napi_value jsthis;
+            size_t argc = 2;
+            napi_value args[2];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1 && argc != 2)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
+            }
+
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype syncJsAndPyT;
+            CHECKNULL(napi_typeof(env, args[0], &syncJsAndPyT));
+
+            napi_valuetype awaitableT = napi_boolean;
+            if (argc == 2)
+                CHECKNULL(napi_typeof(env, args[1], &awaitableT));
+
+            if (syncJsAndPyT == napi_boolean && awaitableT == napi_boolean)
+            {
+                auto syncJsAndPy = false;
+                CHECKNULL(napi_get_value_bool(env, args[0], &syncJsAndPy));
+
+                auto awaitable = false;
+                if (argc == 2)
+                    CHECKNULL(napi_get_value_bool(env, args[1], &awaitable));
+
+                obj->getInterpreter().setSyncJsAndPyInCallback(syncJsAndPy, awaitable);
+            }
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
+
+            return nullptr;
+        }
+
+        static napi_value setCallbackBatching(napi_env env, napi_callback_info info)
         {
-            return callImpl(env, info, false, false); 
+            napi_value jsthis;
+            size_t argc = 2;
+            napi_value args[2];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1 && argc != 2)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
+            }
+
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype batchT;
+            CHECKNULL(napi_typeof(env, args[0], &batchT));
+
+            napi_valuetype asArrayT = napi_boolean;
+            if (argc == 2)
+                CHECKNULL(napi_typeof(env, args[1], &asArrayT));
+
+            if (batchT == napi_boolean && asArrayT == napi_boolean)
+            {
+                auto batch = false;
+                CHECKNULL(napi_get_value_bool(env, args[0], &batch));
+
+                auto asArray = false;
+                if (argc == 2)
+                    CHECKNULL(napi_get_value_bool(env, args[1], &asArray));
+
+                obj->getInterpreter().setCallbackBatching(batch, asArray);
+            }
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
+
+            return nullptr;
         }
 
-        static napi_value newClassSync(napi_env env, napi_callback_info info) 
+        static napi_value setLazyArguments(napi_env env, napi_callback_info info)
         {
-            return callImpl(env, info, false, true); 
+            napi_value jsthis;
+            size_t argc = 1;
+            napi_value args[1];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
+            }
+
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype lazyT;
+            CHECKNULL(napi_typeof(env, args[0], &lazyT));
+
+            if (lazyT == napi_boolean)
+            {
+                auto lazy = false;
+                CHECKNULL(napi_get_value_bool(env, args[0], &lazy));
+
+                obj->getInterpreter().setLazyArguments(lazy);
+            }
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
+
+            return nullptr;
         }
 
-        static std::pair<std::string, Python*> getStringArgument(napi_env env, napi_callback_info info)
+        static napi_value setPreserveReferences(napi_env env, napi_callback_info info)
         {
             napi_value jsthis;
             size_t argc = 1;
             napi_value args[1];
-            CHECKNONE(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
 
             if (argc != 1)
             {
-                napi_throw_error(env, "args", "Must have 1 arguments");
-                return {};
+                napi_throw_error(env, "args", "Wrong number of arguments");
+                return nullptr;
             }
 
             Python* obj;
-            CHECKNONE(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
 
-            napi_valuetype valuetype;
-            CHECKNONE(napi_typeof(env, args[0], &valuetype));
+            napi_valuetype preserveT;
+            CHECKNULL(napi_typeof(env, args[0], &preserveT));
 
-            if (valuetype == napi_string)
-                return { convertString(env, args[0]), obj };
+            if (preserveT == napi_boolean)
+            {
+                auto preserve = false;
+                CHECKNULL(napi_get_value_bool(env, args[0], &preserve));
+
+                obj->getInterpreter().setPreserveReferences(preserve);
+            }
             else
             {
                 napi_throw_error(env, "args", "Wrong type of arguments");
             }
 
-            return {};
+            return nullptr;
         }
 
-        static napi_value fixlink(napi_env env, napi_callback_info info)
+        static napi_value setModuleIndex(napi_env env, napi_callback_info info)
         {
-#ifdef WIN32
-            return nullptr;
-#else
-            std::string filename;
-            Python* obj = nullptr;
-            std::tie(filename, obj) = getStringArgument(env, info);
-            if (filename.empty() || !obj)
+            napi_value jsthis;
+            size_t argc = 1;
+            napi_value args[1];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 1)
+            {
+                napi_throw_error(env, "args", "Wrong number of arguments");
                 return nullptr;
+            }
 
-            auto result = dlopen(filename.c_str(), RTLD_LAZY | RTLD_GLOBAL);
-            if (!result)
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype enabledT;
+            CHECKNULL(napi_typeof(env, args[0], &enabledT));
+
+            if (enabledT == napi_boolean)
             {
-                auto error = dlerror();
-                if (error)
-                    napi_throw_error(env, "args", error);
-                else
-                    napi_throw_error(env, "args", "Unknown error of dlopen");
+                auto enabled = false;
+                CHECKNULL(napi_get_value_bool(env, args[0], &enabled));
+
+                try
+                {
+                    obj->getInterpreter().setModuleIndex(enabled);
+                }
+                catch(const std::exception& e)
+                {
+                    throwError(env, e);
+                }
             }
-            
+            else
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+            }
+
             return nullptr;
-#endif
         }
 
-        static napi_value reimport(napi_env env, napi_callback_info info)
+        static napi_value buildBundle(napi_env env, napi_callback_info info)
         {
-            std::string directory;
-            Python* obj = nullptr;
-            std::tie(directory, obj) = getStringArgument(env, info);
-            if (directory.empty() || !obj)
+            napi_value jsthis;
+            size_t argc = 3;
+            napi_value args[3];
+            CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+            if (argc != 2 && argc != 3)
+            {
+                napi_throw_error(env, "args", "Must have 2 or 3 arguments");
                 return nullptr;
+            }
+
+            Python* obj;
+            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+            napi_valuetype directoryT;
+            CHECKNULL(napi_typeof(env, args[0], &directoryT));
+
+            napi_valuetype outputT;
+            CHECKNULL(napi_typeof(env, args[1], &outputT));
+
+            napi_valuetype namespacePackagesT = napi_boolean;
+            if (argc == 3)
+                CHECKNULL(napi_typeof(env, args[2], &namespacePackagesT));
+
+            if (directoryT != napi_string || outputT != napi_string || namespacePackagesT != napi_boolean)
+            {
+                napi_throw_error(env, "args", "Wrong type of arguments");
+                return nullptr;
+            }
+
+            auto namespacePackages = false;
+            if (argc == 3)
+                CHECKNULL(napi_get_value_bool(env, args[2], &namespacePackages));
 
-            auto& py = obj->getInterpreter();
             try
             {
-                GIL gil;
-                py.reimport(directory);
+                auto count = obj->getInterpreter().buildBundle(convertString(env, args[0]), convertString(env, args[1]), namespacePackages);
+
+                napi_value result;
+                CHECKNULL(napi_create_int32(env, count, &result));
+                return result;
             }
             catch(const std::exception& e)
             {
-                napi_throw_error(env, "py", e.what());
+                throwError(env, e);
             }
 
             return nullptr;
         }
 
-        static napi_value addImportPath(napi_env env, napi_callback_info info)
+        static napi_value addBundle(napi_env env, napi_callback_info info)
         {
             std::string path;
             Python* obj = nullptr;
@@ -749,21 +2088,148 @@ namespace nodecallspython
             if (path.empty() || !obj)
                 return nullptr;
 
-            auto& py = obj->getInterpreter();
             try
             {
-                GIL gil;
-                py.addImportPath(path);
+                obj->getInterpreter().addBundle(path);
             }
             catch(const std::exception& e)
             {
-                napi_throw_error(env, "py", e.what());
+                throwError(env, e);
             }
 
             return nullptr;
         }
 
-        static napi_value setSyncJsAndPyInCallback(napi_env env, napi_callback_info info)
+        static napi_value materialize(napi_env env, napi_callback_info info)
+        {
+            try
+            {
+                napi_value jsthis;
+                size_t argc = 2;
+                napi_value args[2];
+                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+                if (argc < 1)
+                {
+                    napi_throw_error(env, "args", "Wrong number of arguments");
+                    return nullptr;
+                }
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                bool isHandler = false;
+                CHECKNULL(napi_check_object_type_tag(env, args[0], &HANDLER_TYPE_TAG, &isHandler));
+
+                if (isHandler)
+                {
+                    napi_value value;
+                    CHECKNULL(napi_get_named_property(env, args[0], "handler", &value));
+
+                    GIL gil;
+                    auto& py = obj->getInterpreter();
+
+                    CPyObject key;
+                    if (argc > 1)
+                    {
+                        auto pyArgs = py.convert(env, { args[1] }, true);
+                        key = PyTuple_GetItem(*pyArgs.first, 0);
+                        Py_XINCREF(*key);
+                    }
+
+                    auto pyres = py.get(convertString(env, value), key);
+
+                    napi_value result;
+                    if (pyres)
+                        result = py.convert(env, *pyres);
+                    else
+                        CHECKNULL(napi_get_undefined(env, &result));
+                    return result;
+                }
+                else
+                {
+                    napi_throw_error(env, "args", "Wrong type of arguments");
+                }
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+        static napi_value registerCallback(napi_env env, napi_callback_info info)
+        {
+            try
+            {
+                napi_value jsthis;
+                size_t argc = 1;
+                napi_value args[1];
+                CHECKNULL(napi_get_cb_info(env, info, &argc, &args[0], &jsthis, nullptr));
+
+                if (argc != 1)
+                {
+                    napi_throw_error(env, "args", "Wrong number of arguments");
+                    return nullptr;
+                }
+
+                napi_valuetype funcT;
+                CHECKNULL(napi_typeof(env, args[0], &funcT));
+
+                if (funcT != napi_function)
+                {
+                    napi_throw_error(env, "args", "Wrong type of arguments");
+                    return nullptr;
+                }
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                auto& py = obj->getInterpreter();
+
+                std::string handler;
+                {
+                    GIL gil;
+                    handler = py.registerCallback(env, args[0]);
+                }
+
+                return createHandler(env, &py, handler);
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
+
+        static napi_value cacheKey(napi_env env, napi_callback_info info)
+        {
+            size_t argc = 0;
+            CHECKNULL(napi_get_cb_info(env, info, &argc, nullptr, nullptr, nullptr));
+
+            ArgumentBuffer buffer(argc);
+            auto args = buffer.data();
+            CHECKNULL(napi_get_cb_info(env, info, &argc, args, nullptr, nullptr));
+
+            thread_local std::string key;
+            key.clear();
+
+            napi_value result;
+            // the key is binary, latin1 keeps every byte as one character
+            if (cachekey::build(env, args, argc, key))
+                CHECKNULL(napi_create_string_latin1(env, key.data(), key.size(), &result))
+            else
+                CHECKNULL(napi_get_undefined(env, &result));
+
+            if (key.capacity() > 1024 * 1024)
+                std::string().swap(key);
+
+            return result;
+        }
+
+        static napi_value release(napi_env env, napi_callback_info info)
         {
             napi_value jsthis;
             size_t argc = 1;
@@ -776,18 +2242,31 @@ namespace nodecallspython
                 return nullptr;
             }
 
-            Python* obj;
-            CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+            bool isHandler = false;
+            CHECKNULL(napi_check_object_type_tag(env, args[0], &HANDLER_TYPE_TAG, &isHandler));
 
-            napi_valuetype syncJsAndPyT;
-            CHECKNULL(napi_typeof(env, args[0], &syncJsAndPyT));
+            bool isForkHandler = false;
+            if (!isHandler)
+                CHECKNULL(napi_check_object_type_tag(env, args[0], &FORK_HANDLER_TYPE_TAG, &isForkHandler));
 
-            if (syncJsAndPyT == napi_boolean)
+            if (isHandler)
             {
-                auto syncJsAndPy = false;
-                CHECKNULL(napi_get_value_bool(env, args[0], &syncJsAndPy));
-
-                obj->getInterpreter().setSyncJsAndPyInCallback(syncJsAndPy);
+                // releasing twice is a no-op, the wrap is already removed
+                void* handler = nullptr;
+                if (napi_remove_wrap(env, args[0], &handler) == napi_ok && handler)
+                {
+                    std::unique_ptr<Handler> native(reinterpret_cast<Handler*>(handler));
+                    native->release(env);
+                }
+            }
+            else if (isForkHandler)
+            {
+                void* handler = nullptr;
+                if (napi_remove_wrap(env, args[0], &handler) == napi_ok && handler)
+                {
+                    std::unique_ptr<ForkHandler> native(reinterpret_cast<ForkHandler*>(handler));
+                    native->release();
+                }
             }
             else
             {
@@ -796,6 +2275,29 @@ namespace nodecallspython
 
             return nullptr;
         }
+
+        static napi_value memoryStats(napi_env env, napi_callback_info info)
+        {
+            try
+            {
+                napi_value jsthis;
+                CHECKNULL(napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr));
+
+                Python* obj;
+                CHECKNULL(napi_unwrap(env, jsthis, reinterpret_cast<void**>(&obj)));
+
+                GIL gil;
+                auto& py = obj->getInterpreter();
+                auto stats = py.memoryStats();
+                return py.convert(env, *stats);
+            }
+            catch(const std::exception& e)
+            {
+                throwError(env, e);
+            }
+
+            return nullptr;
+        }
     };
 
     napi_ref Python::constructor;
@@ -0,0 +1,207 @@
+#include "cachekey.h"
+#include "pyinterpreter.h"
+#include <cstring>
+#include <cstdint>
+
+using namespace nodecallspython;
+
+namespace
+{
+    // deeper values are not cached, this also stops on cyclic objects
+    const int MAX_DEPTH = 64;
+
+    size_t elementSize(napi_typedarray_type type)
+    {
+        switch (type)
+        {
+        case napi_int16_array:
+        case napi_uint16_array:
+            return 2;
+        case napi_int32_array:
+        case napi_uint32_array:
+        case napi_float32_array:
+            return 4;
+        case napi_float64_array:
+        case napi_bigint64_array:
+        case napi_biguint64_array:
+            return 8;
+        default:
+            return 1;
+        }
+    }
+
+    class KeyBuilder
+    {
+        napi_env m_env;
+        std::string& m_key;
+
+        template<class T>
+        void write(char tag, T value)
+        {
+            m_key.push_back(tag);
+            m_key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        bool string(napi_value value)
+        {
+            size_t length = 0;
+            if (napi_get_value_string_utf8(m_env, value, nullptr, 0, &length) != napi_ok)
+                return false;
+
+            write<uint32_t>('s', static_cast<uint32_t>(length));
+            auto pos = m_key.size();
+            m_key.resize(pos + length + 1);
+            if (napi_get_value_string_utf8(m_env, value, &m_key[pos], length + 1, &length) != napi_ok)
+                return false;
+            m_key.resize(pos + length);
+            return true;
+        }
+
+        void bytes(char tag, int type, const void* data, size_t size)
+        {
+            write<int32_t>(tag, type);
+            write<uint64_t>(':', size);
+            m_key.append(reinterpret_cast<const char*>(data), size);
+        }
+
+        bool object(napi_value value, int depth)
+        {
+            bool is = false;
+            if (napi_is_array(m_env, value, &is) != napi_ok)
+                return false;
+            if (is)
+            {
+                uint32_t length = 0;
+                if (napi_get_array_length(m_env, value, &length) != napi_ok)
+                    return false;
+
+                write<uint32_t>('a', length);
+                for (auto i = 0u; i < length; ++i)
+                {
+                    napi_value item;
+                    if (napi_get_element(m_env, value, i, &item) != napi_ok || !add(item, depth + 1))
+                        return false;
+                }
+                return true;
+            }
+
+            if (napi_is_typedarray(m_env, value, &is) != napi_ok)
+                return false;
+            if (is)
+            {
+                napi_typedarray_type type;
+                size_t length = 0;
+                void* data = nullptr;
+                if (napi_get_typedarray_info(m_env, value, &type, &length, &data, nullptr, nullptr) != napi_ok)
+                    return false;
+
+                size_t byteLength = length * elementSize(type);
+                bytes('T', type, data, byteLength);
+                return true;
+            }
+
+            if (napi_is_arraybuffer(m_env, value, &is) != napi_ok)
+                return false;
+            if (is)
+            {
+                void* data = nullptr;
+                size_t length = 0;
+                if (napi_get_arraybuffer_info(m_env, value, &data, &length) != napi_ok)
+                    return false;
+
+                bytes('A', 0, data, length);
+                return true;
+            }
+
+            if (napi_is_dataview(m_env, value, &is) != napi_ok)
+                return false;
+            if (is)
+            {
+                void* data = nullptr;
+                size_t length = 0;
+                if (napi_get_dataview_info(m_env, value, &length, &data, nullptr, nullptr) != napi_ok)
+                    return false;
+
+                bytes('V', 0, data, length);
+                return true;
+            }
+
+            // python objects can change between calls
+            if (napi_check_object_type_tag(m_env, value, &HANDLER_TYPE_TAG, &is) != napi_ok || is)
+                return false;
+
+            napi_value properties;
+            uint32_t length = 0;
+            if (napi_get_property_names(m_env, value, &properties) != napi_ok || napi_get_array_length(m_env, properties, &length) != napi_ok)
+                return false;
+
+            write<uint32_t>('o', length);
+            for (auto i = 0u; i < length; ++i)
+            {
+                napi_value key, item;
+                if (napi_get_element(m_env, properties, i, &key) != napi_ok || napi_get_property(m_env, value, key, &item) != napi_ok)
+                    return false;
+
+                if (!add(key, depth + 1) || !add(item, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+
+    public:
+        KeyBuilder(napi_env env, std::string& key) : m_env(env), m_key(key) {}
+
+        bool add(napi_value value, int depth)
+        {
+            if (depth > MAX_DEPTH)
+                return false;
+
+            napi_valuetype type;
+            if (napi_typeof(m_env, value, &type) != napi_ok)
+                return false;
+
+            switch (type)
+            {
+            case napi_undefined:
+            case napi_null:
+                // both are converted to None
+                m_key.push_back('n');
+                return true;
+            case napi_boolean:
+            {
+                bool b = false;
+                if (napi_get_value_bool(m_env, value, &b) != napi_ok)
+                    return false;
+                m_key.push_back(b ? 't' : 'f');
+                return true;
+            }
+            case napi_number:
+            {
+                double d = 0.0;
+                if (napi_get_value_double(m_env, value, &d) != napi_ok)
+                    return false;
+                // 0 and -0 are both converted to the int 0
+                write<double>('d', d == 0.0 ? 0.0 : d);
+                return true;
+            }
+            case napi_string:
+                return string(value);
+            case napi_object:
+                return object(value, depth);
+            default:
+                return false;
+            }
+        }
+    };
+}
+
+bool cachekey::build(napi_env env, const napi_value* args, size_t argc, std::string& key)
+{
+    KeyBuilder builder(env, key);
+    for (auto i = 0u; i < argc; ++i)
+    {
+        if (!builder.add(args[i], 0))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <node_api.h>
+#include <string>
+
+namespace nodecallspython
+{
+    // builds the keys of the memoization cache of index.js straight from the JS values, without the GIL or any python conversion
+    // the key is an exact encoding of everything the conversion to python depends on, so equal keys always mean equal arguments
+    namespace cachekey
+    {
+        // returns false if one of the arguments cannot be part of a key (functions, python objects, symbols, cycles, ...)
+        bool build(napi_env env, const napi_value* args, size_t argc, std::string& key);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+
+namespace nodecallspython
+{
+    // the recursive converters stop at this depth instead of overflowing the native stack, this also stops them on cyclic values
+    const int MAX_CONVERSION_DEPTH = 1000;
+
+    // counts the nesting of the recursive converters of the current thread
+    class DepthGuard
+    {
+        static inline thread_local int m_depth = 0;
+    public:
+        // hint is appended to the error message
+        explicit DepthGuard(const char* hint = ", use setPreserveReferences(true) for cyclic values")
+        {
+            if (++m_depth > MAX_CONVERSION_DEPTH)
+            {
+                --m_depth;
+                throw std::runtime_error("Cannot convert values nested deeper than " + std::to_string(MAX_CONVERSION_DEPTH) + " levels" + hint);
+            }
+        }
+
+        ~DepthGuard()
+        {
+            --m_depth;
+        }
+
+        DepthGuard(const DepthGuard&) = delete;
+        DepthGuard& operator=(const DepthGuard&) = delete;
+    };
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "cpyobject.h"
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <functional>
+
+namespace nodecallspython
+{
+    // the python objects referenced from JS by their handler strings
+    // free-threaded python runs calls in parallel without the GIL, so the table is sharded by the hash of the handler:
+    // lookups only take the read lock of their shard and writes only block their own shard
+    // the objects must be accessed by threads attached to the interpreter (holding the GIL on the default builds)
+    class HandlerTable
+    {
+        static const size_t SHARDS = 16;
+
+        struct Shard
+        {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<std::string, CPyObject> objs;
+        };
+
+        std::array<Shard, SHARDS> m_shards;
+
+        Shard& shard(const std::string& handler)
+        {
+            return m_shards[std::hash<std::string>()(handler) % SHARDS];
+        }
+
+    public:
+        // returns a new reference to the object, or an empty object if the handler is not found
+        CPyObject find(const std::string& handler)
+        {
+            auto& s = shard(handler);
+            std::shared_lock<std::shared_mutex> l(s.mutex);
+            auto it = s.objs.find(handler);
+            return it == s.objs.end() ? CPyObject() : it->second;
+        }
+
+        bool contains(const std::string& handler)
+        {
+            auto& s = shard(handler);
+            std::shared_lock<std::shared_mutex> l(s.mutex);
+            return s.objs.count(handler) > 0;
+        }
+
+        // returns the replaced object, it is released by the caller outside of the lock, because releasing it may run python code
+        CPyObject set(const std::string& handler, const CPyObject& obj)
+        {
+            auto& s = shard(handler);
+            std::unique_lock<std::shared_mutex> l(s.mutex);
+            auto& value = s.objs[handler];
+            CPyObject replaced = value;
+            value = obj;
+            return replaced;
+        }
+
+        // returns the removed object, it is released by the caller outside of the lock
+        CPyObject erase(const std::string& handler)
+        {
+            auto& s = shard(handler);
+            std::unique_lock<std::shared_mutex> l(s.mutex);
+            auto it = s.objs.find(handler);
+            if (it == s.objs.end())
+                return CPyObject();
+
+            CPyObject removed = it->second;
+            s.objs.erase(it);
+            return removed;
+        }
+
+        size_t size() const
+        {
+            size_t size = 0;
+            for (auto& s : m_shards)
+            {
+                std::shared_lock<std::shared_mutex> l(s.mutex);
+                size += s.objs.size();
+            }
+            return size;
+        }
+
+        void clear()
+        {
+            for (auto& s : m_shards)
+            {
+                std::unordered_map<std::string, CPyObject> objs;
+                {
+                    std::unique_lock<std::shared_mutex> l(s.mutex);
+                    objs.swap(s.objs);
+                }
+            }
+        }
+    };
+}
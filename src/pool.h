@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+namespace nodecallspython
+{
+    // per-thread freelist of reusable objects, released objects are reset and handed out again by acquire
+    template<class T, size_t MaxSize = 64>
+    class Pool
+    {
+        struct FreeList
+        {
+            std::vector<T*> items;
+
+            FreeList()
+            {
+                items.reserve(MaxSize);
+            }
+
+            ~FreeList()
+            {
+                for (auto item : items)
+                    delete item;
+            }
+        };
+
+        static std::vector<T*>& freeList()
+        {
+            thread_local FreeList list;
+            return list.items;
+        }
+
+    public:
+        struct Deleter
+        {
+            void operator()(T* item) const
+            {
+                Pool::release(item);
+            }
+        };
+
+        using Ptr = std::unique_ptr<T, Deleter>;
+
+        static T* acquire()
+        {
+            auto& items = freeList();
+            if (items.empty())
+                return new T;
+
+            auto item = items.back();
+            items.pop_back();
+            return item;
+        }
+
+        static void release(T* item)
+        {
+            item->reset();
+
+            auto& items = freeList();
+            if (items.size() < MaxSize)
+                items.push_back(item);
+            else
+                delete item;
+        }
+    };
+}
@@ -1,14 +1,24 @@
 #include "pyinterpreter.h"
+#include "depthguard.h"
 #include <sstream>
 #include <iostream>
 #include <csignal>
 #include <cstdlib>
 #include <future>
+#include <algorithm>
+#include <unordered_set>
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
 
 using namespace nodecallspython;
 
 bool nodecallspython::PyInterpreter::m_inited = false;
 std::mutex nodecallspython::PyInterpreter::m_mutex;
+std::atomic<PyObject*> nodecallspython::PyInterpreter::m_loop(nullptr);
 
 namespace
 {
@@ -16,9 +26,11 @@ namespace
     {
         std::exit(130);
     }
+
+    void stopEventLoop(PyObject* loop);
 }
 
-PyInterpreter::PyInterpreter() : m_state(nullptr), m_syncJsAndPy(true)
+PyInterpreter::PyInterpreter() : m_state(nullptr), m_syncJsAndPy(true), m_awaitableCallbacks(false), m_batchCallbacks(false), m_batchCallbacksAsArray(false), m_lazyArguments(false), m_preserveReferences(false), m_handlerMemory(0), m_stopRelease(false)
 {
     std::lock_guard<std::mutex> l(m_mutex);
 
@@ -44,14 +56,42 @@ PyInterpreter::PyInterpreter() : m_state(nullptr), m_syncJsAndPy(true)
 
 PyInterpreter::~PyInterpreter()
 {
+    if (m_releaseThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> l(m_releaseMutex);
+            m_stopRelease = true;
+        }
+        m_releaseCondition.notify_one();
+        m_releaseThread.join();
+    }
+
     {
         GIL gil;
-        m_objs = {};
+        m_releaseQueue.clear();
+        m_objs.clear();
+        m_moduleIndex = CPyObject();
+        m_reloader = CPyObject();
+    }
+
+#ifndef WIN32
+    // the children exit once their sockets are closed, reap them so they do not stay zombies
+    for (auto& fork : m_forks)
+    {
+        std::lock_guard<std::mutex> l(fork.second->mutex);
+        ::close(fork.second->fd);
+        fork.second->fd = -1;
     }
+    for (auto& fork : m_forks)
+        ::waitpid(fork.first, nullptr, 0);
+    m_forks.clear();
+#endif
 
     if (m_state)
     {
         PyEval_RestoreThread(m_state);
+        if (m_loop)
+            stopEventLoop(m_loop);
         Py_Finalize();
     }
 }
@@ -62,8 +102,64 @@ namespace
 {
     napi_value convert(napi_env env, PyObject* obj);
 
+    bool getProxyOriginal(PyObject* obj, napi_value& value);
+
+    // the thread local string conversion buffers are shrunk back to the min size after converting a string larger than the max size
+    const size_t STRING_BUFFER_MIN_SIZE = 4096;
+    const size_t STRING_BUFFER_MAX_SIZE = 16 * 1024 * 1024;
+
+    // creates the JS string straight from the compact representation of the python str, avoiding the utf-8 copy that python caches on the object
+    napi_value convertUnicode(napi_env env, PyObject* obj)
+    {
+#if PY_VERSION_HEX < 0x030C0000
+        if (PyUnicode_READY(obj) != 0)
+            throw std::runtime_error("Cannot read python string");
+#endif
+        auto length = PyUnicode_GET_LENGTH(obj);
+
+        napi_value result;
+        switch (PyUnicode_KIND(obj))
+        {
+            case PyUnicode_1BYTE_KIND:
+                CHECK(napi_create_string_latin1(env, reinterpret_cast<const char*>(PyUnicode_1BYTE_DATA(obj)), length, &result));
+                break;
+            case PyUnicode_2BYTE_KIND:
+                CHECK(napi_create_string_utf16(env, reinterpret_cast<const char16_t*>(PyUnicode_2BYTE_DATA(obj)), length, &result));
+                break;
+            default:
+            {
+                // characters outside the BMP become surrogate pairs
+                thread_local std::u16string buffer;
+                buffer.clear();
+                buffer.reserve(length * 2);
+
+                auto* data = PyUnicode_4BYTE_DATA(obj);
+                for (Py_ssize_t i = 0; i < length; ++i)
+                {
+                    auto c = data[i];
+                    if (c >= 0x10000)
+                    {
+                        c -= 0x10000;
+                        buffer.push_back(static_cast<char16_t>(0xD800 + (c >> 10)));
+                        buffer.push_back(static_cast<char16_t>(0xDC00 + (c & 0x3FF)));
+                    }
+                    else
+                        buffer.push_back(static_cast<char16_t>(c));
+                }
+
+                CHECK(napi_create_string_utf16(env, buffer.data(), buffer.size(), &result));
+
+                // do not keep megabytes of text around after a large string
+                if (buffer.capacity() > STRING_BUFFER_MAX_SIZE)
+                    std::u16string().swap(buffer);
+            }
+        }
+        return result;
+    }
+
     napi_value fillArray(napi_env env, CPyObject& iterator, napi_value array)
     {
+        DepthGuard guard;
         PyObject *item;
         auto i = 0;
         while ((item = PyIter_Next(*iterator))) 
@@ -76,6 +172,209 @@ namespace
         return array;
     }
 
+    // sequences shorter than this are converted element by element
+    const Py_ssize_t BULK_MIN_LENGTH = 16;
+
+    // the maximum number of arguments passed to Array.of and Array.prototype.push in one call
+    const size_t BULK_CHUNK_SIZE = 8192;
+
+    // JS functions used to build arrays with a single call
+    struct ArrayBuilders
+    {
+        napi_ref arrayOf = nullptr;
+        napi_ref arrayFrom = nullptr;
+        napi_ref arrayPush = nullptr;
+    };
+
+    // the JS values cached for an env, they are stored as its instance data, so they are freed with the env and never reused by another one
+    struct EnvData
+    {
+        ArrayBuilders builders;
+        napi_ref identityMemoFactory = nullptr;
+        napi_ref pyErrorClass = nullptr;
+    };
+
+    void envDataFinalizer(napi_env env, void* data, void* hint)
+    {
+        delete reinterpret_cast<EnvData*>(data);
+    }
+
+    EnvData& getEnvData(napi_env env)
+    {
+        void* data = nullptr;
+        CHECK(napi_get_instance_data(env, &data));
+        if (!data)
+        {
+            auto envData = new EnvData();
+            auto status = napi_set_instance_data(env, envData, envDataFinalizer, nullptr);
+            if (status != napi_ok)
+            {
+                delete envData;
+                CHECK(status);
+            }
+            data = envData;
+        }
+        return *reinterpret_cast<EnvData*>(data);
+    }
+
+    ArrayBuilders& getArrayBuilders(napi_env env)
+    {
+        auto& builders = getEnvData(env).builders;
+        if (!builders.arrayOf)
+        {
+            napi_value global, array, prototype, arrayOf, arrayFrom, arrayPush;
+            CHECK(napi_get_global(env, &global));
+            CHECK(napi_get_named_property(env, global, "Array", &array));
+            CHECK(napi_get_named_property(env, array, "of", &arrayOf));
+            CHECK(napi_get_named_property(env, array, "from", &arrayFrom));
+            CHECK(napi_get_named_property(env, array, "prototype", &prototype));
+            CHECK(napi_get_named_property(env, prototype, "push", &arrayPush));
+
+            CHECK(napi_create_reference(env, arrayFrom, 1, &builders.arrayFrom));
+            CHECK(napi_create_reference(env, arrayPush, 1, &builders.arrayPush));
+            CHECK(napi_create_reference(env, arrayOf, 1, &builders.arrayOf));
+        }
+        return builders;
+    }
+
+    // the keys of the dicts in a list usually are the same python objects, so their JS strings are created once
+    class KeyCache
+    {
+        static const size_t MAX_SIZE = 64;
+        std::vector<std::pair<PyObject*, napi_value> > m_keys;
+
+    public:
+        napi_value get(napi_env env, PyObject* key);
+    };
+
+    napi_value convertKey(napi_env env, PyObject* key)
+    {
+        napi_value result;
+        if (PyUnicode_Check(key))
+            result = convertUnicode(env, key);
+        else
+            CHECK(napi_coerce_to_string(env, convert(env, key), &result));
+        return result;
+    }
+
+    napi_value KeyCache::get(napi_env env, PyObject* key)
+    {
+        for (auto& cached : m_keys)
+        {
+            if (cached.first == key)
+                return cached.second;
+        }
+
+        auto result = convertKey(env, key);
+        if (m_keys.size() < MAX_SIZE)
+            m_keys.emplace_back(key, result);
+        return result;
+    }
+
+    // all properties of the object are defined with one call
+    napi_value convertDict(napi_env env, PyObject* obj, KeyCache* cache)
+    {
+        DepthGuard guard;
+        std::vector<napi_property_descriptor> properties;
+        properties.reserve(PyDict_Size(obj));
+
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(obj, &pos, &key, &value))
+        {
+            auto name = cache ? cache->get(env, key) : convertKey(env, key);
+            properties.push_back({ nullptr, name, nullptr, nullptr, nullptr, convert(env, value), napi_default_jsproperty, nullptr });
+        }
+
+        napi_value object;
+        CHECK(napi_create_object(env, &object));
+        if (!properties.empty())
+            CHECK(napi_define_properties(env, object, properties.size(), properties.data()));
+        return object;
+    }
+
+    bool isNumber(PyObject* obj)
+    {
+        if (PyFloat_CheckExact(obj))
+            return true;
+
+        if (PyLong_CheckExact(obj))
+        {
+            int overflow = 0;
+            PyLong_AsLongLongAndOverflow(obj, &overflow);
+            return overflow == 0;
+        }
+
+        return false;
+    }
+
+    // lists and tuples: numbers are packed into a Float64Array and turned into an array by Array.from,
+    // other items are converted first and passed to Array.of / Array.prototype.push in chunks
+    napi_value convertSequence(napi_env env, PyObject** items, Py_ssize_t length)
+    {
+        DepthGuard guard;
+        napi_value array;
+        if (length < BULK_MIN_LENGTH)
+        {
+            CHECK(napi_create_array_with_length(env, length, &array));
+            for (auto i = 0; i < length; ++i)
+                CHECK(napi_set_element(env, array, i, convert(env, items[i])));
+            return array;
+        }
+
+        auto& builders = getArrayBuilders(env);
+
+        napi_value undefined;
+        CHECK(napi_get_undefined(env, &undefined));
+
+        auto numbers = true;
+        for (auto i = 0; i < length && numbers; ++i)
+            numbers = isNumber(items[i]);
+
+        if (numbers)
+        {
+            void* data = nullptr;
+            napi_value buffer;
+            CHECK(napi_create_arraybuffer(env, length * sizeof(double), &data, &buffer));
+
+            auto values = static_cast<double*>(data);
+            for (auto i = 0; i < length; ++i)
+                values[i] = PyFloat_CheckExact(items[i]) ? PyFloat_AS_DOUBLE(items[i]) : static_cast<double>(PyLong_AsLongLong(items[i]));
+
+            napi_value typedArray;
+            CHECK(napi_create_typedarray(env, napi_float64_array, length, buffer, 0, &typedArray));
+
+            napi_value arrayFrom;
+            CHECK(napi_get_reference_value(env, builders.arrayFrom, &arrayFrom));
+            CHECK(napi_call_function(env, undefined, arrayFrom, 1, &typedArray, &array));
+            return array;
+        }
+
+        KeyCache cache;
+        std::vector<napi_value> values(length);
+        for (auto i = 0; i < length; ++i)
+            values[i] = PyDict_CheckExact(items[i]) ? convertDict(env, items[i], &cache) : convert(env, items[i]);
+
+        napi_value arrayOf;
+        CHECK(napi_get_reference_value(env, builders.arrayOf, &arrayOf));
+
+        auto chunk = std::min<size_t>(length, BULK_CHUNK_SIZE);
+        CHECK(napi_call_function(env, undefined, arrayOf, chunk, values.data(), &array));
+
+        if (chunk < static_cast<size_t>(length))
+        {
+            napi_value arrayPush;
+            CHECK(napi_get_reference_value(env, builders.arrayPush, &arrayPush));
+            for (auto pos = chunk; pos < static_cast<size_t>(length); pos += BULK_CHUNK_SIZE)
+            {
+                napi_value size;
+                CHECK(napi_call_function(env, array, arrayPush, std::min<size_t>(length - pos, BULK_CHUNK_SIZE), values.data() + pos, &size));
+            }
+        }
+
+        return array;
+    }
+
     napi_value createArrayBuffer(napi_env env, size_t size, const char* ptr)
     {
         void* data = nullptr;
@@ -95,14 +394,7 @@ namespace
             return result;
         }
         else if (PyUnicode_Check(obj))
-        {
-            Py_ssize_t size;
-            auto str = PyUnicode_AsUTF8AndSize(obj, &size);
-
-            napi_value result;
-            CHECK(napi_create_string_utf8(env, str, size, &result));
-            return result;
-        }
+            return convertUnicode(env, obj);
         else if (PyLong_Check(obj))
         {
             napi_value result;
@@ -115,27 +407,9 @@ namespace
             CHECK(napi_create_double(env, PyFloat_AsDouble(obj), &result));
             return result;
         }
-        else if (PyList_Check(obj))
-        {
-            auto length = PyList_Size(obj);
-            napi_value array;
-            CHECK(napi_create_array_with_length(env, length, &array));
-
-            for (auto i = 0u; i < length; ++i)
-                CHECK(napi_set_element(env, array, i, convert(env, PyList_GetItem(obj, i))));
-
-            return array;
-        }
-        else if (PyTuple_Check(obj))
+        else if (PyList_Check(obj) || PyTuple_Check(obj))
         {
-            auto length = PyTuple_Size(obj);
-            napi_value array;
-            CHECK(napi_create_array_with_length(env, length, &array));
-
-            for (auto i = 0u; i < length; ++i)
-                CHECK(napi_set_element(env, array, i, convert(env, PyTuple_GetItem(obj, i))));
-
-            return array;
+            return convertSequence(env, PySequence_Fast_ITEMS(obj), PySequence_Fast_GET_SIZE(obj));
         }
         else if (PySet_Check(obj))
         {
@@ -163,16 +437,7 @@ namespace
         }
         else if (PyDict_Check(obj))
         {
-            napi_value object;
-            CHECK(napi_create_object(env, &object));
-
-            PyObject *key, *value;
-            Py_ssize_t pos = 0;
-
-            while (PyDict_Next(obj, &pos, &key, &value))
-                CHECK(napi_set_property(env, object, convert(env, key), convert(env, value)));
-
-            return object;
+            return convertDict(env, obj, nullptr);
         }
         else if (obj == Py_None)
         {
@@ -182,6 +447,10 @@ namespace
         }
         else
         {
+            napi_value original;
+            if (getProxyOriginal(obj, original))
+                return original;
+
             CPyObject iterator = PyObject_GetIter(obj);
             if (iterator)
             {
@@ -224,6 +493,87 @@ namespace
         }
     }
 
+    // converts dicts, lists and tuples with an explicit work stack, every python object is converted once,
+    // so shared objects stay shared and cyclic objects become cyclic JS values, everything else is converted by convert
+    class GraphToJs
+    {
+        struct Frame
+        {
+            PyObject* obj;
+            napi_value target;
+            Py_ssize_t pos;
+        };
+
+        napi_env m_env;
+        std::unordered_map<PyObject*, napi_value> m_memo;
+        std::vector<Frame> m_stack;
+
+        napi_value visit(PyObject* obj)
+        {
+            auto isDict = PyDict_Check(obj);
+            if (!isDict && !PyList_Check(obj) && !PyTuple_Check(obj))
+                return ::convert(m_env, obj);
+
+            auto found = m_memo.find(obj);
+            if (found != m_memo.end())
+                return found->second;
+
+            napi_value target;
+            if (isDict)
+            {
+                CHECK(napi_create_object(m_env, &target));
+            }
+            else
+            {
+                CHECK(napi_create_array_with_length(m_env, PySequence_Fast_GET_SIZE(obj), &target));
+            }
+
+            m_memo.emplace(obj, target);
+            m_stack.push_back({ obj, target, 0 });
+            return target;
+        }
+
+    public:
+        GraphToJs(napi_env env) : m_env(env) {}
+
+        napi_value convert(PyObject* obj)
+        {
+            auto result = visit(obj);
+            while (!m_stack.empty())
+            {
+                // visit may grow the stack, so the frame is always accessed by index
+                auto index = m_stack.size() - 1;
+                auto current = m_stack[index].obj;
+                auto target = m_stack[index].target;
+
+                if (PyDict_Check(current))
+                {
+                    PyObject *key, *value;
+                    if (!PyDict_Next(current, &m_stack[index].pos, &key, &value))
+                    {
+                        m_stack.pop_back();
+                        continue;
+                    }
+
+                    auto name = convertKey(m_env, key);
+                    CHECK(napi_set_property(m_env, target, name, visit(value)));
+                }
+                else
+                {
+                    auto pos = m_stack[index].pos++;
+                    if (pos >= PySequence_Fast_GET_SIZE(current))
+                    {
+                        m_stack.pop_back();
+                        continue;
+                    }
+
+                    CHECK(napi_set_element(m_env, target, static_cast<uint32_t>(pos), visit(PySequence_Fast_ITEMS(current)[pos])));
+                }
+            }
+            return result;
+        }
+    };
+
     std::vector<napi_value> convertParams(napi_env env, void* data)
     {
         std::vector<napi_value> params;
@@ -243,7 +593,9 @@ namespace
         return result;
     }
 
-    std::pair<PyObject*, bool> convert(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy);
+    std::pair<PyObject*, bool> convert(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py);
+
+    std::pair<PyObject*, bool> convertValue(napi_env env, napi_value arg, napi_valuetype type, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py);
 
     void callJs(napi_env env, napi_value func, void* context, void* data) 
     {
@@ -268,90 +620,593 @@ namespace
         Py_RETURN_NONE;
     }
 
-    struct Promise
+    // invocations of a batched callback are queued here and the whole queue is handed over to the main thread with a single threadsafe call
+    struct BatchedCallback
     {
-        std::promise<PyObject*> promise;
-        PyObject* args;
-
-        Promise(PyObject* args) : args(args)
-        {            
-        }
+        napi_threadsafe_function tsfn;
+        bool asArray;
+        std::mutex mutex;
+        std::vector<PyObject*> pending;
     };
 
-    void callJsPromise(napi_env env, napi_value func, void* context, void* data) 
+    void callJsBatched(napi_env env, napi_value func, void* context, void* data)
     {
-        auto promise = reinterpret_cast<Promise*>(data);
-        try
+        // the queue is drained without env when the function is released, batchedCallbackFinalizer runs afterwards and releases the pending invocations
+        if (!env)
+            return;
+
+        auto callback = reinterpret_cast<BatchedCallback*>(context);
+
+        std::vector<PyObject*> pending;
         {
-            std::vector<napi_value> params;
+            std::lock_guard<std::mutex> l(callback->mutex);
+            pending.swap(callback->pending);
+        }
+
+        if (pending.empty())
+            return;
+
+        std::vector<std::vector<napi_value> > invocations;
+        {
+            GIL gil;
+            invocations.reserve(pending.size());
+            for (auto args : pending)
             {
-                GIL gil;
-                CPyObject args(promise->args);
-                params = convertParams(env, *args);
+                try
+                {
+                    invocations.push_back(convertParams(env, args));
+                }
+                catch(std::exception&)
+                {
+                }
+                Py_DECREF(args);
             }
+        }
 
-            auto result = callJsImpl(env, func, params);
-
+        try
+        {
+            if (callback->asArray)
             {
-                GIL gil;
-                auto pyResult = convert(env, result, true, false, false).first;
-                promise->promise.set_value(pyResult);
+                napi_value array;
+                CHECK(napi_create_array_with_length(env, invocations.size(), &array));
+                for (auto i = 0u; i < invocations.size(); ++i)
+                {
+                    napi_value params;
+                    CHECK(napi_create_array_with_length(env, invocations[i].size(), &params));
+                    for (auto j = 0u; j < invocations[i].size(); ++j)
+                        CHECK(napi_set_element(env, params, j, invocations[i][j]));
+                    CHECK(napi_set_element(env, array, i, params));
+                }
+                callJsImpl(env, func, { array });
+            }
+            else
+            {
+                for (auto& params : invocations)
+                    callJsImpl(env, func, params);
             }
         }
         catch(std::exception&)
-        {           
-            promise->promise.set_value(nullptr); 
+        {
         }
     }
 
-    PyObject* __callback_function_napi_async_promise(PyObject *self, PyObject* args)
+    PyObject* __callback_function_napi_async_batched(PyObject *self, PyObject* args)
     {
-        auto func = reinterpret_cast<napi_threadsafe_function*>(PyCapsule_GetPointer(self, nullptr));
+        auto callback = reinterpret_cast<BatchedCallback*>(PyCapsule_GetPointer(self, nullptr));
         Py_INCREF(args);
-        auto promise = std::make_unique<Promise>(args);
-        auto future = promise->promise.get_future();
 
-        Py_BEGIN_ALLOW_THREADS;
-        napi_call_threadsafe_function(*func, promise.get(), napi_tsfn_nonblocking);
-        future.wait();
-        Py_END_ALLOW_THREADS;
+        bool notify = false;
+        {
+            std::lock_guard<std::mutex> l(callback->mutex);
+            notify = callback->pending.empty();
+            callback->pending.push_back(args);
+        }
 
-        return future.get();
+        if (notify)
+            napi_call_threadsafe_function(callback->tsfn, nullptr, napi_tsfn_nonblocking);
+        Py_RETURN_NONE;
     }
 
-    struct SycnCallback
+    void batchedCallbackFinalizer(napi_env env, void* data, void* hint)
     {
-        napi_env env;
-        napi_value func;
-    };
+        auto callback = reinterpret_cast<BatchedCallback*>(data);
+        if (!callback->pending.empty())
+        {
+            GIL gil;
+            for (auto args : callback->pending)
+                Py_DECREF(args);
+        }
+        delete callback;
+    }
 
-    PyObject* __callback_function_napi_sync(PyObject *self, PyObject* args)
+    PyObject* __set_future_result(PyObject *self, PyObject* args)
     {
-        auto func = reinterpret_cast<SycnCallback*>(PyCapsule_GetPointer(self, nullptr));
-        auto params = convertParams(func->env, args);
-        auto result = callJsImpl(func->env, func->func, params);
-        return convert(func->env, result, true, false, false).first;
+        PyObject *future, *value;
+        int isError = 0;
+        if (!PyArg_ParseTuple(args, "OOp", &future, &value, &isError))
+            return nullptr;
+
+        CPyObject done = PyObject_CallMethod(future, "done", nullptr);
+        if (!done)
+            return nullptr;
+
+        if (!PyObject_IsTrue(*done))
+        {
+            CPyObject result = isError ?
+                PyObject_CallMethod(future, "set_exception", "O", *CPyObject(PyObject_CallFunctionObjArgs(PyExc_RuntimeError, value, nullptr))) :
+                PyObject_CallMethod(future, "set_result", "O", value);
+            if (!result)
+                return nullptr;
+        }
+
+        Py_RETURN_NONE;
     }
 
-    void capsuleDestructor(PyObject* obj)
+    PyMethodDef mlSetFutureResult = { "__set_future_result", (PyCFunction)(void(*)(void))__set_future_result, METH_VARARGS, nullptr };
+
+    // imports a module into cache once and returns it (borrowed), returns nullptr with the python error set if the import fails
+    // threads of free-threaded python may race here, the loser releases its reference
+    PyObject* importOnce(std::atomic<PyObject*>& cache, const char* name)
     {
-        auto func = reinterpret_cast<napi_threadsafe_function*>(PyCapsule_GetPointer(obj, nullptr));
-        napi_release_threadsafe_function(*func, napi_tsfn_abort);
-        delete func;
+        auto module = cache.load();
+        if (module)
+            return module;
+
+        module = PyImport_ImportModule(name);
+        if (!module)
+            return nullptr;
+
+        PyObject* expected = nullptr;
+        if (!cache.compare_exchange_strong(expected, module))
+        {
+            Py_DECREF(module);
+            return expected;
+        }
+        return module;
     }
 
-    void capsuleDestructorSync(PyObject* obj)
+    // returns the asyncio module (borrowed), it is imported once and never released
+    PyObject* getAsyncio()
     {
-        delete reinterpret_cast<SycnCallback*>(PyCapsule_GetPointer(obj, nullptr));
+        static std::atomic<PyObject*> asyncio{nullptr};
+        auto module = importOnce(asyncio, "asyncio");
+        if (!module)
+            PyErr_Clear();
+        return module;
     }
 
-    PyMethodDef mlAsync = { "__callback_function_napi_async", (PyCFunction)(void(*)(void))__callback_function_napi_async, METH_VARARGS, nullptr };
-    PyMethodDef mlAsyncPromise = { "__callback_function_napi_async_promise", (PyCFunction)(void(*)(void))__callback_function_napi_async_promise, METH_VARARGS, nullptr };
-    PyMethodDef mlSync = { "__callback_function_napi_sync", (PyCFunction)(void(*)(void))__callback_function_napi_sync, METH_VARARGS, nullptr };
-
-    PyObject* handleInteger(napi_env env, napi_value arg)
+    // returns the asyncio event loop running in the current thread (borrowed) or nullptr
+    PyObject* getRunningLoop()
     {
-        //handle integers
+        auto asyncio = getAsyncio();
+        if (!asyncio)
+            return nullptr;
+
+        CPyObject loop = PyObject_CallMethod(asyncio, "_get_running_loop", nullptr);
+        if (!loop)
+        {
+            PyErr_Clear();
+            return nullptr;
+        }
+
+        return *loop == Py_None ? nullptr : *loop;
+    }
+
+    // the JS threads blocked in a sync call until a coroutine finishes, the JS functions of these threads cannot run meanwhile
+    std::mutex coroutineWaitersMutex;
+    std::unordered_multiset<std::thread::id> coroutineWaiters;
+
+    struct CoroutineWait
+    {
+        CoroutineWait()
+        {
+            std::lock_guard<std::mutex> l(coroutineWaitersMutex);
+            coroutineWaiters.insert(std::this_thread::get_id());
+        }
+
+        ~CoroutineWait()
+        {
+            std::lock_guard<std::mutex> l(coroutineWaitersMutex);
+            coroutineWaiters.erase(coroutineWaiters.find(std::this_thread::get_id()));
+        }
+
+        CoroutineWait(const CoroutineWait&) = delete;
+        CoroutineWait& operator=(const CoroutineWait&) = delete;
+    };
+
+    bool isWaitingForCoroutine(std::thread::id thread)
+    {
+        std::lock_guard<std::mutex> l(coroutineWaitersMutex);
+        return coroutineWaiters.count(thread) > 0;
+    }
+
+    const char* const COROUTINE_CALLBACK_ERROR = "JavaScript functions cannot be called from a coroutine awaited by a sync call, use the async call instead";
+
+    struct Promise
+    {
+        std::promise<PyObject*> promise;
+        std::string error;
+        PyObject* args;
+
+        // set when the callback is awaited in an asyncio event loop instead of blocking the calling thread
+        PyObject* loop;
+        PyObject* future;
+
+        Promise(PyObject* args) : args(args), loop(nullptr), future(nullptr)
+        {            
+        }
+
+        // takes the ownership of result, must be called holding the GIL
+        void complete(PyObject* result, const std::string& error)
+        {
+            if (!future)
+            {
+                this->error = error;
+                promise.set_value(result);
+                return;
+            }
+
+            CPyObject value = result ? result : PyUnicode_FromString(error.c_str());
+            CPyObject setter = PyCFunction_New(&mlSetFutureResult, nullptr);
+            CPyObject isError = PyBool_FromLong(result ? 0 : 1);
+            CPyObject scheduled = PyObject_CallMethod(loop, "call_soon_threadsafe", "OOOO", *setter, future, *value, *isError);
+            if (!scheduled)
+                PyErr_Clear();
+
+            Py_DECREF(loop);
+            Py_DECREF(future);
+            delete this;
+        }
+    };
+
+    std::string getJsError(napi_env env, napi_value error)
+    {
+        napi_value message;
+        if (napi_coerce_to_string(env, error, &message) != napi_ok)
+            return "Unknown JavaScript error";
+
+        size_t length = 0;
+        napi_get_value_string_utf8(env, message, NULL, 0, &length);
+        std::string result(length, ' ');
+        napi_get_value_string_utf8(env, message, &result[0], length + 1, &length);
+        return result;
+    }
+
+    napi_value jsPromiseSettled(napi_env env, napi_callback_info info, bool resolved)
+    {
+        size_t argc = 1;
+        napi_value value;
+        void* data = nullptr;
+        napi_get_cb_info(env, info, &argc, &value, nullptr, &data);
+        if (argc == 0)
+            napi_get_undefined(env, &value);
+
+        auto promise = reinterpret_cast<Promise*>(data);
+        try
+        {
+            if (resolved)
+            {
+                GIL gil;
+                promise->complete(convert(env, value, true, false, false, nullptr).first, {});
+            }
+            else
+            {
+                auto error = getJsError(env, value);
+                GIL gil;
+                promise->complete(nullptr, error);
+            }
+        }
+        catch(std::exception& e)
+        {
+            GIL gil;
+            promise->complete(nullptr, e.what());
+        }
+
+        return nullptr;
+    }
+
+    napi_value jsPromiseResolved(napi_env env, napi_callback_info info)
+    {
+        return jsPromiseSettled(env, info, true);
+    }
+
+    napi_value jsPromiseRejected(napi_env env, napi_callback_info info)
+    {
+        return jsPromiseSettled(env, info, false);
+    }
+
+    void callJsPromise(napi_env env, napi_value func, void* context, void* data) 
+    {
+        auto promise = reinterpret_cast<Promise*>(data);
+        try
+        {
+            std::vector<napi_value> params;
+            {
+                GIL gil;
+                CPyObject args(promise->args);
+                params = convertParams(env, *args);
+            }
+
+            napi_value undefined, result;
+            CHECK(napi_get_undefined(env, &undefined));
+            if (napi_call_function(env, undefined, func, params.size(), params.data(), &result) != napi_ok)
+            {
+                napi_value exception;
+                napi_get_and_clear_last_exception(env, &exception);
+                auto error = getJsError(env, exception);
+
+                GIL gil;
+                promise->complete(nullptr, error);
+                return;
+            }
+
+            bool isPromise = false;
+            CHECK(napi_is_promise(env, result, &isPromise));
+            if (isPromise)
+            {
+                napi_value then, handlers[2];
+                CHECK(napi_get_named_property(env, result, "then", &then));
+                CHECK(napi_create_function(env, "resolve", NAPI_AUTO_LENGTH, jsPromiseResolved, promise, &handlers[0]));
+                CHECK(napi_create_function(env, "reject", NAPI_AUTO_LENGTH, jsPromiseRejected, promise, &handlers[1]));
+                CHECK(napi_call_function(env, result, then, 2, handlers, nullptr));
+                return;
+            }
+
+            {
+                GIL gil;
+                auto pyResult = convert(env, result, true, false, false, nullptr).first;
+                promise->complete(pyResult, {});
+            }
+        }
+        catch(std::exception& e)
+        {           
+            GIL gil;
+            promise->complete(nullptr, env ? e.what() : "JavaScript function is not available anymore");
+        }
+    }
+
+    // calls the JS function through queue and waits for its (awaited) result, awaitable callbacks return a future when called from a coroutine
+    // queue(Promise*) queues the call on the JS thread and returns its napi_status
+    template<class Queue>
+    PyObject* callPromise(Queue queue, PyObject* args, bool awaitable)
+    {
+        Py_INCREF(args);
+
+        auto loop = awaitable ? getRunningLoop() : nullptr;
+        if (loop)
+        {
+            // called from a coroutine: return an awaitable and keep the event loop running
+            CPyObject future = PyObject_CallMethod(loop, "create_future", nullptr);
+            if (!future)
+            {
+                Py_DECREF(args);
+                return nullptr;
+            }
+
+            auto promise = new Promise(args);
+            promise->loop = loop;
+            promise->future = *future;
+            Py_INCREF(promise->loop);
+            Py_INCREF(promise->future);
+
+            if (queue(promise) != napi_ok)
+            {
+                Py_DECREF(args);
+                Py_DECREF(promise->loop);
+                Py_DECREF(promise->future);
+                delete promise;
+                PyErr_SetString(PyExc_RuntimeError, "JavaScript function is not available anymore");
+                return nullptr;
+            }
+
+            Py_INCREF(*future);
+            return *future;
+        }
+
+        auto promise = std::make_unique<Promise>(args);
+        auto future = promise->promise.get_future();
+
+        napi_status status;
+        Py_BEGIN_ALLOW_THREADS;
+        status = queue(promise.get());
+        if (status == napi_ok)
+            future.wait();
+        Py_END_ALLOW_THREADS;
+
+        if (status != napi_ok)
+        {
+            Py_DECREF(args);
+            PyErr_SetString(PyExc_RuntimeError, "JavaScript function is not available anymore");
+            return nullptr;
+        }
+
+        auto result = future.get();
+        if (!result)
+            PyErr_SetString(PyExc_RuntimeError, promise->error.c_str());
+        return result;
+    }
+
+    PyObject* __callback_function_napi_async_promise(PyObject *self, PyObject* args)
+    {
+        auto func = reinterpret_cast<napi_threadsafe_function*>(PyCapsule_GetPointer(self, nullptr));
+        return callPromise([func](Promise* promise) { return napi_call_threadsafe_function(*func, promise, napi_tsfn_nonblocking); }, args, false);
+    }
+
+    PyObject* __callback_function_napi_async_awaitable(PyObject *self, PyObject* args)
+    {
+        auto func = reinterpret_cast<napi_threadsafe_function*>(PyCapsule_GetPointer(self, nullptr));
+        return callPromise([func](Promise* promise) { return napi_call_threadsafe_function(*func, promise, napi_tsfn_nonblocking); }, args, true);
+    }
+
+    PyObject* __coroutine_done(PyObject *self, PyObject* future)
+    {
+        auto tsfn = reinterpret_cast<napi_threadsafe_function>(PyCapsule_GetPointer(self, nullptr));
+        Py_INCREF(future);
+        if (napi_call_threadsafe_function(tsfn, future, napi_tsfn_nonblocking) != napi_ok)
+            Py_DECREF(future);
+        napi_release_threadsafe_function(tsfn, napi_tsfn_release);
+        Py_RETURN_NONE;
+    }
+
+    PyMethodDef mlCoroutineDone = { "__coroutine_done", (PyCFunction)(void(*)(void))__coroutine_done, METH_O, nullptr };
+
+    struct SycnCallback
+    {
+        napi_env env;
+        napi_value func;
+        std::thread::id thread;
+    };
+
+    PyObject* __callback_function_napi_sync(PyObject *self, PyObject* args)
+    {
+        auto func = reinterpret_cast<SycnCallback*>(PyCapsule_GetPointer(self, nullptr));
+        // e.g. called by a coroutine, which runs on the thread of the event loop
+        if (std::this_thread::get_id() != func->thread)
+        {
+            PyErr_SetString(PyExc_RuntimeError, isWaitingForCoroutine(func->thread) ? COROUTINE_CALLBACK_ERROR : "JavaScript function can only be called on the thread of the sync call it was passed to");
+            return nullptr;
+        }
+
+        auto params = convertParams(func->env, args);
+        auto result = callJsImpl(func->env, func->func, params);
+        return convert(func->env, result, true, false, false, nullptr).first;
+    }
+
+    void capsuleDestructor(PyObject* obj)
+    {
+        auto func = reinterpret_cast<napi_threadsafe_function*>(PyCapsule_GetPointer(obj, nullptr));
+        napi_release_threadsafe_function(*func, napi_tsfn_abort);
+        delete func;
+    }
+
+    void capsuleDestructorBatched(PyObject* obj)
+    {
+        auto callback = reinterpret_cast<BatchedCallback*>(PyCapsule_GetPointer(obj, nullptr));
+        // release instead of abort so the invocations queued before the end of the python call are still delivered
+        napi_release_threadsafe_function(callback->tsfn, napi_tsfn_release);
+    }
+
+    void capsuleDestructorSync(PyObject* obj)
+    {
+        delete reinterpret_cast<SycnCallback*>(PyCapsule_GetPointer(obj, nullptr));
+    }
+
+    PyMethodDef mlAsync = { "__callback_function_napi_async", (PyCFunction)(void(*)(void))__callback_function_napi_async, METH_VARARGS, nullptr };
+    PyMethodDef mlAsyncPromise = { "__callback_function_napi_async_promise", (PyCFunction)(void(*)(void))__callback_function_napi_async_promise, METH_VARARGS, nullptr };
+    PyMethodDef mlAsyncAwaitable = { "__callback_function_napi_async_awaitable", (PyCFunction)(void(*)(void))__callback_function_napi_async_awaitable, METH_VARARGS, nullptr };
+    PyMethodDef mlAsyncBatched = { "__callback_function_napi_async_batched", (PyCFunction)(void(*)(void))__callback_function_napi_async_batched, METH_VARARGS, nullptr };
+    PyMethodDef mlSync = { "__callback_function_napi_sync", (PyCFunction)(void(*)(void))__callback_function_napi_sync, METH_VARARGS, nullptr };
+
+    // a JS function registered once and passed to any number of calls, it owns a single long-lived threadsafe function
+    struct RegisteredCallback
+    {
+        napi_env env;
+        napi_ref func;
+        napi_threadsafe_function tsfn;
+        std::thread::id thread;
+        bool syncJsAndPy;
+        bool awaitable;
+
+        // the python function may outlive the env, the last one of the two owners deletes the callback
+        std::mutex mutex;
+        bool released;
+        std::atomic<bool> finalized;
+
+        RegisteredCallback(napi_env env, bool syncJsAndPy, bool awaitable) : env(env), func(nullptr), tsfn(nullptr), thread(std::this_thread::get_id()), syncJsAndPy(syncJsAndPy), awaitable(awaitable), released(false), finalized(false)
+        {
+        }
+
+        // the check and the call are made under the lock, so the threadsafe function cannot be finalized in between
+        napi_status call(void* data)
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if (finalized)
+                return napi_closing;
+            return napi_call_threadsafe_function(tsfn, data, napi_tsfn_nonblocking);
+        }
+    };
+
+    PyObject* __registered_callback(PyObject *self, PyObject* args)
+    {
+        auto callback = reinterpret_cast<RegisteredCallback*>(PyCapsule_GetPointer(self, nullptr));
+        if (callback->finalized)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "JavaScript function is not available anymore");
+            return nullptr;
+        }
+
+        // invoked from a sync call on the JS thread, the function can be called directly
+        if (std::this_thread::get_id() == callback->thread)
+        {
+            try
+            {
+                napi_value func;
+                CHECK(napi_get_reference_value(callback->env, callback->func, &func));
+                auto params = convertParams(callback->env, args);
+                auto result = callJsImpl(callback->env, func, params);
+                return convert(callback->env, result, true, false, false, nullptr).first;
+            }
+            catch(const std::exception& e)
+            {
+                PyErr_SetString(PyExc_RuntimeError, e.what());
+                return nullptr;
+            }
+        }
+
+        // the JS thread would wait for the coroutine and the coroutine for the JS thread
+        if (callback->syncJsAndPy && isWaitingForCoroutine(callback->thread))
+        {
+            PyErr_SetString(PyExc_RuntimeError, COROUTINE_CALLBACK_ERROR);
+            return nullptr;
+        }
+
+        if (callback->syncJsAndPy)
+            return callPromise([callback](Promise* promise) { return callback->call(promise); }, args, callback->awaitable);
+
+        Py_INCREF(args);
+        if (callback->call(args) != napi_ok)
+        {
+            Py_DECREF(args);
+            PyErr_SetString(PyExc_RuntimeError, "JavaScript function is not available anymore");
+            return nullptr;
+        }
+        Py_RETURN_NONE;
+    }
+
+    void capsuleDestructorRegistered(PyObject* obj)
+    {
+        auto callback = reinterpret_cast<RegisteredCallback*>(PyCapsule_GetPointer(obj, nullptr));
+        {
+            std::lock_guard<std::mutex> l(callback->mutex);
+            callback->released = true;
+            if (!callback->finalized)
+            {
+                napi_release_threadsafe_function(callback->tsfn, napi_tsfn_abort);
+                return;
+            }
+        }
+        delete callback;
+    }
+
+    // called on the JS thread once the threadsafe function is released, the reference can only be deleted there
+    void registeredCallbackFinalizer(napi_env env, void* data, void* hint)
+    {
+        auto callback = reinterpret_cast<RegisteredCallback*>(data);
+        napi_delete_reference(env, callback->func);
+        {
+            std::lock_guard<std::mutex> l(callback->mutex);
+            callback->finalized = true;
+            if (!callback->released)
+                return;
+        }
+        delete callback;
+    }
+
+    PyMethodDef mlRegistered = { "__registered_callback", (PyCFunction)(void(*)(void))__registered_callback, METH_VARARGS, nullptr };
+
+    PyObject* handleInteger(napi_env env, napi_value arg)
+    {
+        //handle integers
         int32_t i = 0;
         auto res = napi_get_value_int32(env, arg, &i);
         if (res != napi_ok)
@@ -374,519 +1229,2732 @@ namespace
             return PyLong_FromLong(i);
     }
 
-    std::pair<PyObject*, bool> convert(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy)
+    PyObject* convertNumber(double d)
+    {
+        if (d >= INT32_MIN && d <= INT32_MAX && static_cast<double>(static_cast<int32_t>(d)) == d)
+            return PyLong_FromLong(static_cast<int32_t>(d));
+        else
+            return PyFloat_FromDouble(d);
+    }
+
+    // returns nullptr if the value is not a string
+    PyObject* convertString(napi_env env, napi_value arg)
+    {
+        // most strings fit into the buffer, so they are converted with a single copy
+        thread_local std::vector<char> buffer(STRING_BUFFER_MIN_SIZE);
+
+        size_t length = 0;
+        if (napi_get_value_string_utf8(env, arg, buffer.data(), buffer.size(), &length) != napi_ok)
+            return nullptr;
+
+        // the copy stops at a character boundary, so a truncated string can be up to 3 bytes shorter than the buffer
+        if (length + 4 < buffer.size())
+            return PyUnicode_FromStringAndSize(buffer.data(), length);
+
+        // longer strings are copied as utf-16, their length is known by V8 without an encoding pass
+        CHECK(napi_get_value_string_utf16(env, arg, NULL, 0, &length));
+        if (buffer.size() < (length + 1) * sizeof(char16_t))
+            buffer.resize((length + 1) * sizeof(char16_t));
+        CHECK(napi_get_value_string_utf16(env, arg, reinterpret_cast<char16_t*>(buffer.data()), length + 1, &length));
+
+        // lone surrogates become U+FFFD, as they do in the utf-8 copy of the short strings
+        int byteorder = PY_BIG_ENDIAN ? 1 : -1;
+        auto* result = PyUnicode_DecodeUTF16(buffer.data(), length * sizeof(char16_t), "replace", &byteorder);
+
+        if (buffer.size() > STRING_BUFFER_MAX_SIZE)
+            std::vector<char>(STRING_BUFFER_MIN_SIZE).swap(buffer);
+
+        return result;
+    }
+
+    PyObject* convertArray(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py)
+    {
+        uint32_t length = 0;
+        CHECK(napi_get_array_length(env, arg, &length));
+
+        CPyObject list = PyList_New(length);
+
+        // while the elements have the same primitive type, the next element is read without probing its type
+        auto last = napi_undefined;
+        auto mixed = false;
+        for (auto i = 0u; i < length; ++i)
+        {
+            napi_value value;
+            CHECK(napi_get_element(env, arg, i, &value));
+
+            PyObject* item = nullptr;
+            if (last == napi_number)
+            {
+                double d = 0.0;
+                if (napi_get_value_double(env, value, &d) == napi_ok)
+                    item = convertNumber(d);
+            }
+            else if (last == napi_string)
+                item = convertString(env, value);
+
+            if (!item)
+            {
+                napi_valuetype type;
+                CHECK(napi_typeof(env, value, &type));
+
+                if (last != napi_undefined && type != last)
+                    mixed = true;
+                last = mixed ? napi_undefined : type;
+
+                item = convertValue(env, value, type, isSync, allowFunc, syncJsAndPy, py).first;
+            }
+
+            PyList_SET_ITEM(*list, i, item);
+        }
+
+        Py_INCREF(*list);
+        return *list;
+    }
+
+    // returns nullptr if the object is not an ArrayBuffer, a typed array (including Buffer) or a DataView
+    PyObject* convertBinary(napi_env env, napi_value arg)
+    {
+        bool istypedarray = false;
+        CHECK(napi_is_typedarray(env, arg, &istypedarray));
+        if (istypedarray)
+        {
+            napi_typedarray_type type;
+            void* data = nullptr;
+            size_t len = 0;
+            CHECK(napi_get_typedarray_info(env, arg, &type, &len, &data, nullptr, nullptr));
+
+            switch (type)
+            {
+            case napi_int16_array:
+            case napi_uint16_array:
+                len *= 2;
+                break;
+            case napi_int32_array:
+            case napi_uint32_array:
+            case napi_float32_array:
+                len *= 4;
+                break;
+            case napi_float64_array:
+            case napi_bigint64_array:
+            case napi_biguint64_array:
+                len *= 8;
+                break;
+            default:
+                break;
+            }
+
+            return PyBytes_FromStringAndSize((const char*)data, len);
+        }
+
+        bool isarraybuffer = false;
+        CHECK(napi_is_arraybuffer(env, arg, &isarraybuffer));
+        if (isarraybuffer)
+        {
+            void* data = nullptr;
+            size_t len = 0;
+            CHECK(napi_get_arraybuffer_info(env, arg, &data, &len));
+            return PyBytes_FromStringAndSize((const char*)data, len);
+        }
+
+        bool isdataview = false;
+        CHECK(napi_is_dataview(env, arg, &isdataview));
+        if (isdataview)
+        {
+            void* data = nullptr;
+            size_t len = 0;
+            CHECK(napi_get_dataview_info(env, arg, &len, &data, nullptr, nullptr));
+            return PyBytes_FromStringAndSize((const char*)data, len);
+        }
+
+        return nullptr;
+    }
+
+    std::pair<PyObject*, bool> convertObject(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py)
+    {
+        DepthGuard guard;
+        bool isarray = false;
+        CHECK(napi_is_array(env, arg, &isarray));
+        if (isarray)
+            return { convertArray(env, arg, isSync, allowFunc, syncJsAndPy, py), false };
+
+        auto bytes = convertBinary(env, arg);
+        if (bytes)
+            return { bytes, false };
+
+        bool isHandler = false;
+        CHECK(napi_check_object_type_tag(env, arg, &HANDLER_TYPE_TAG, &isHandler));
+        if (isHandler && py)
+        {
+            napi_value handler;
+            CHECK(napi_get_named_property(env, arg, "handler", &handler));
+
+            size_t length = 0;
+            CHECK(napi_get_value_string_utf8(env, handler, NULL, 0, &length));
+            std::string s(length, ' ');
+            CHECK(napi_get_value_string_utf8(env, handler, &s[0], length + 1, &length));
+
+            auto obj = py->getObject(s);
+            Py_INCREF(*obj);
+            return { *obj, false };
+        }
+
+        napi_value properties;
+        CHECK(napi_get_property_names(env, arg, &properties));
+
+        uint32_t length = 0;
+        CHECK(napi_get_array_length(env, properties, &length));
+
+        auto kwargs = false;
+
+        auto* dict = PyDict_New();
+        for (auto i = 0u; i < length; ++i)
+        {
+            napi_value key;
+            CHECK(napi_get_element(env, properties, i, &key));
+
+            napi_value value;
+            CHECK(napi_get_property(env, arg, key, &value));
+
+            napi_valuetype keyType;
+            CHECK(napi_typeof(env, key, &keyType));
+            auto thisKwargs = false;
+            if (keyType == napi_string)
+            {
+                napi_valuetype valueType;
+                CHECK(napi_typeof(env, value, &valueType));
+                if (valueType == napi_boolean)
+                {
+                    size_t length = 0;
+                    CHECK(napi_get_value_string_utf8(env, key, NULL, 0, &length));
+                    std::string s(length, ' ');
+                    CHECK(napi_get_value_string_utf8(env, key, &s[0], length + 1, &length));
+                    if (s == "__kwargs")
+                    {
+                        CHECK(napi_get_value_bool(env, value, &thisKwargs));
+                    }
+                }
+            }
+
+            if (thisKwargs)
+                kwargs = true;
+            else
+            {
+                CPyObject pykey = ::convert(env, key, isSync, allowFunc, syncJsAndPy, py).first;
+
+                CPyObject pyvalue = ::convert(env, value, isSync, allowFunc, syncJsAndPy, py).first;
+
+                PyDict_SetItem(dict, *pykey, *pyvalue);
+            }
+        }
+
+        return { dict, kwargs };
+    }
+
+    PyObject* convertFunction(napi_env env, napi_value arg, bool isSync, bool syncJsAndPy, PyInterpreter* py)
+    {
+        if (isSync)
+        {
+            CPyObject capsule = PyCapsule_New(new SycnCallback{env, arg, std::this_thread::get_id()}, nullptr, capsuleDestructorSync);
+            return PyCFunction_New(&mlSync, *capsule);
+        }
+        else if (!syncJsAndPy && py && py->batchCallbacks())
+        {
+            napi_value workName;
+            CHECK(napi_create_string_utf8(env, "ThreadSafeCallback", NAPI_AUTO_LENGTH, &workName));
+
+            auto callback = new BatchedCallback;
+            callback->asArray = py->batchCallbacksAsArray();
+
+            auto status = napi_create_threadsafe_function(env, arg, nullptr, workName, 0, 1, callback, batchedCallbackFinalizer, callback, callJsBatched, &callback->tsfn);
+            if (status != napi_ok)
+            {
+                delete callback;
+                CHECK(status);
+            }
+
+            CPyObject capsule = PyCapsule_New(callback, nullptr, capsuleDestructorBatched);
+            return PyCFunction_New(&mlAsyncBatched, *capsule);
+        }
+        else
+        {
+            auto tsfn = new napi_threadsafe_function;
+
+            napi_value workName;
+            CHECK(napi_create_string_utf8(env, "ThreadSafeCallback", NAPI_AUTO_LENGTH, &workName));
+
+            CPyObject capsule = PyCapsule_New(tsfn, nullptr, capsuleDestructor);
+            PyObject* function = nullptr;
+            if (syncJsAndPy)
+            {
+                CHECK(napi_create_threadsafe_function(env, arg, nullptr, workName, 0, 1, nullptr, nullptr, nullptr, callJsPromise, tsfn));
+                function = PyCFunction_New(py && py->awaitableCallbacks() ? &mlAsyncAwaitable : &mlAsyncPromise, *capsule);
+            }
+            else
+            {
+                CHECK(napi_create_threadsafe_function(env, arg, nullptr, workName, 0, 1, nullptr, nullptr, nullptr, callJs, tsfn));
+                function = PyCFunction_New(&mlAsync, *capsule);
+            }
+
+            return function;
+        }
+    }
+
+    // dispatches on the type first, only objects are probed for their subtypes
+    std::pair<PyObject*, bool> convertValue(napi_env env, napi_value arg, napi_valuetype type, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py)
+    {
+        switch (type)
+        {
+        case napi_undefined:
+        case napi_null:
+            Py_INCREF(Py_None);
+            return { Py_None, false };
+        case napi_string:
+            return { convertString(env, arg), false };
+        case napi_number:
+        {
+            double d = 0.0;
+            CHECK(napi_get_value_double(env, arg, &d));
+            return { convertNumber(d), false };
+        }
+        case napi_boolean:
+        {
+            bool b = false;
+            CHECK(napi_get_value_bool(env, arg, &b));
+            return { b ? PyBool_FromLong(1) : PyBool_FromLong(0), false };
+        }
+        case napi_object:
+            return convertObject(env, arg, isSync, allowFunc, syncJsAndPy, py);
+        case napi_function:
+            if (allowFunc)
+                return { convertFunction(env, arg, isSync, syncJsAndPy, py), false };
+            break;
+        default:
+            break;
+        }
+
+        return { handleInteger(env, arg), false };
+    }
+
+    std::pair<PyObject*, bool> convert(napi_env env, napi_value arg, bool isSync, bool allowFunc, bool syncJsAndPy, PyInterpreter* py)
+    {
+        napi_valuetype type;
+        CHECK(napi_typeof(env, arg, &type));
+
+        return convertValue(env, arg, type, isSync, allowFunc, syncJsAndPy, py);
+    }
+
+    // returns a JS function of (object, index): it returns the index stored for the object, or stores index and returns undefined
+    // the objects are kept in a Map, so a new function has to be created for every conversion
+    napi_value createIdentityMemo(napi_env env)
+    {
+        auto& envData = getEnvData(env);
+
+        napi_value factory;
+        if (!envData.identityMemoFactory)
+        {
+            napi_value source;
+            CHECK(napi_create_string_utf8(env, "(function () { const map = new Map(); return function (obj, index) { const found = map.get(obj); if (found === undefined) map.set(obj, index); return found; }; })", NAPI_AUTO_LENGTH, &source));
+            CHECK(napi_run_script(env, source, &factory));
+            CHECK(napi_create_reference(env, factory, 1, &envData.identityMemoFactory));
+        }
+        else
+            CHECK(napi_get_reference_value(env, envData.identityMemoFactory, &factory));
+
+        napi_value undefined, memo;
+        CHECK(napi_get_undefined(env, &undefined));
+        CHECK(napi_call_function(env, undefined, factory, 0, nullptr, &memo));
+        return memo;
+    }
+
+    // the JS -> python counterpart of GraphToJs, the memo is shared by all the arguments of a call
+    class GraphToPython
+    {
+        struct Frame
+        {
+            napi_value js;
+            PyObject* target;
+            napi_value keys;
+            uint32_t length;
+            uint32_t pos;
+        };
+
+        napi_env m_env;
+        bool m_isSync;
+        bool m_syncJsAndPy;
+        PyInterpreter* m_py;
+        napi_value m_memo;
+        std::vector<CPyObject> m_objects;
+        std::vector<Frame> m_stack;
+        bool m_kwargs;
+
+        // returns a new reference, objects and arrays are only created here and filled later by convert
+        PyObject* visit(napi_value value)
+        {
+            napi_valuetype type;
+            CHECK(napi_typeof(m_env, value, &type));
+            if (type != napi_object && type != napi_function)
+                return convertValue(m_env, value, type, m_isSync, true, m_syncJsAndPy, m_py).first;
+
+            napi_value args[2] = { value, nullptr };
+            CHECK(napi_create_uint32(m_env, static_cast<uint32_t>(m_objects.size()), &args[1]));
+
+            napi_value undefined, found;
+            CHECK(napi_get_undefined(m_env, &undefined));
+            CHECK(napi_call_function(m_env, undefined, m_memo, 2, args, &found));
+
+            uint32_t index = 0;
+            if (napi_get_value_uint32(m_env, found, &index) == napi_ok)
+            {
+                auto obj = *m_objects[index];
+                Py_INCREF(obj);
+                return obj;
+            }
+
+            m_objects.emplace_back();
+            auto slot = m_objects.size() - 1;
+
+            PyObject* result = nullptr;
+            if (type == napi_function)
+                result = convertFunction(m_env, value, m_isSync, m_syncJsAndPy, m_py);
+            else
+                result = visitObject(value);
+
+            if (!result)
+                throw std::runtime_error("Cannot convert the JavaScript object");
+
+            Py_INCREF(result);
+            m_objects[slot] = result;
+            return result;
+        }
+
+        PyObject* visitObject(napi_value value)
+        {
+            bool isArray = false;
+            CHECK(napi_is_array(m_env, value, &isArray));
+            if (isArray)
+            {
+                uint32_t length = 0;
+                CHECK(napi_get_array_length(m_env, value, &length));
+
+                // the items are set by convert, until then they are NULL which python accepts for unfinished lists
+                auto list = PyList_New(length);
+                if (list)
+                    m_stack.push_back({ value, list, nullptr, length, 0 });
+                return list;
+            }
+
+            auto bytes = convertBinary(m_env, value);
+            if (bytes)
+                return bytes;
+
+            bool isHandler = false;
+            CHECK(napi_check_object_type_tag(m_env, value, &HANDLER_TYPE_TAG, &isHandler));
+            if (isHandler)
+                return convertObject(m_env, value, m_isSync, true, m_syncJsAndPy, m_py).first;
+
+            napi_value keys;
+            CHECK(napi_get_property_names(m_env, value, &keys));
+            uint32_t length = 0;
+            CHECK(napi_get_array_length(m_env, keys, &length));
+
+            auto dict = PyDict_New();
+            if (dict)
+                m_stack.push_back({ value, dict, keys, length, 0 });
+            return dict;
+        }
+
+        bool isKwargsFlag(napi_value key, napi_value value)
+        {
+            napi_valuetype type;
+            CHECK(napi_typeof(m_env, value, &type));
+            if (type != napi_boolean)
+                return false;
+
+            char name[9];
+            size_t length = 0;
+            if (napi_get_value_string_utf8(m_env, key, name, sizeof(name), &length) != napi_ok || std::string(name, length) != "__kwargs")
+                return false;
+
+            bool flag = false;
+            CHECK(napi_get_value_bool(m_env, value, &flag));
+            return flag;
+        }
+
+    public:
+        GraphToPython(napi_env env, bool isSync, bool syncJsAndPy, PyInterpreter* py) : m_env(env), m_isSync(isSync), m_syncJsAndPy(syncJsAndPy), m_py(py), m_memo(createIdentityMemo(env)), m_kwargs(false) {}
+
+        std::pair<PyObject*, bool> convert(napi_value arg)
+        {
+            m_kwargs = false;
+            CPyObject result = visit(arg);
+            auto root = m_stack.empty() ? nullptr : m_stack.front().target;
+
+            while (!m_stack.empty())
+            {
+                // visit may grow the stack, so the frame is always accessed by index
+                auto index = m_stack.size() - 1;
+                auto frame = m_stack[index];
+                if (frame.pos >= frame.length)
+                {
+                    m_stack.pop_back();
+                    continue;
+                }
+                ++m_stack[index].pos;
+
+                if (!frame.keys)
+                {
+                    napi_value item;
+                    CHECK(napi_get_element(m_env, frame.js, frame.pos, &item));
+                    PyList_SET_ITEM(frame.target, frame.pos, visit(item));
+                    continue;
+                }
+
+                napi_value key, value;
+                CHECK(napi_get_element(m_env, frame.keys, frame.pos, &key));
+                CHECK(napi_get_property(m_env, frame.js, key, &value));
+
+                if (isKwargsFlag(key, value))
+                {
+                    if (frame.target == root)
+                        m_kwargs = true;
+                    continue;
+                }
+
+                CPyObject pykey = ::convert(m_env, key, m_isSync, true, m_syncJsAndPy, m_py).first;
+                CPyObject pyvalue = visit(value);
+                if (!pykey || !pyvalue || PyDict_SetItem(frame.target, *pykey, *pyvalue) != 0)
+                {
+                    PyErr_Clear();
+                    throw std::runtime_error("Cannot convert the JavaScript object");
+                }
+            }
+
+            auto obj = *result;
+            Py_INCREF(obj);
+            return { obj, m_kwargs };
+        }
+    };
+}
+
+namespace
+{
+    void handleException();
+
+    // a JS object or array passed to python as a lazy proxy, it is only valid until the end of the ProxyScope it was created in
+    // and only on the JS thread which created it, python code running on other threads cannot enter V8
+    struct JsProxy
+    {
+        napi_env env;
+        napi_ref ref = nullptr;
+        PyInterpreter* py;
+        std::thread::id thread;
+        std::atomic<bool> valid;
+
+        JsProxy(napi_env env, PyInterpreter* py) : env(env), py(py), thread(std::this_thread::get_id()), valid(true) {}
+    };
+
+    using JsProxyPtr = std::shared_ptr<JsProxy>;
+
+    // the proxies of the active scopes, nested scopes come from sync calls made by JS functions called from python
+    thread_local std::vector<std::vector<JsProxyPtr> > proxyScopes;
+
+    const char* PROXY_SOURCE = R"py(
+import collections.abc
+import operator
+
+class JsObject(collections.abc.Mapping):
+    """Read-only view of a JavaScript object, the properties are converted on first access"""
+    __slots__ = ("_js", "_cache")
+
+    def __init__(self, js):
+        self._js = js
+        self._cache = {}
+
+    def __getitem__(self, key):
+        if key not in self._cache:
+            self._cache[key] = _get(self._js, key)
+        return self._cache[key]
+
+    def __iter__(self):
+        return iter(_keys(self._js))
+
+    def __len__(self):
+        return len(_keys(self._js))
+
+    def __repr__(self):
+        return "JsObject(%r)" % dict(self)
+
+class JsArray(collections.abc.Sequence):
+    """Read-only view of a JavaScript array, the elements are converted on first access"""
+    __slots__ = ("_js", "_cache", "_length")
+
+    def __init__(self, js):
+        self._js = js
+        self._cache = {}
+        self._length = _len(js)
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(self._length))]
+
+        index = operator.index(index)
+        if index < 0:
+            index += self._length
+        if index < 0 or index >= self._length:
+            raise IndexError("JsArray index out of range")
+
+        if index not in self._cache:
+            self._cache[index] = _get(self._js, index)
+        return self._cache[index]
+
+    def __len__(self):
+        return self._length
+
+    def __repr__(self):
+        return "JsArray(%r)" % list(self)
+)py";
+
+    napi_value getProxyValue(PyObject* capsule, JsProxy*& proxy)
+    {
+        auto ptr = reinterpret_cast<JsProxyPtr*>(PyCapsule_GetPointer(capsule, nullptr));
+        if (!ptr)
+            throw std::runtime_error("Invalid JavaScript proxy");
+
+        proxy = ptr->get();
+        if (proxy->thread != std::this_thread::get_id())
+            throw std::runtime_error("JavaScript object can only be used on the thread of the sync call it was passed to");
+        if (!proxy->valid)
+            throw std::runtime_error("JavaScript object is not available anymore, it can only be used during the sync call it was passed to");
+
+        napi_value value;
+        CHECK(napi_get_reference_value(proxy->env, proxy->ref, &value));
+        return value;
+    }
+
+    PyObject* createProxy(napi_env env, napi_value value, PyInterpreter* py, bool isArray);
+
+    // returns a proxy for plain objects and arrays, nullptr for everything else
+    PyObject* tryCreateProxy(napi_env env, napi_value value, PyInterpreter* py)
+    {
+        napi_valuetype type;
+        CHECK(napi_typeof(env, value, &type));
+
+        if (type == napi_object)
+        {
+            bool isArray = false;
+            CHECK(napi_is_array(env, value, &isArray));
+
+            bool isOther = false;
+            if (!isArray)
+            {
+                bool is = false;
+                CHECK(napi_is_typedarray(env, value, &is));
+                isOther |= is;
+                CHECK(napi_is_arraybuffer(env, value, &is));
+                isOther |= is;
+                CHECK(napi_is_dataview(env, value, &is));
+                isOther |= is;
+                CHECK(napi_check_object_type_tag(env, value, &HANDLER_TYPE_TAG, &is));
+                isOther |= is;
+                CHECK(napi_has_named_property(env, value, "__kwargs", &is));
+                isOther |= is;
+            }
+
+            if (!isOther)
+                return createProxy(env, value, py, isArray);
+        }
+
+        return nullptr;
+    }
+
+    PyObject* __js_get(PyObject* self, PyObject* args)
+    {
+        PyObject *capsule, *key;
+        if (!PyArg_ParseTuple(args, "OO", &capsule, &key))
+            return nullptr;
+
+        try
+        {
+            JsProxy* proxy;
+            auto object = getProxyValue(capsule, proxy);
+
+            napi_value value;
+            if (PyLong_Check(key))
+            {
+                CHECK(napi_get_element(proxy->env, object, static_cast<uint32_t>(PyLong_AsUnsignedLong(key)), &value));
+            }
+            else if (PyUnicode_Check(key))
+            {
+                napi_value name;
+                Py_ssize_t size;
+                auto str = PyUnicode_AsUTF8AndSize(key, &size);
+                CHECK(napi_create_string_utf8(proxy->env, str, size, &name));
+
+                bool has = false;
+                CHECK(napi_has_own_property(proxy->env, object, name, &has));
+                if (!has)
+                {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    return nullptr;
+                }
+
+                CHECK(napi_get_property(proxy->env, object, name, &value));
+            }
+            else
+            {
+                PyErr_SetObject(PyExc_KeyError, key);
+                return nullptr;
+            }
+
+            auto result = tryCreateProxy(proxy->env, value, proxy->py);
+            return result ? result : convert(proxy->env, value, true, true, false, proxy->py).first;
+        }
+        catch(const std::exception& e)
+        {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return nullptr;
+        }
+    }
+
+    PyObject* __js_keys(PyObject* self, PyObject* capsule)
+    {
+        try
+        {
+            JsProxy* proxy;
+            auto object = getProxyValue(capsule, proxy);
+
+            napi_value properties;
+            CHECK(napi_get_property_names(proxy->env, object, &properties));
+
+            uint32_t length = 0;
+            CHECK(napi_get_array_length(proxy->env, properties, &length));
+
+            CPyObject keys = PyList_New(length);
+            for (auto i = 0u; i < length; ++i)
+            {
+                napi_value key;
+                CHECK(napi_get_element(proxy->env, properties, i, &key));
+                auto item = convertString(proxy->env, key);
+                if (!item)
+                    throw std::runtime_error("Cannot convert the keys of the JavaScript object");
+                PyList_SET_ITEM(*keys, i, item);
+            }
+
+            Py_INCREF(*keys);
+            return *keys;
+        }
+        catch(const std::exception& e)
+        {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return nullptr;
+        }
+    }
+
+    PyObject* __js_len(PyObject* self, PyObject* capsule)
+    {
+        try
+        {
+            JsProxy* proxy;
+            auto object = getProxyValue(capsule, proxy);
+
+            uint32_t length = 0;
+            CHECK(napi_get_array_length(proxy->env, object, &length));
+            return PyLong_FromUnsignedLong(length);
+        }
+        catch(const std::exception& e)
+        {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return nullptr;
+        }
+    }
+
+    PyMethodDef mlJsGet = { "_get", (PyCFunction)(void(*)(void))__js_get, METH_VARARGS, nullptr };
+    PyMethodDef mlJsKeys = { "_keys", (PyCFunction)(void(*)(void))__js_keys, METH_O, nullptr };
+    PyMethodDef mlJsLen = { "_len", (PyCFunction)(void(*)(void))__js_len, METH_O, nullptr };
+
+    // the namespace holding JsObject and JsArray, it is created once and never released
+    std::atomic<PyObject*> proxyClasses{nullptr};
+
+    // returns the proxy namespace (borrowed)
+    PyObject* getProxyClasses()
+    {
+        auto& classes = proxyClasses;
+        auto globals = classes.load();
+        if (globals)
+            return globals;
+
+        globals = PyDict_New();
+        PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+        for (auto ml : { &mlJsGet, &mlJsKeys, &mlJsLen })
+        {
+            CPyObject function = PyCFunction_New(ml, nullptr);
+            PyDict_SetItemString(globals, ml->ml_name, *function);
+        }
+
+        CPyObject result = PyRun_String(PROXY_SOURCE, Py_file_input, globals, globals);
+        if (!result)
+        {
+            Py_DECREF(globals);
+            handleException();
+            throw std::runtime_error("Cannot create the JavaScript proxy classes");
+        }
+
+        PyObject* expected = nullptr;
+        if (!classes.compare_exchange_strong(expected, globals))
+        {
+            Py_DECREF(globals);
+            return expected;
+        }
+        return globals;
+    }
+
+    // proxies returned to JS are the original JS values
+    bool getProxyOriginal(PyObject* obj, napi_value& value)
+    {
+        auto globals = proxyClasses.load();
+        if (!globals)
+            return false;
+
+        auto type = reinterpret_cast<PyObject*>(Py_TYPE(obj));
+        if (type != PyDict_GetItemString(globals, "JsObject") && type != PyDict_GetItemString(globals, "JsArray"))
+            return false;
+
+        CPyObject capsule = PyObject_GetAttrString(obj, "_js");
+        if (!capsule)
+        {
+            PyErr_Clear();
+            return false;
+        }
+
+        JsProxy* proxy;
+        value = getProxyValue(*capsule, proxy);
+        return true;
+    }
+
+    void capsuleDestructorProxy(PyObject* obj)
+    {
+        delete reinterpret_cast<JsProxyPtr*>(PyCapsule_GetPointer(obj, nullptr));
+    }
+
+    PyObject* createProxy(napi_env env, napi_value value, PyInterpreter* py, bool isArray)
+    {
+        auto proxy = std::make_shared<JsProxy>(env, py);
+        CHECK(napi_create_reference(env, value, 1, &proxy->ref));
+        proxyScopes.back().push_back(proxy);
+
+        auto cls = PyDict_GetItemString(getProxyClasses(), isArray ? "JsArray" : "JsObject");
+        CPyObject capsule = PyCapsule_New(new JsProxyPtr(proxy), nullptr, capsuleDestructorProxy);
+        auto result = PyObject_CallFunctionObjArgs(cls, *capsule, nullptr);
+        if (!result)
+        {
+            handleException();
+            throw std::runtime_error("Cannot create the JavaScript proxy");
+        }
+        return result;
+    }
+}
+
+ProxyScope::ProxyScope()
+{
+    proxyScopes.emplace_back();
+}
+
+ProxyScope::~ProxyScope()
+{
+    for (auto& proxy : proxyScopes.back())
+    {
+        proxy->valid = false;
+        napi_delete_reference(proxy->env, proxy->ref);
+    }
+    proxyScopes.pop_back();
+}
+
+std::pair<CPyObject, CPyObject> PyInterpreter::convert(napi_env env, const std::vector<napi_value>& args, bool isSync)
+{
+    return convert(env, args.data(), args.size(), isSync);
+}
+
+std::pair<CPyObject, CPyObject> PyInterpreter::convert(napi_env env, const napi_value* args, size_t argc, bool isSync)
+{
+    // the arguments are stored into the tuple directly, the filled part is copied at the end if one of them was the kwargs
+    CPyObject params = PyTuple_New(argc);
+    CPyObject kwargs;
+    Py_ssize_t size = 0;
+    auto lazy = isSync && m_lazyArguments && !proxyScopes.empty();
+    std::unique_ptr<GraphToPython> graph(m_preserveReferences ? new GraphToPython(env, isSync, m_syncJsAndPy, this) : nullptr);
+    for (auto i=0u;i<argc;++i)
+    {
+        auto proxy = lazy ? tryCreateProxy(env, args[i], this) : nullptr;
+        auto cparams = proxy ? std::make_pair(proxy, false) : graph ? graph->convert(args[i]) : ::convert(env, args[i], isSync, true, m_syncJsAndPy, this);
+        if (!cparams.first)
+            throw std::runtime_error("Cannot convert #" + std::to_string(i + 1) + " argument");
+
+        if (cparams.second)
+            kwargs = cparams.first;
+        else
+            PyTuple_SET_ITEM(*params, size++, cparams.first);
+    }
+
+    if (size != static_cast<Py_ssize_t>(argc))
+    {
+        params = PyTuple_GetSlice(*params, 0, size);
+        if (!params)
+        {
+            PyErr_Clear();
+            throw std::runtime_error("Cannot create the arguments");
+        }
+    }
+
+    return { params, kwargs };
+}
+
+napi_value PyInterpreter::convert(napi_env env, PyObject* obj)
+{
+    if (m_preserveReferences)
+        return GraphToJs(env).convert(obj);
+
+    return ::convert(env, obj);
+}
+
+namespace
+{
+    static const char MODULE = '@';
+    static const char INSTANCE = '#';
+
+    std::string getUUID(bool module, CPyObject& obj)
+    {
+        std::stringstream ss;
+        ss << (module ? MODULE : INSTANCE);
+        ss << "nodecallspython-";
+        // rand is not thread safe on free-threaded python, a counter also keeps the handlers unique
+        static std::atomic<uint64_t> counter{0};
+        ss << ++counter << "-";
+        ss << *obj;
+        return ss.str();
+    }
+
+    // the name python prints in tracebacks: the qualified name of the type, prefixed with its module unless it is a builtin
+    std::string getTypeName(PyObject* type)
+    {
+        CPyObject qualname = PyObject_GetAttrString(type, "__qualname__");
+        CPyObject module = PyObject_GetAttrString(type, "__module__");
+        PyErr_Clear();
+
+        // names which cannot be encoded, e.g. with lone surrogates, fall back to the name of the C type
+        auto qualnameUtf8 = qualname && PyUnicode_Check(*qualname) ? PyUnicode_AsUTF8(*qualname) : nullptr;
+        auto moduleUtf8 = module && PyUnicode_Check(*module) ? PyUnicode_AsUTF8(*module) : nullptr;
+        PyErr_Clear();
+
+        std::string name = qualnameUtf8 ? qualnameUtf8 : reinterpret_cast<PyTypeObject*>(type)->tp_name;
+        if (moduleUtf8)
+        {
+            std::string moduleName = moduleUtf8;
+            if (moduleName != "builtins" && moduleName != "__main__")
+                name = moduleName + "." + name;
+        }
+        return name;
+    }
+
+    void handleException()
+    {
+        if (PyErr_Occurred())
+        {
+            PyObject *type, *value, *traceback;
+            PyErr_Fetch(&type, &value, &traceback);
+            PyErr_NormalizeException(&type, &value, &traceback);
+
+            // the traceback is only formatted if JS reads it, until then it is kept on the exception
+            if (value && traceback)
+                PyException_SetTraceback(value, traceback);
+            Py_XDECREF(traceback);
+
+            if (!value)
+            {
+                Py_XDECREF(type);
+                throw std::runtime_error("Unknown python error");
+            }
+
+            auto name = getTypeName(type);
+            Py_XDECREF(type);
+
+            std::string message;
+            CPyObject str = PyObject_Str(value);
+            if (str)
+            {
+                auto utf8 = PyUnicode_AsUTF8(*str);
+                if (utf8)
+                    message = utf8;
+            }
+            // the error is reported as a C++ exception, so do not leave it set on the (possibly persistent) thread state
+            PyErr_Clear();
+
+            throw PyError(value, name, message);
+        }
+    }
+
+    // returns traceback.format_exception (borrowed) or nullptr, it is looked up once and never released
+    PyObject* getFormatException()
+    {
+        static std::atomic<PyObject*> traceback{nullptr};
+        static std::atomic<PyObject*> formatException{nullptr};
+
+        auto function = formatException.load();
+        if (function)
+            return function;
+
+        auto module = importOnce(traceback, "traceback");
+        if (!module)
+            return nullptr;
+
+        function = PyObject_GetAttrString(module, "format_exception");
+        if (!function)
+            return nullptr;
+
+        PyObject* expected = nullptr;
+        if (!formatException.compare_exchange_strong(expected, function))
+        {
+            Py_DECREF(function);
+            return expected;
+        }
+        return function;
+    }
+
+    // must be called holding the GIL
+    std::string formatTraceback(PyObject* exception)
+    {
+        auto function = getFormatException();
+        CPyObject traceback = PyException_GetTraceback(exception);
+        CPyObject lines = function ? PyObject_CallFunctionObjArgs(function, reinterpret_cast<PyObject*>(Py_TYPE(exception)), exception, traceback ? *traceback : Py_None, nullptr) : nullptr;
+        CPyObject empty = PyUnicode_FromString("");
+        CPyObject text = lines ? PyUnicode_Join(*empty, *lines) : nullptr;
+
+        std::string result;
+        auto utf8 = text ? PyUnicode_AsUTF8(*text) : nullptr;
+        if (utf8)
+            result = utf8;
+        PyErr_Clear();
+        return result;
+    }
+
+    // wrapped by the JS error, it keeps the python exception alive until the error is garbage collected
+    struct ErrorTraceback
+    {
+        std::shared_ptr<PyObject> exception;
+        std::string fallback;
+        std::string text;
+        bool formatted;
+    };
+
+    napi_value getErrorTraceback(napi_env env, napi_callback_info info)
+    {
+        napi_value jsthis;
+        napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+
+        // PyError.prototype itself or an object inheriting from it
+        void* data = nullptr;
+        if (napi_unwrap(env, jsthis, &data) != napi_ok || !data)
+        {
+            napi_value undefined;
+            napi_get_undefined(env, &undefined);
+            return undefined;
+        }
+
+        auto traceback = reinterpret_cast<ErrorTraceback*>(data);
+        if (!traceback->formatted)
+        {
+            GIL gil;
+            traceback->text = formatTraceback(traceback->exception.get());
+            if (traceback->text.empty())
+                traceback->text = traceback->fallback;
+            traceback->formatted = true;
+        }
+
+        napi_value result;
+        napi_create_string_utf8(env, traceback->text.c_str(), traceback->text.size(), &result);
+        return result;
+    }
+
+    void errorTracebackFinalizer(napi_env env, void* data, void* hint)
+    {
+        delete reinterpret_cast<ErrorTraceback*>(data);
+    }
+
+    // an args item or attribute which cannot be converted is passed as its repr, so the error is still a PyError
+    napi_value convertErrorValue(napi_env env, PyObject* value)
+    {
+        try
+        {
+            return ::convert(env, value);
+        }
+        catch(const std::exception&)
+        {
+        }
+
+        PyErr_Clear();
+        CPyObject repr = PyObject_Repr(value);
+        auto utf8 = repr ? PyUnicode_AsUTF8(*repr) : nullptr;
+        PyErr_Clear();
+
+        napi_value result;
+        if (!utf8)
+        {
+            CHECK(napi_get_undefined(env, &result));
+            return result;
+        }
+
+        CHECK(napi_create_string_utf8(env, utf8, NAPI_AUTO_LENGTH, &result));
+        return result;
+    }
+
+    napi_value constructPyError(napi_env env, napi_callback_info info)
+    {
+        napi_value jsthis;
+        napi_get_cb_info(env, info, nullptr, nullptr, &jsthis, nullptr);
+        return jsthis;
+    }
+}
+
+napi_value nodecallspython::getPyErrorClass(napi_env env)
+{
+    auto& envData = getEnvData(env);
+
+    napi_value cls;
+    if (envData.pyErrorClass)
+    {
+        CHECK(napi_get_reference_value(env, envData.pyErrorClass, &cls));
+        return cls;
+    }
+
+    // the getters are defined on the prototype, so creating an error does not define any accessor on the instance
+    napi_property_descriptor properties[] = {
+        { "traceback", nullptr, nullptr, getErrorTraceback, nullptr, nullptr, napi_configurable, nullptr },
+        { "stack", nullptr, nullptr, getErrorTraceback, nullptr, nullptr, napi_configurable, nullptr }
+    };
+    CHECK(napi_define_class(env, "PyError", NAPI_AUTO_LENGTH, constructPyError, nullptr, 2, properties, &cls));
+
+    napi_value global, object, setPrototypeOf, error, errorPrototype, prototype, undefined, result;
+    CHECK(napi_get_global(env, &global));
+    CHECK(napi_get_named_property(env, global, "Object", &object));
+    CHECK(napi_get_named_property(env, object, "setPrototypeOf", &setPrototypeOf));
+    CHECK(napi_get_named_property(env, global, "Error", &error));
+    CHECK(napi_get_named_property(env, error, "prototype", &errorPrototype));
+    CHECK(napi_get_named_property(env, cls, "prototype", &prototype));
+    CHECK(napi_get_undefined(env, &undefined));
+
+    napi_value prototypeArgs[] = { prototype, errorPrototype };
+    CHECK(napi_call_function(env, undefined, setPrototypeOf, 2, prototypeArgs, &result));
+    napi_value classArgs[] = { cls, error };
+    CHECK(napi_call_function(env, undefined, setPrototypeOf, 2, classArgs, &result));
+
+    CHECK(napi_create_reference(env, cls, 1, &envData.pyErrorClass));
+    return cls;
+}
+
+PyError::PyError(PyObject* exception, const std::string& type, const std::string& message, const std::string& traceback) :
+    std::runtime_error(message.empty() ? type : type + ": " + message),
+    m_exception(exception, [](PyObject* obj) { GIL gil; Py_DECREF(obj); }),
+    m_type(type),
+    m_message(message),
+    m_traceback(traceback)
+{
+}
+
+napi_value nodecallspython::createJsError(napi_env env, const PyError& error)
+{
+    // a plain instance of PyError, the JS stack is not captured since the stack of the error is the python traceback
+    napi_value result;
+    CHECK(napi_new_instance(env, getPyErrorClass(env), 0, nullptr, &result));
+
+    napi_value name, message, code;
+    CHECK(napi_create_string_utf8(env, error.type().c_str(), error.type().size(), &name));
+    CHECK(napi_create_string_utf8(env, error.message().c_str(), error.message().size(), &message));
+    CHECK(napi_create_string_utf8(env, "py", NAPI_AUTO_LENGTH, &code));
+    CHECK(napi_set_named_property(env, result, "name", name));
+    CHECK(napi_set_named_property(env, result, "message", message));
+    CHECK(napi_set_named_property(env, result, "code", code));
+
+    {
+        GIL gil;
+        auto exception = error.exception().get();
+
+        CPyObject args = PyObject_GetAttrString(exception, "args");
+        if (args && PyTuple_Check(*args))
+        {
+            auto size = PyTuple_GET_SIZE(*args);
+            napi_value array;
+            CHECK(napi_create_array_with_length(env, size, &array));
+            for (Py_ssize_t i = 0; i < size; ++i)
+                CHECK(napi_set_element(env, array, static_cast<uint32_t>(i), convertErrorValue(env, PyTuple_GET_ITEM(*args, i))));
+            CHECK(napi_set_named_property(env, result, "args", array));
+        }
+        else if (args)
+            CHECK(napi_set_named_property(env, result, "args", convertErrorValue(env, *args)));
+        PyErr_Clear();
+
+        // the attributes set by the exception, e.g. in the constructor of a custom exception
+        CPyObject attributes = PyObject_GetAttrString(exception, "__dict__");
+        PyErr_Clear();
+
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+        while (attributes && PyDict_Check(*attributes) && PyDict_Next(*attributes, &pos, &key, &value))
+        {
+            auto utf8 = PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : nullptr;
+            if (!utf8 || utf8[0] == '_')
+                continue;
+
+            // the properties of every PyError take precedence over the attributes with the same name
+            std::string attribute = utf8;
+            if (attribute == "name" || attribute == "message" || attribute == "code" || attribute == "args" || attribute == "stack" || attribute == "traceback")
+                continue;
+
+            CHECK(napi_set_named_property(env, result, utf8, convertErrorValue(env, value)));
+        }
+        PyErr_Clear();
+    }
+
+    auto traceback = new ErrorTraceback{ error.exception(), error.what(), error.traceback(), !error.traceback().empty() };
+    auto status = napi_wrap(env, result, traceback, errorTracebackFinalizer, nullptr, nullptr);
+    if (status != napi_ok)
+    {
+        delete traceback;
+        CHECK(status);
+    }
+    return result;
+}
+std::string PyInterpreter::import(const std::string& modulename, bool allowReimport)
+{
+    releasePending();
+
+    auto name = modulename;
+    auto pos = name.find_last_of("\\");
+    if (pos == std::string::npos)
+        pos =  name.find_last_of("/");
+
+    if (pos != std::string::npos)
+    {
+        auto dir = name.substr(0, pos);
+        name = name.substr(pos + 1);
+
+        addImportPath(dir);
+    }
+
+    auto len = name.length();
+    if (len > 2 && name[len - 3] == '.' && name[len - 2] == 'p' && name[len - 1] == 'y')
+        name = name.substr(0, len - 3);
+    
+    PyErr_Clear();
+    CPyObject pyModule = PyImport_ImportModule(name.c_str());
+    if (!pyModule)
+    {
+        handleException();
+        return {};
+    }
+
+    bool imported = false;
+    {
+        std::lock_guard<std::mutex> l(m_importMutex);
+        imported = m_imports.count(*pyModule) > 0;
+    }
+
+    if (imported && allowReimport)
+    {
+        pyModule = PyImport_ReloadModule(*pyModule);
+        if (!pyModule)
+        {
+            handleException();
+            return {};
+        }
+    }
+
+    auto uuid = getUUID(true, pyModule);
+    m_objs.set(uuid, pyModule);
+
+    std::lock_guard<std::mutex> l(m_importMutex);
+    m_imports[*pyModule] = uuid;
+    return uuid;
+}
+
+CPyObject PyInterpreter::call(const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs)
+{
+    releasePending();
+
+    auto obj = m_objs.find(handler);
+
+    if (!obj)
+        throw std::runtime_error("Cannot find handler: " + handler);
+
+    return call(*obj, func, args, kwargs);
+}
+
+CPyObject PyInterpreter::call(PyObject* obj, const std::string& func, CPyObject& args, CPyObject& kwargs)
+{
+    PyErr_Clear();
+    CPyObject pyFunc = PyObject_GetAttrString(obj, func.c_str());
+    if (pyFunc && PyCallable_Check(*pyFunc))
+    {
+        CPyObject pyResult = PyObject_Call(*pyFunc, *args, *kwargs);
+        if (!*pyResult)
+        {
+            handleException();
+            throw std::runtime_error("Unknown python error");
+        }
+
+        return pyResult;
+    }
+    else
+        handleException();
+    
+    throw std::runtime_error("Unknown python error");
+}
+
+std::vector<CPyObject> PyInterpreter::pipeline(std::vector<PipelineStep>& steps)
+{
+    std::vector<CPyObject> results;
+    results.reserve(steps.size());
+
+    for (auto i=0u;i<steps.size();++i)
+    {
+        auto& step = steps[i];
+        for (auto& ref : step.refs)
+        {
+            if (ref.second >= i)
+                throw std::runtime_error("Step #" + std::to_string(i + 1) + " can only use the results of the previous steps");
+
+            if (ref.first >= static_cast<size_t>(PyTuple_Size(*step.args)))
+                throw std::runtime_error("Step #" + std::to_string(i + 1) + " has an invalid argument reference");
+
+            // the reference is stolen even if setting the item fails
+            auto result = *results[ref.second];
+            Py_INCREF(result);
+            if (PyTuple_SetItem(*step.args, ref.first, result) != 0)
+            {
+                handleException();
+                throw std::runtime_error("Step #" + std::to_string(i + 1) + " cannot use the result of step #" + std::to_string(ref.second + 1));
+            }
+        }
+
+        if (step.handler.empty())
+        {
+            if (step.handlerStep >= i)
+                throw std::runtime_error("Step #" + std::to_string(i + 1) + " can only use the results of the previous steps");
+
+            results.push_back(call(*results[step.handlerStep], step.func, step.args, step.kwargs));
+        }
+        else
+            results.push_back(call(step.handler, step.func, step.args, step.kwargs));
+    }
+
+    return results;
+}
+
+CPyObject PyInterpreter::exec(const std::string& handler, const std::string& code, bool eval)
+{
+    releasePending();
+
+    auto globals = CPyObject{PyDict_New()};
+
+    PyObject* localsPtr;
+    CPyObject module;
+    if (handler.empty())
+        localsPtr = *globals;
+    else
+    {
+        module = m_objs.find(handler);
+
+        if (!module)
+            throw std::runtime_error("Cannot find handler: " + handler);
+
+        localsPtr = PyModule_GetDict(*module);
+    }
+
+    PyErr_Clear();
+    CPyObject pyResult = PyRun_String(code.c_str(), eval ? Py_eval_input : Py_file_input, *globals, localsPtr);
+    if (!*pyResult)
+    {
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
+
+    return pyResult;
+}
+
+std::string PyInterpreter::create(const std::string& handler, const std::string& name, CPyObject& args, CPyObject& kwargs)
+{
+    auto obj = call(handler, name, args, kwargs);
+
+    if (obj)
+    {
+        auto uuid = getUUID(false, obj);
+        m_objs.set(uuid, obj);
+        return uuid;
+    }
+
+    return std::string();
+}
+
+std::string PyInterpreter::registerCallback(napi_env env, napi_value func)
+{
+    auto callback = new RegisteredCallback(env, m_syncJsAndPy, m_awaitableCallbacks);
+
+    napi_value workName;
+    CHECK(napi_create_string_utf8(env, "RegisteredCallback", NAPI_AUTO_LENGTH, &workName));
+
+    auto status = napi_create_reference(env, func, 1, &callback->func);
+    if (status == napi_ok)
+        status = napi_create_threadsafe_function(env, func, nullptr, workName, 0, 1, callback, registeredCallbackFinalizer, callback, m_syncJsAndPy ? callJsPromise : callJs, &callback->tsfn);
+    if (status != napi_ok)
+    {
+        if (callback->func)
+            napi_delete_reference(env, callback->func);
+        delete callback;
+        CHECK(status);
+    }
+
+    // a registered callback must not keep the process alive
+    CHECK(napi_unref_threadsafe_function(env, callback->tsfn));
+
+    CPyObject capsule = PyCapsule_New(callback, nullptr, capsuleDestructorRegistered);
+    CPyObject function = PyCFunction_New(&mlRegistered, *capsule);
+    if (!function)
     {
-        napi_valuetype type;
-        CHECK(napi_typeof(env, arg, &type));
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
 
-        bool isarray = false;
-        CHECK(napi_is_array(env, arg, &isarray));
+    auto uuid = getUUID(false, function);
+    m_objs.set(uuid, function);
+    return uuid;
+}
 
-        if (isarray)
-        {
-            uint32_t length = 0;
-            CHECK(napi_get_array_length(env, arg, &length));
+void PyInterpreter::release(const std::string& handler)
+{
+    auto obj = m_objs.erase(handler);
+    if (obj)
+    {
+        std::lock_guard<std::mutex> l(m_importMutex);
+        m_imports.erase(*obj);
+    }
+}
 
-            auto* list = PyList_New(length);
+int64_t PyInterpreter::getSize(const std::string& handler)
+{
+    auto found = m_objs.find(handler);
+    if (!found)
+        return 0;
 
-            for (auto i = 0u; i < length; ++i)
-            {
-                napi_value value;
-                CHECK(napi_get_element(env, arg, i, &value));
-                PyList_SetItem(list, i, ::convert(env, value, isSync, allowFunc, syncJsAndPy).first);
-            }
+    auto obj = *found;
 
-            return { list, false };
-        }
+    int64_t size = 0;
+    auto getsizeof = PySys_GetObject("getsizeof");
+    if (getsizeof)
+    {
+        CPyObject result = PyObject_CallFunctionObjArgs(getsizeof, obj, nullptr);
+        if (result)
+            size = PyLong_AsLongLong(*result);
+    }
 
-        bool isarraybuffer = false;
-        CHECK(napi_is_arraybuffer(env, arg, &isarraybuffer));
-        if (isarraybuffer)
+    // objects exposing a buffer (numpy arrays, bytes, ...) may not report the memory they only refer to
+    if (PyObject_CheckBuffer(obj))
+    {
+        Py_buffer view;
+        if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) == 0)
         {
-            void* data = nullptr;
-            size_t len = 0;
-            CHECK(napi_get_arraybuffer_info(env, arg, &data, &len));
-            auto* bytes = PyBytes_FromStringAndSize((const char*)data, len);
-            return { bytes, false };
+            size = std::max<int64_t>(size, view.len);
+            PyBuffer_Release(&view);
         }
+    }
+
+    PyErr_Clear();
+    return size > 0 ? size : 0;
+}
+
+CPyObject PyInterpreter::memoryStats()
+{
+    CPyObject stats = Py_BuildValue("{s:n,s:L}", "handles", static_cast<Py_ssize_t>(m_objs.size()), "bytes", static_cast<long long>(m_handlerMemory));
+    if (!stats)
+    {
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
+
+    CPyObject sys = PyImport_ImportModule("sys");
+    CPyObject blocks = sys ? PyObject_CallMethod(*sys, "getallocatedblocks", nullptr) : nullptr;
+    if (blocks)
+        PyDict_SetItemString(*stats, "allocatedBlocks", *blocks);
 
-        bool isbuffer = false;
-        CHECK(napi_is_buffer(env, arg, &isbuffer));
-        if (isbuffer)
+    // tracemalloc is only reported if it was started by the application
+    CPyObject tracemalloc = PyImport_ImportModule("tracemalloc");
+    CPyObject tracing = tracemalloc ? PyObject_CallMethod(*tracemalloc, "is_tracing", nullptr) : nullptr;
+    if (tracing && PyObject_IsTrue(*tracing) == 1)
+    {
+        CPyObject memory = PyObject_CallMethod(*tracemalloc, "get_traced_memory", nullptr);
+        if (memory && PyTuple_Check(*memory) && PyTuple_Size(*memory) == 2)
         {
-            void* data = nullptr;
-            size_t len = 0;
-            CHECK(napi_get_buffer_info(env, arg, &data, &len));
-            auto* bytes = PyBytes_FromStringAndSize((const char*)data, len);
-            return { bytes, false };
+            CPyObject traced = Py_BuildValue("{s:O,s:O}", "current", PyTuple_GetItem(*memory, 0), "peak", PyTuple_GetItem(*memory, 1));
+            if (traced)
+                PyDict_SetItemString(*stats, "tracemalloc", *traced);
         }
+    }
 
-        bool istypedarray = false;
-        CHECK(napi_is_typedarray(env, arg, &istypedarray));
-        if (istypedarray)
-        {
-            napi_typedarray_type type;
-            void* data = nullptr;
-            size_t len = 0;
-            CHECK(napi_get_typedarray_info(env, arg, &type, &len, &data, nullptr, nullptr));
+    PyErr_Clear();
+    return stats;
+}
 
-            switch (type)
-            {
-            case napi_int16_array:
-            case napi_uint16_array:
-                len *= 2;
-                break;
-            case napi_int32_array:
-            case napi_uint32_array:
-            case napi_float32_array:
-                len *= 4;
-                break;
-            case napi_float64_array:
-            case napi_bigint64_array:
-            case napi_biguint64_array:
-                len *= 8;
-                break;
-            default:
-                break;
-            }
+// called by the finalizers of the handlers, the handlers are released by a dedicated thread or by the next python call
+void PyInterpreter::deferRelease(const std::string& handler)
+{
+    {
+        std::lock_guard<std::mutex> l(m_releaseMutex);
+        m_releaseQueue.push_back(handler);
 
-            auto* bytes = PyBytes_FromStringAndSize((const char*)data, len);
-            return { bytes, false };
+        if (!m_releaseThread.joinable())
+        {
+            m_releaseThread = std::thread([this]() {
+                while (true)
+                {
+                    {
+                        std::unique_lock<std::mutex> l(m_releaseMutex);
+                        m_releaseCondition.wait(l, [this]() { return m_stopRelease || !m_releaseQueue.empty(); });
+                        if (m_stopRelease)
+                            return;
+                    }
+
+                    GIL gil;
+                    releasePending();
+                }
+            });
         }
+    }
 
-        bool isdataview = false;
-        CHECK(napi_is_dataview(env, arg, &isdataview));
-        if (isdataview)
+    m_releaseCondition.notify_one();
+}
+
+// must be called holding the GIL
+void PyInterpreter::releasePending()
+{
+    std::vector<std::string> handlers;
+    {
+        std::lock_guard<std::mutex> l(m_releaseMutex);
+        if (m_releaseQueue.empty())
+            return;
+
+        handlers.swap(m_releaseQueue);
+    }
+
+    for (auto& handler : handlers)
+        release(handler);
+}
+
+CPyObject PyInterpreter::getObject(const std::string& handler)
+{
+    auto obj = m_objs.find(handler);
+
+    if (!obj)
+        throw std::runtime_error("Cannot find handler: " + handler);
+
+    return obj;
+}
+
+CPyObject PyInterpreter::get(const std::string& handler, CPyObject& key)
+{
+    auto obj = getObject(handler);
+    if (!key)
+        return obj;
+
+    PyErr_Clear();
+    CPyObject item = PyObject_GetItem(*obj, *key);
+    if (item)
+        return item;
+
+    // missing keys are mapped to undefined like missing properties of JS objects, other errors are raised
+    // a string key of an object without string items (e.g. a list) is looked up as an attribute
+    auto isString = PyUnicode_Check(*key);
+    if (!PyErr_ExceptionMatches(PyExc_KeyError) && !PyErr_ExceptionMatches(PyExc_IndexError) && !(isString && PyErr_ExceptionMatches(PyExc_TypeError)))
+    {
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
+    PyErr_Clear();
+
+    if (!isString)
+        return item;
+
+    item = PyObject_GetAttr(*obj, *key);
+    if (item)
+        return item;
+
+    if (!PyErr_ExceptionMatches(PyExc_AttributeError))
+    {
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
+    PyErr_Clear();
+
+    if (PyUnicode_CompareWithASCIIString(*key, "length") == 0 && PySequence_Check(*obj))
+    {
+        auto size = PySequence_Size(*obj);
+        if (size >= 0)
+            item = PyLong_FromSsize_t(size);
+        PyErr_Clear();
+    }
+    return item;
+}
+
+namespace
+{
+    // returns the pickle module (borrowed), it is imported once and never released
+    PyObject* getPickle()
+    {
+        static std::atomic<PyObject*> pickle{nullptr};
+        auto module = importOnce(pickle, "pickle");
+        if (!module)
         {
-            void* data = nullptr;
-            size_t len = 0;
-            CHECK(napi_get_dataview_info(env, arg, &len, &data, nullptr, nullptr));
-            auto* bytes = PyBytes_FromStringAndSize((const char*)data, len);
-            return { bytes, false };
+            handleException();
+            throw std::runtime_error("Cannot import pickle");
         }
-        else if (type == napi_undefined || type == napi_null)
+        return module;
+    }
+
+    CPyObject dumps(PyObject* obj)
+    {
+        CPyObject data = PyObject_CallMethod(getPickle(), "dumps", "(O)", obj);
+        if (!data)
         {
-            Py_INCREF(Py_None);
-            return { Py_None, false };
+            handleException();
+            throw std::runtime_error("Unknown python error");
         }
-        else if (type == napi_string)
-        {
-            size_t length = 0;
-            CHECK(napi_get_value_string_utf8(env, arg, NULL, 0, &length));
-            std::string s(length, ' ');
-            CHECK(napi_get_value_string_utf8(env, arg, &s[0], length + 1, &length));
+        return data;
+    }
 
-            return { PyUnicode_FromString(s.c_str()), false };
+    CPyObject loads(const std::string& data)
+    {
+        CPyObject bytes = PyBytes_FromStringAndSize(data.data(), data.size());
+        CPyObject obj = bytes ? PyObject_CallMethod(getPickle(), "loads", "(O)", *bytes) : nullptr;
+        if (!obj)
+        {
+            handleException();
+            throw std::runtime_error("Unknown python error");
         }
-        else if (type == napi_number)
+        return obj;
+    }
+
+#ifndef WIN32
+    // messages between the parent and the forked interpreters are length prefixed pickles
+    bool writeMessage(int fd, const char* data, uint64_t size)
+    {
+        if (::write(fd, &size, sizeof(size)) != sizeof(size))
+            return false;
+
+        while (size > 0)
         {
-            double d = 0.0;
-            CHECK(napi_get_value_double(env, arg, &d));
-            if ((double) ((int) d) == d)
-                return { handleInteger(env, arg), false };
-            else
-                return { PyFloat_FromDouble(d), false };
+            auto written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            data += written;
+            size -= written;
         }
-        else if (type == napi_boolean)
+        return true;
+    }
+
+    bool readMessage(int fd, std::string& data)
+    {
+        uint64_t size = 0;
+        if (::recv(fd, &size, sizeof(size), MSG_WAITALL) != sizeof(size))
+            return false;
+
+        data.resize(size);
+        size_t pos = 0;
+        while (pos < size)
         {
-            bool b = false;
-            CHECK(napi_get_value_bool(env, arg, &b));
-            return { b ? PyBool_FromLong(1) : PyBool_FromLong(0), false };
+            auto received = ::read(fd, &data[pos], size - pos);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return false;
+            pos += received;
         }
-        else if (type == napi_object)
+        return true;
+    }
+#endif
+}
+
+int PyInterpreter::fork()
+{
+#ifdef WIN32
+    throw std::runtime_error("Forking the interpreter is not supported on Windows");
+#else
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        throw std::runtime_error("Cannot create socket pair");
+
+    // do not leak the sockets into processes spawned by node or python
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    // the release thread does not exist in the child, its mutex must not be inherited locked
+    std::unique_lock<std::mutex> releaseLock(m_releaseMutex);
+    std::unique_lock<std::mutex> forkLock(m_forkMutex);
+
+    PyOS_BeforeFork();
+    auto pid = ::fork();
+    if (pid == 0)
+    {
+        PyOS_AfterFork_Child();
+        releaseLock.unlock();
+
+        ::close(fds[0]);
+        for (auto& fork : m_forks)
         {
-            napi_value properties;
-            CHECK(napi_get_property_names(env, arg, &properties));
+            ::close(fork.second->fd);
+            fork.second->fd = -1;
+        }
+        m_forks.clear();
+        forkLock.unlock();
 
-            uint32_t length = 0;
-            CHECK(napi_get_array_length(env, properties, &length));
+        // the thread running the event loop does not exist in the child, a new one is started on demand
+        m_loop.store(nullptr);
+
+        serveForked(fds[1]);
+    }
 
-            auto kwargs = false;
+    PyOS_AfterFork_Parent();
+    releaseLock.unlock();
+    ::close(fds[1]);
 
-            auto* dict = PyDict_New();
-            for (auto i = 0u; i < length; ++i)
+    if (pid < 0)
+    {
+        ::close(fds[0]);
+        throw std::runtime_error("Cannot fork the interpreter");
+    }
+
+    m_forks[pid] = std::make_shared<ForkedInterpreter>(pid, fds[0]);
+    return pid;
+#endif
+}
+
+void PyInterpreter::serveForked(int fd)
+{
+#ifndef WIN32
+    while (true)
+    {
+        std::string request;
+        bool received;
+        Py_BEGIN_ALLOW_THREADS
+        received = readMessage(fd, request);
+        Py_END_ALLOW_THREADS
+
+        if (!received)
+            break;
+
+        CPyObject data;
+        try
+        {
+            CPyObject reply;
+            try
             {
-                napi_value key;
-                CHECK(napi_get_element(env, properties, i, &key));
-                
-                napi_value value;
-                CHECK(napi_get_property(env, arg, key, &value));
-
-                napi_valuetype keyType;
-                CHECK(napi_typeof(env, key, &keyType));
-                auto thisKwargs = false;
-                if (keyType == napi_string)
+                auto message = loads(request);
+
+                PyObject *isFunc, *handler, *func, *args, *kwargs, *released;
+                if (!PyArg_ParseTuple(*message, "OUUOOO!", &isFunc, &handler, &func, &args, &kwargs, &PyList_Type, &released))
                 {
-                    napi_valuetype valueType;
-                    CHECK(napi_typeof(env, value, &valueType));
-                    if (valueType == napi_boolean)
-                    {
-                        size_t length = 0;
-                        CHECK(napi_get_value_string_utf8(env, key, NULL, 0, &length));
-                        std::string s(length, ' ');
-                        CHECK(napi_get_value_string_utf8(env, key, &s[0], length + 1, &length));
-                        if (s == "__kwargs")
-                        {
-                            CHECK(napi_get_value_bool(env, value, &thisKwargs));
-                        }
-                    }
+                    handleException();
+                    throw std::runtime_error("Invalid request");
                 }
 
-                if (thisKwargs)
-                    kwargs = true;
-                else
+                // the objects whose JS handlers were released since the last request
+                for (Py_ssize_t i = 0; i < PyList_GET_SIZE(released); ++i)
                 {
-                    CPyObject pykey = ::convert(env, key, isSync, allowFunc, syncJsAndPy).first;
+                    auto utf8 = PyUnicode_AsUTF8(PyList_GET_ITEM(released, i));
+                    if (utf8)
+                        release(utf8);
+                    PyErr_Clear();
+                }
 
-                    CPyObject pyvalue = ::convert(env, value, isSync, allowFunc, syncJsAndPy).first;
+                CPyObject pyArgs = args;
+                Py_INCREF(args);
+                CPyObject pyKwargs = kwargs == Py_None ? nullptr : kwargs;
+                Py_XINCREF(*pyKwargs);
 
-                    PyDict_SetItem(dict, *pykey, *pyvalue);
+                CPyObject result;
+                if (PyObject_IsTrue(isFunc))
+                {
+                    result = call(PyUnicode_AsUTF8(handler), PyUnicode_AsUTF8(func), pyArgs, pyKwargs);
+                    if (isCoroutine(result))
+                        result = runCoroutineSync(result);
                 }
-            }
+                else
+                    result = PyUnicode_FromString(create(PyUnicode_AsUTF8(handler), PyUnicode_AsUTF8(func), pyArgs, pyKwargs).c_str());
 
-            return { dict, kwargs };
-        }
-        else if (type == napi_function && allowFunc)
-        {
-            if (isSync)
-            {
-                CPyObject capsule = PyCapsule_New(new SycnCallback{env, arg}, nullptr, capsuleDestructorSync);
-                auto function = PyCFunction_New(&mlSync, *capsule);
-                return { function, false };
+                reply = Py_BuildValue("(OO)", Py_True, result ? *result : Py_None);
+                data = dumps(*reply);
             }
-            else
+            catch(const PyError& e)
             {
-                auto tsfn = new napi_threadsafe_function;
-
-                napi_value workName;
-                CHECK(napi_create_string_utf8(env, "ThreadSafeCallback", NAPI_AUTO_LENGTH, &workName));
-
-                CPyObject capsule = PyCapsule_New(tsfn, nullptr, capsuleDestructor);
-                PyObject* function = nullptr;
-                if (syncJsAndPy)
+                // the exception is pickled on its own, the parent still gets the error if it cannot be pickled or unpickled
+                CPyObject exception;
+                try
                 {
-                    CHECK(napi_create_threadsafe_function(env, arg, nullptr, workName, 0, 1, nullptr, nullptr, nullptr, callJsPromise, tsfn));
-                    function = PyCFunction_New(&mlAsyncPromise, *capsule);
+                    exception = dumps(e.exception().get());
                 }
-                else
+                catch(const std::exception&)
                 {
-                    CHECK(napi_create_threadsafe_function(env, arg, nullptr, workName, 0, 1, nullptr, nullptr, nullptr, callJs, tsfn));
-                    function = PyCFunction_New(&mlAsync, *capsule);
                 }
 
-                return { function, false };
+                auto traceback = formatTraceback(e.exception().get());
+                CPyObject type = PyBytes_FromStringAndSize(e.type().data(), e.type().size());
+                CPyObject text = PyBytes_FromStringAndSize(e.message().data(), e.message().size());
+                CPyObject lines = PyBytes_FromStringAndSize(traceback.data(), traceback.size());
+                reply = Py_BuildValue("(OOOOO)", Py_False, *type, *text, *lines, exception ? *exception : Py_None);
+                data = dumps(*reply);
+            }
+            catch(const std::exception& e)
+            {
+                reply = Py_BuildValue("(Oy)", Py_False, e.what());
+                data = dumps(*reply);
+            }
+        }
+        catch(const std::exception&)
+        {
+            break;
+        }
+
+        char* buffer;
+        Py_ssize_t size;
+        PyBytes_AsStringAndSize(*data, &buffer, &size);
+
+        bool sent;
+        Py_BEGIN_ALLOW_THREADS
+        sent = writeMessage(fd, buffer, size);
+        Py_END_ALLOW_THREADS
+
+        if (!sent)
+            break;
+    }
+
+    // the forked child must never return into node, flush python's buffers and leave without running any destructors
+    CPyObject flushed = PyRun_String("import sys\nsys.stdout.flush()\nsys.stderr.flush()", Py_file_input, PyEval_GetBuiltins(), nullptr);
+    ::_exit(0);
+#else
+    throw std::runtime_error("Forking the interpreter is not supported on Windows");
+#endif
+}
+
+std::shared_ptr<ForkedInterpreter> PyInterpreter::findFork(int pid)
+{
+    std::lock_guard<std::mutex> l(m_forkMutex);
+    auto it = m_forks.find(pid);
+    if (it == m_forks.end())
+        throw std::runtime_error("Cannot find forked interpreter: " + std::to_string(pid));
+
+    return it->second;
+}
+
+CPyObject PyInterpreter::forkCall(int pid, bool isFunc, const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs)
+{
+    return forkCall(findFork(pid), isFunc, handler, func, args, kwargs);
+}
+
+CPyObject PyInterpreter::forkCall(const std::shared_ptr<ForkedInterpreter>& fork, bool isFunc, const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs)
+{
+#ifdef WIN32
+    throw std::runtime_error("Forking the interpreter is not supported on Windows");
+#else
+    std::vector<std::string> releases;
+    {
+        std::lock_guard<std::mutex> l(fork->releaseMutex);
+        releases.swap(fork->releaseQueue);
+    }
+
+    CPyObject released = PyList_New(0);
+    for (auto& releasedHandler : releases)
+    {
+        CPyObject item = PyUnicode_FromString(releasedHandler.c_str());
+        if (!item || PyList_Append(*released, *item) != 0)
+        {
+            handleException();
+            throw std::runtime_error("Unknown python error");
+        }
+    }
+
+    CPyObject request = Py_BuildValue("(OssOOO)", isFunc ? Py_True : Py_False, handler.c_str(), func.c_str(), *args, kwargs ? *kwargs : Py_None, *released);
+    auto data = dumps(*request);
+
+    char* buffer;
+    Py_ssize_t size;
+    PyBytes_AsStringAndSize(*data, &buffer, &size);
+
+    std::string reply;
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    {
+        std::lock_guard<std::mutex> l(fork->mutex);
+        ok = fork->fd >= 0 && writeMessage(fork->fd, buffer, size) && readMessage(fork->fd, reply);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!ok)
+        throw std::runtime_error("Forked interpreter is not available: " + std::to_string(fork->pid));
+
+    auto message = loads(reply);
+    auto success = PyObject_IsTrue(PyTuple_GetItem(*message, 0));
+    auto value = PyTuple_GetItem(*message, 1);
+    if (!success)
+    {
+        if (PyTuple_GET_SIZE(*message) == 2)
+            throw std::runtime_error(PyBytes_AsString(value));
+
+        // python exceptions of the child are rethrown as PyError, like the ones of this interpreter
+        std::string type = PyBytes_AsString(value);
+        std::string text = PyBytes_AsString(PyTuple_GetItem(*message, 2));
+        std::string traceback = PyBytes_AsString(PyTuple_GetItem(*message, 3));
+
+        PyObject* exception = nullptr;
+        auto pickled = PyTuple_GetItem(*message, 4);
+        if (pickled != Py_None)
+        {
+            CPyObject loaded = PyObject_CallMethod(getPickle(), "loads", "(O)", pickled);
+            if (loaded && PyExceptionInstance_Check(*loaded))
+            {
+                exception = *loaded;
+                Py_INCREF(exception);
             }
+            PyErr_Clear();
         }
-        else
-            return { handleInteger(env, arg), false };
+        if (!exception)
+        {
+            CPyObject args = PyUnicode_FromStringAndSize(text.data(), text.size());
+            exception = args ? PyObject_CallFunctionObjArgs(PyExc_RuntimeError, *args, nullptr) : nullptr;
+        }
+        if (!exception)
+        {
+            PyErr_Clear();
+            throw std::runtime_error(type + ": " + text);
+        }
+
+        throw PyError(exception, type, text, traceback);
+    }
 
-        throw std::runtime_error("Invalid parameter: unknown type");
-    }}
+    Py_INCREF(value);
+    return CPyObject(value);
+#endif
+}
 
-std::pair<CPyObject, CPyObject> PyInterpreter::convert(napi_env env, const std::vector<napi_value>& args, bool isSync)
+void PyInterpreter::releaseFork(int pid)
 {
-    std::vector<PyObject*> paramsVect;
-    CPyObject kwargs;
-    paramsVect.reserve(args.size());
-    for (auto i=0u;i<args.size();++i)
+    // calls already queued keep the fork alive, the last one closes its socket
+    std::lock_guard<std::mutex> l(m_forkMutex);
+    m_forks.erase(pid);
+}
+
+ForkedInterpreter::~ForkedInterpreter()
+{
+#ifndef WIN32
+    if (fd < 0)
+        return;
+
+    // the child exits once its socket is closed, it is reaped off the JS thread
+    ::close(fd);
+    std::thread([pid = pid]() { ::waitpid(pid, nullptr, 0); }).detach();
+#endif
+}
+
+namespace
+{
+    const char* MODULE_INDEX_SOURCE = R"py(
+import importlib.machinery
+import importlib.util
+import os
+
+class ModuleIndex:
+    """Finds the top level modules of the indexed directories without touching the file system, every directory is listed once"""
+
+    def __init__(self):
+        self._directories = []
+        self._listings = {}
+        self._index = {}
+
+    @staticmethod
+    def _list(directory):
+        # the same precedence as the FileFinder of python: packages, extension modules, source files
+        sources, extensions, packages = {}, {}, {}
+        try:
+            entries = list(os.scandir(directory))
+        except OSError:
+            return {}
+
+        for entry in entries:
+            name = entry.name
+            if entry.is_dir():
+                init = os.path.join(entry.path, "__init__.py")
+                if name.isidentifier() and os.path.isfile(init):
+                    packages[name] = (init, entry.path)
+                continue
+
+            for suffixes, modules in ((importlib.machinery.SOURCE_SUFFIXES, sources), (importlib.machinery.EXTENSION_SUFFIXES, extensions)):
+                for suffix in suffixes:
+                    if name.endswith(suffix) and name[:-len(suffix)].isidentifier():
+                        modules.setdefault(name[:-len(suffix)], (entry.path, None))
+
+        listing = sources
+        listing.update(extensions)
+        listing.update(packages)
+        return listing
+
+    def _rebuild(self):
+        index = {}
+        for directory in reversed(self._directories):
+            index.update(self._listings[directory])
+        self._index = index
+
+    def add(self, directory):
+        # the directory takes precedence over the directories added before, like at the front of sys.path
+        if self._directories and self._directories[0] == directory:
+            return
+
+        if directory in self._directories:
+            self._directories.remove(directory)
+        self._directories.insert(0, directory)
+
+        if directory not in self._listings:
+            self._listings[directory] = self._list(directory)
+        self._index.update(self._listings[directory])
+
+    def invalidate_caches(self):
+        for directory in self._directories:
+            self._listings[directory] = self._list(directory)
+        self._rebuild()
+
+    def find_spec(self, fullname, path=None, target=None):
+        # submodules are found by the default finders using the __path__ of their package
+        if path is not None:
+            return None
+
+        found = self._index.get(fullname)
+        if found is None:
+            return None
+
+        origin, package = found
+        return importlib.util.spec_from_file_location(fullname, origin, submodule_search_locations=[package] if package else None)
+)py";
+
+    CPyObject createModuleIndex()
     {
-        auto cparams = ::convert(env, args[i], isSync, true, m_syncJsAndPy);
-        if (!cparams.first)
-            throw std::runtime_error("Cannot convert #" + std::to_string(i + 1) + " argument");
+        CPyObject globals = PyDict_New();
+        PyDict_SetItemString(*globals, "__builtins__", PyEval_GetBuiltins());
 
-        if (cparams.second)
-            kwargs = cparams.first;
-        else
-            paramsVect.push_back(cparams.first);
-    }
+        CPyObject result = PyRun_String(MODULE_INDEX_SOURCE, Py_file_input, *globals, *globals);
+        if (!result)
+        {
+            handleException();
+            throw std::runtime_error("Cannot create the module index");
+        }
 
-    CPyObject params = PyTuple_New(paramsVect.size());
+        CPyObject index = PyObject_CallFunctionObjArgs(PyDict_GetItemString(*globals, "ModuleIndex"), nullptr);
+        if (!index)
+        {
+            handleException();
+            throw std::runtime_error("Cannot create the module index");
+        }
+        return index;
+    }
 
-    for (auto i=0u;i<paramsVect.size();++i)
-        PyTuple_SetItem(*params, i, paramsVect[i]);
+    // the position of the PathFinder in sys.meta_path, or of before, if it comes first
+    Py_ssize_t findPathFinder(PyObject* metaPath, PyObject* before)
+    {
+        CPyObject machinery = PyImport_ImportModule("importlib.machinery");
+        CPyObject pathFinder = machinery ? PyObject_GetAttrString(*machinery, "PathFinder") : nullptr;
+        if (!pathFinder)
+            handleException();
 
-    return { params, kwargs };
+        auto size = PyList_Size(metaPath);
+        for (auto i = 0; i < size; ++i)
+        {
+            auto item = PyList_GetItem(metaPath, i);
+            if (item == *pathFinder || (before && item == before))
+                return i;
+        }
+        return size;
+    }
 }
 
-napi_value PyInterpreter::convert(napi_env env, PyObject* obj)
+void PyInterpreter::addImportPath(const std::string& path)
 {
-    return ::convert(env, obj);
+    auto sysPath = PySys_GetObject("path");
+    CPyObject dirName = PyUnicode_FromString(path.c_str());
+
+    // a directory used again is moved to the front instead of being inserted again, so sys.path does not grow with every import
+    auto size = PyList_Size(sysPath);
+    auto first = size > 0 ? PyList_GetItem(sysPath, 0) : nullptr;
+    if (!first || !PyUnicode_Check(first) || PyUnicode_Compare(first, *dirName) != 0)
+    {
+        for (auto i = size - 1; i > 0; --i)
+        {
+            auto item = PyList_GetItem(sysPath, i);
+            if (PyUnicode_Check(item) && PyUnicode_Compare(item, *dirName) == 0)
+                PySequence_DelItem(sysPath, i);
+        }
+        PyList_Insert(sysPath, 0, *dirName);
+    }
+
+    CPyObject moduleIndex;
+    {
+        std::lock_guard<std::mutex> l(m_importMutex);
+        moduleIndex = m_moduleIndex;
+    }
+
+    if (moduleIndex)
+    {
+        CPyObject result = PyObject_CallMethod(*moduleIndex, "add", "O", *dirName);
+        if (!result)
+            handleException();
+    }
 }
 
-namespace
+void PyInterpreter::setModuleIndex(bool enabled)
 {
-    static const char MODULE = '@';
-    static const char INSTANCE = '#';
+    GIL gil;
 
-    std::string getUUID(bool module, CPyObject& obj)
+    CPyObject moduleIndex;
     {
-        std::stringstream ss;
-        ss << (module ? MODULE : INSTANCE);
-        ss << "nodecallspython-";
-        ss << rand() << "-";
-        ss << *obj;
-        return ss.str();
+        std::lock_guard<std::mutex> l(m_importMutex);
+        moduleIndex = m_moduleIndex;
     }
 
-    void handleException()
-    {
-        if (PyErr_Occurred())
-        {
-            PyObject *type, *value, *traceback;
-            PyErr_Fetch(&type, &value, &traceback);
+    if (enabled == static_cast<bool>(moduleIndex))
+        return;
 
-            CPyObject error = PyObject_Str(value);
+    auto metaPath = PySys_GetObject("meta_path");
+    if (!metaPath)
+        throw std::runtime_error("Cannot find sys.meta_path");
 
-            std::runtime_error err("Unknown python error");
-            if (error)
-            {
-                Py_ssize_t size;
-                std::string str = "";
-                if (traceback == nullptr)
-                    str = PyUnicode_AsUTF8AndSize(*error, &size);
-                else
-                {
-                    PyErr_NormalizeException(&type, &value, &traceback);
-                    PyObject *pTraceModule = PyImport_ImportModule("traceback");
-                    if (pTraceModule != nullptr)
-                    {
-                        PyObject *pModuleDict = PyModule_GetDict(pTraceModule);
-                        if (pModuleDict != nullptr)
-                        {
-                            PyObject *pFunc = PyDict_GetItemString(pModuleDict, "format_exception");
-                            if (pFunc != nullptr)
-                            {
-                                CPyObject pyErrList = 
-                                    PyObject_CallFunctionObjArgs(pFunc, type, value, traceback, nullptr, nullptr);
-                                if (pyErrList) {
-                                    int listSize = PyList_Size(*pyErrList);
-                                    for (int i = 0; i < listSize; ++i) {
-                                        auto item = PyList_GetItem(*pyErrList, i);
-                                        str += PyUnicode_AsUTF8(item);
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+    if (enabled)
+    {
+        moduleIndex = createModuleIndex();
 
-                err = std::runtime_error(!str.empty() ? str : "Unknown python error");
-            }
+        // the builtin and frozen modules are still found first, the index replaces the scan of sys.path
+        if (PyList_Insert(metaPath, findPathFinder(metaPath, nullptr), *moduleIndex) != 0)
+            handleException();
+    }
+    else
+    {
+        CPyObject result = PyObject_CallMethod(metaPath, "remove", "O", *moduleIndex);
+        if (!result)
+            PyErr_Clear();
+        moduleIndex = CPyObject();
+    }
+
+    // the previous index is released after unlocking
+    CPyObject previous;
+    std::lock_guard<std::mutex> l(m_importMutex);
+    previous = m_moduleIndex;
+    m_moduleIndex = moduleIndex;
+}
 
-            PyErr_Restore(type, value, traceback);
+namespace
+{
+    const char* BUNDLE_SOURCE = R"py(
+import importlib.machinery
+import importlib.util
+import marshal
+import mmap
+import os
+import struct
+
+# magic, the bytecode magic number of the python which compiled the bundle, size of the index
+HEADER = struct.Struct("<4s4sQ")
+MAGIC = b"NCPB"
+
+def build(directory, output, namespaces=False):
+    """Compiles the modules of directory into a bundle, the subdirectories with an __init__.py are packages, returns the number of modules
+    with namespaces every subdirectory is a package, the ones without __init__.py are empty"""
+    directory = os.path.abspath(directory)
+    modules = {}
+    for root, dirs, files in os.walk(directory):
+        dirs[:] = sorted(d for d in dirs if d.isidentifier() and d != "__pycache__" and (namespaces or os.path.isfile(os.path.join(root, d, "__init__.py"))))
+        relative = os.path.relpath(root, directory)
+        parts = [] if relative == os.curdir else relative.split(os.sep)
+        if parts:
+            modules[".".join(parts)] = (os.path.join(root, "__init__.py"), True)
+
+        for name in sorted(files):
+            module, suffix = os.path.splitext(name)
+            if suffix not in importlib.machinery.SOURCE_SUFFIXES or not module.isidentifier():
+                continue
+            if module != "__init__":
+                modules[".".join(parts + [module])] = (os.path.join(root, name), False)
+
+    index, blobs, offset = {}, [], 0
+    for name, (origin, package) in sorted(modules.items()):
+        source, stamp = b"", None
+        if os.path.isfile(origin):
+            with open(origin, "rb") as f:
+                stat = os.fstat(f.fileno())
+                source, stamp = f.read(), (stat.st_mtime_ns, stat.st_size)
+
+        blob = marshal.dumps(compile(source, origin, "exec", dont_inherit=True))
+        index[name] = (offset, len(blob), package, origin, stamp)
+        blobs.append(blob)
+        offset += len(blob)
+
+    # the bundle is replaced at once, a process reading the previous one keeps its mapping
+    header = marshal.dumps(index)
+    temp = output + ".tmp"
+    with open(temp, "wb") as f:
+        f.write(HEADER.pack(MAGIC, importlib.util.MAGIC_NUMBER, len(header)))
+        f.write(header)
+        for blob in blobs:
+            f.write(blob)
+    os.replace(temp, output)
+    return len(index)
+
+class BundleImporter:
+    """Imports the modules of a bundle from its memory mapped bytecode, without touching the file system"""
+
+    def __init__(self, path):
+        self.path = os.path.abspath(path)
+        with open(self.path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        if len(self._map) < HEADER.size:
+            raise ImportError("%s is not a bundle" % self.path)
+
+        magic, version, size = HEADER.unpack_from(self._map)
+        if magic != MAGIC:
+            raise ImportError("%s is not a bundle" % self.path)
+        if version != importlib.util.MAGIC_NUMBER:
+            raise ImportError("%s was compiled by another python version" % self.path)
+
+        self._start = HEADER.size + size
+        self._index = marshal.loads(self._map[HEADER.size:self._start])
+
+    def find_spec(self, fullname, path=None, target=None):
+        found = self._index.get(fullname)
+        if found is None:
+            return None
+
+        # a module is reloaded (e.g. by reimport) with its target, its source is used instead once it changed
+        if target is not None and self._changed(found):
+            return None
+
+        origin, package = found[3], found[2]
+        spec = importlib.machinery.ModuleSpec(fullname, self, origin=origin, is_package=package)
+        spec.has_location = True
+        if package:
+            # the modules which are not in the bundle are still found next to the package
+            spec.submodule_search_locations.append(os.path.dirname(origin))
+        return spec
+
+    def _changed(self, found):
+        stamp = found[4] if len(found) > 4 else None
+        if stamp is None:
+            return False
+        try:
+            stat = os.stat(found[3])
+        except OSError:
+            return False
+        return (stat.st_mtime_ns, stat.st_size) != tuple(stamp)
+
+    def create_module(self, spec):
+        return None
+
+    def get_code(self, fullname):
+        offset, size = self._index[fullname][:2]
+        start = self._start + offset
+        with memoryview(self._map) as view:
+            return marshal.loads(view[start:start + size])
+
+    def exec_module(self, module):
+        exec(self.get_code(module.__spec__.name), module.__dict__)
+)py";
+
+    CPyObject runBundleSource()
+    {
+        CPyObject globals = PyDict_New();
+        PyDict_SetItemString(*globals, "__builtins__", PyEval_GetBuiltins());
 
-            throw err;
+        CPyObject result = PyRun_String(BUNDLE_SOURCE, Py_file_input, *globals, *globals);
+        if (!result)
+        {
+            handleException();
+            throw std::runtime_error("Cannot load the bundle support");
         }
+        return globals;
     }
 }
 
-std::string PyInterpreter::import(const std::string& modulename, bool allowReimport)
+int PyInterpreter::buildBundle(const std::string& directory, const std::string& output, bool namespacePackages)
 {
-    auto name = modulename;
-    auto pos = name.find_last_of("\\");
-    if (pos == std::string::npos)
-        pos =  name.find_last_of("/");
+    GIL gil;
 
-    if (pos != std::string::npos)
+    auto globals = runBundleSource();
+    CPyObject result = PyObject_CallFunction(PyDict_GetItemString(*globals, "build"), "ssO", directory.c_str(), output.c_str(), namespacePackages ? Py_True : Py_False);
+    if (!result)
     {
-        auto dir = name.substr(0, pos);
-        name = name.substr(pos + 1);
-
-        addImportPath(dir);
+        handleException();
+        throw std::runtime_error("Cannot build the bundle");
     }
+    return static_cast<int>(PyLong_AsLong(*result));
+}
 
-    auto len = name.length();
-    if (len > 2 && name[len - 3] == '.' && name[len - 2] == 'p' && name[len - 1] == 'y')
-        name = name.substr(0, len - 3);
-    
-    PyErr_Clear();
-    CPyObject pyModule = PyImport_ImportModule(name.c_str());
-    if (!pyModule)
+void PyInterpreter::addBundle(const std::string& path)
+{
+    GIL gil;
+
+    auto metaPath = PySys_GetObject("meta_path");
+    if (!metaPath)
+        throw std::runtime_error("Cannot find sys.meta_path");
+
+    auto globals = runBundleSource();
+    CPyObject importer = PyObject_CallFunction(PyDict_GetItemString(*globals, "BundleImporter"), "s", path.c_str());
+    if (!importer)
     {
         handleException();
-        return {};
+        throw std::runtime_error("Cannot load the bundle");
     }
 
-    auto it = m_imports.find(*pyModule);
-    if (it != m_imports.end() && allowReimport)
+    CPyObject moduleIndex;
     {
-        pyModule = PyImport_ReloadModule(*pyModule);
-        if (!pyModule)
+        std::lock_guard<std::mutex> l(m_importMutex);
+        moduleIndex = m_moduleIndex;
+    }
+
+    // the bundles take precedence over the module index and sys.path, a bundle added later over the earlier ones
+    auto size = PyList_Size(metaPath);
+    auto pos = findPathFinder(metaPath, *moduleIndex);
+    for (auto i = 0; i < size; ++i)
+    {
+        CPyObject name = PyObject_GetAttrString(reinterpret_cast<PyObject*>(Py_TYPE(PyList_GetItem(metaPath, i))), "__name__");
+        if (name && PyUnicode_Check(*name) && PyUnicode_CompareWithASCIIString(*name, "BundleImporter") == 0)
         {
-            handleException();
-            return {};
+            pos = i;
+            break;
         }
+        PyErr_Clear();
     }
 
-    auto uuid = getUUID(true, pyModule);
-    m_objs[uuid] = pyModule;
-    m_imports[*pyModule] = uuid;
-    return uuid;
+    if (PyList_Insert(metaPath, pos, *importer) != 0)
+        handleException();
 }
 
-CPyObject PyInterpreter::call(const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs)
+namespace
 {
-    auto it = m_objs.find(handler);
-
-    if(it == m_objs.end())
-        throw std::runtime_error("Cannot find handler: " + handler);
-
-    PyErr_Clear();
-    CPyObject pyFunc = PyObject_GetAttrString(*(it->second), func.c_str());
-    if (pyFunc && PyCallable_Check(*pyFunc))
+    const char* RELOADER_SOURCE = R"py(
+import ast
+import os
+import re
+import sys
+import sysconfig
+
+def normalize(path):
+    return re.sub(r"[\\/]+", "/", path)
+
+class Reloader:
+    """Plans the reloads of changed modules, with a module to file index and an import graph updated only for new and changed modules"""
+
+    def __init__(self):
+        self._files = {}
+        self._modules = {}
+        self._byFile = {}
+        self._imports = {}
+        self._dependents = None
+        paths = sysconfig.get_paths()
+        # the modules of python and of the installed packages are not reloaded as dependents
+        self._installed = tuple(set(normalize(paths[key]) + "/" for key in ("stdlib", "platstdlib", "purelib", "platlib") if key in paths))
+
+    def _index(self):
+        for name in [name for name in self._modules if name not in sys.modules]:
+            self._forget(name)
+
+        for name, module in list(sys.modules.items()):
+            if self._modules.get(name) is module:
+                continue
+            self._forget(name)
+            file = getattr(module, "__file__", None)
+            file = normalize(file) if isinstance(file, str) else None
+            self._modules[name] = module
+            self._files[name] = file
+            if file:
+                self._byFile.setdefault(file, []).append(name)
+            self._dependents = None
+
+    def _forget(self, name):
+        file = self._files.pop(name, None)
+        if file and name in self._byFile.get(file, ()):
+            self._byFile[file].remove(name)
+        self._modules.pop(name, None)
+        self._imports.pop(name, None)
+        self._dependents = None
+
+    def _importsOf(self, name, changed=False):
+        file = self._files.get(name)
+        if not file or not file.endswith(".py") or file.startswith(self._installed):
+            return ()
+
+        # only the changed files are parsed again, if they were saved since they were parsed
+        cached = self._imports.get(name)
+        if cached and not changed:
+            return cached[1]
+
+        try:
+            stat = os.stat(file)
+        except OSError:
+            return ()
+
+        stamp = (stat.st_mtime_ns, stat.st_size)
+        if cached and cached[0] == stamp:
+            return cached[1]
+
+        imports = set()
+        try:
+            with open(file, "rb") as f:
+                tree = ast.parse(f.read(), file)
+        except (OSError, SyntaxError, ValueError):
+            tree = None
+
+        if tree:
+            module = self._modules[name]
+            package = getattr(module, "__package__", None) or ""
+            for node in ast.walk(tree):
+                if isinstance(node, ast.Import):
+                    for alias in node.names:
+                        parts = alias.name.split(".")
+                        imports.update(".".join(parts[:i]) for i in range(1, len(parts) + 1))
+                elif isinstance(node, ast.ImportFrom):
+                    base = package.rsplit(".", node.level - 1)[0] if node.level > 1 else package if node.level else ""
+                    base = ".".join(part for part in (base, node.module) if part)
+                    if base:
+                        imports.add(base)
+                        imports.update(base + "." + alias.name for alias in node.names)
+
+        imports.discard(name)
+        imports = frozenset(imports)
+        if not cached or cached[1] != imports:
+            self._dependents = None
+        self._imports[name] = (stamp, imports)
+        return imports
+
+    def _getDependents(self):
+        if self._dependents is None:
+            dependents = {}
+            for name in self._files:
+                for imported in self._importsOf(name):
+                    dependents.setdefault(imported, []).append(name)
+            self._dependents = dependents
+        return self._dependents
+
+    def plan(self, paths):
+        """Returns the modules to reload, the ones with a file name containing one of paths and their dependents, dependencies first"""
+        self._index()
+        changed = set()
+        for path in map(normalize, paths):
+            found = self._byFile.get(path)
+            if found:
+                changed.update(found)
+            else:
+                changed.update(name for name, file in self._files.items() if file and path in file)
+        if not changed:
+            return []
+
+        for name in changed:
+            self._importsOf(name, True)
+        dependents = self._getDependents()
+
+        reload = set(changed)
+        stack = list(changed)
+        while stack:
+            for dependent in dependents.get(stack.pop(), ()):
+                if dependent not in reload:
+                    reload.add(dependent)
+                    stack.append(dependent)
+
+        # in import order, a module after the ones it imports, the modules of an import cycle in import order
+        order = [name for name in sys.modules if name in reload]
+        position = {name: i for i, name in enumerate(order)}
+        pending = {name: sum(1 for imported in self._importsOf(name) if imported in reload) for name in order}
+        ready = [name for name in order if not pending[name]]
+        result, done = [], set()
+        while len(result) < len(order):
+            if not ready:
+                ready = [min((name for name in order if name not in done), key=position.get)]
+            ready.sort(key=position.get, reverse=True)
+            name = ready.pop()
+            if name in done:
+                continue
+            done.add(name)
+            result.append(self._modules[name])
+            for dependent in dependents.get(name, ()):
+                if dependent in pending and dependent not in done:
+                    pending[dependent] -= 1
+                    if pending[dependent] == 0:
+                        ready.append(dependent)
+        return result
+)py";
+
+    CPyObject createReloader()
     {
-        CPyObject pyResult = PyObject_Call(*pyFunc, *args, *kwargs);
-        if (!*pyResult)
+        CPyObject globals = PyDict_New();
+        PyDict_SetItemString(*globals, "__builtins__", PyEval_GetBuiltins());
+
+        CPyObject result = PyRun_String(RELOADER_SOURCE, Py_file_input, *globals, *globals);
+        if (!result)
         {
             handleException();
-            throw std::runtime_error("Unknown python error");
+            throw std::runtime_error("Cannot create the reloader");
         }
 
-        return pyResult;
+        CPyObject reloader = PyObject_CallFunctionObjArgs(PyDict_GetItemString(*globals, "Reloader"), nullptr);
+        if (!reloader)
+        {
+            handleException();
+            throw std::runtime_error("Cannot create the reloader");
+        }
+        return reloader;
     }
-    else
-        handleException();
-    
-    throw std::runtime_error("Unknown python error");
 }
 
-CPyObject PyInterpreter::exec(const std::string& handler, const std::string& code, bool eval)
+std::vector<std::string> PyInterpreter::reimport(const std::vector<std::string>& paths)
 {
-    auto globals = CPyObject{PyDict_New()};
+    PyErr_Clear();
 
-    PyObject* localsPtr;
-    if (handler.empty())
-        localsPtr = *globals;
-    else
+    // new and removed files are picked up by the module index as well
+    CPyObject moduleIndex;
+    CPyObject reloader;
     {
-        auto it = m_objs.find(handler);
+        std::lock_guard<std::mutex> l(m_importMutex);
+        moduleIndex = m_moduleIndex;
+        reloader = m_reloader;
+    }
 
-        if(it == m_objs.end())
-            throw std::runtime_error("Cannot find handler: " + handler);
+    if (moduleIndex)
+    {
+        CPyObject result = PyObject_CallMethod(*moduleIndex, "invalidate_caches", nullptr);
+        if (!result)
+            handleException();
+    }
+
+    if (!reloader)
+    {
+        reloader = createReloader();
 
-        localsPtr = PyModule_GetDict(*(it->second));
+        std::lock_guard<std::mutex> l(m_importMutex);
+        m_reloader = reloader;
     }
 
-    PyErr_Clear();
-    CPyObject pyResult = PyRun_String(code.c_str(), eval ? Py_eval_input : Py_file_input, *globals, localsPtr);
-    if (!*pyResult)
+    CPyObject pyPaths = PyList_New(0);
+    for (auto& path : paths)
+    {
+        CPyObject pyPath = PyUnicode_FromString(path.c_str());
+        if (!pyPath || PyList_Append(*pyPaths, *pyPath) != 0)
+            handleException();
+    }
+
+    CPyObject plan = PyObject_CallMethod(*reloader, "plan", "O", *pyPaths);
+    if (!plan)
     {
         handleException();
         throw std::runtime_error("Unknown python error");
     }
 
-    return pyResult;
+    std::vector<std::string> reloadedNames;
+    auto size = PyList_Size(*plan);
+    for (auto i = 0; i < size; ++i)
+    {
+        auto pymodule = PyList_GetItem(*plan, i);
+
+        std::string handler;
+        {
+            std::lock_guard<std::mutex> l(m_importMutex);
+            auto it = m_imports.find(pymodule);
+            if (it != m_imports.end())
+                handler = it->second;
+        }
+
+        CPyObject reloaded = PyImport_ReloadModule(pymodule);
+        if (!reloaded)
+            handleException();
+
+        CPyObject name = PyObject_GetAttrString(*reloaded, "__name__");
+        if (name && PyUnicode_Check(*name))
+            reloadedNames.push_back(PyUnicode_AsUTF8(*name));
+        PyErr_Clear();
+
+        if (!handler.empty())
+        {
+            {
+                std::lock_guard<std::mutex> l(m_importMutex);
+                m_imports[*reloaded] = handler;
+            }
+            m_objs.set(handler, reloaded);
+        }
+    }
+
+    return reloadedNames;
 }
 
-std::string PyInterpreter::create(const std::string& handler, const std::string& name, CPyObject& args, CPyObject& kwargs)
+bool PyInterpreter::isCoroutine(CPyObject& obj)
 {
-    auto obj = call(handler, name, args, kwargs);
+    if (!obj)
+        return false;
 
-    if (obj)
+    if (PyCoro_CheckExact(*obj))
+        return true;
+
+    // every coroutine is awaitable, so plain results are told apart without calling into asyncio
+    auto async = Py_TYPE(*obj)->tp_as_async;
+    if (!async || !async->am_await)
+        return false;
+
+    auto asyncio = getAsyncio();
+    if (!asyncio)
+        return false;
+
+    CPyObject result = PyObject_CallMethod(asyncio, "iscoroutine", "O", *obj);
+    if (!result)
     {
-        auto uuid = getUUID(false, obj);
-        m_objs[uuid] = obj;
-        return uuid;
+        PyErr_Clear();
+        return false;
     }
 
-    return std::string();
+    return PyObject_IsTrue(*result) == 1;
 }
 
-void PyInterpreter::release(const std::string& handler)
+bool PyInterpreter::isCoroutineFunction(const std::string& handler, const std::string& func)
 {
-    if (m_objs.count(handler))
+    auto obj = m_objs.find(handler);
+    if (!obj)
+        return false;
+
+    CPyObject function = PyObject_GetAttrString(*obj, func.c_str());
+    CPyObject inspect = function ? PyImport_ImportModule("inspect") : nullptr;
+    CPyObject result = inspect ? PyObject_CallMethod(*inspect, "iscoroutinefunction", "O", *function) : nullptr;
+    if (!result)
     {
-        m_imports.erase(*m_objs[handler]);
-        m_objs.erase(handler);
+        PyErr_Clear();
+        return false;
     }
-}
 
-void PyInterpreter::addImportPath(const std::string& path)
-{
-    auto sysPath = PySys_GetObject("path");
-    CPyObject dirName = PyUnicode_FromString(path.c_str());
-    PyList_Insert(sysPath, 0, *dirName);
+    return PyObject_IsTrue(*result) == 1;
 }
 
 namespace
 {
-    std::string normalize(const std::string& s)
+    // coroutines are scheduled on a persistent event loop running on its own python thread
+    PyObject* startEventLoop()
     {
-        std::string result;
-        char lastCh = 'A';
-        for (auto& ch : s)
+        auto asyncio = getAsyncio();
+        if (!asyncio)
+            throw std::runtime_error("Cannot import asyncio");
+
+        CPyObject loop = PyObject_CallMethod(asyncio, "new_event_loop", nullptr);
+        if (!loop)
         {
-            if (ch == '\\' || ch == '/')
-            {
-                if (lastCh != '\\' && lastCh != '/')
-                    result.push_back('/');
-            }
-            else
-                result.push_back(ch);
+            handleException();
+            throw std::runtime_error("Unknown python error");
+        }
 
-            lastCh = ch;
+        CPyObject threading = PyImport_ImportModule("threading");
+        CPyObject threadClass = threading ? PyObject_GetAttrString(*threading, "Thread") : nullptr;
+        CPyObject runForever = PyObject_GetAttrString(*loop, "run_forever");
+        CPyObject kwargs = Py_BuildValue("{s:O,s:s,s:O}", "target", *runForever, "name", "nodecallspython-asyncio", "daemon", Py_True);
+        CPyObject args = PyTuple_New(0);
+        CPyObject thread = threadClass ? PyObject_Call(*threadClass, *args, *kwargs) : nullptr;
+        CPyObject started = thread ? PyObject_CallMethod(*thread, "start", nullptr) : nullptr;
+        if (!started)
+        {
+            handleException();
+            throw std::runtime_error("Unknown python error");
         }
 
-        return result;
+        Py_INCREF(*loop);
+        return *loop;
+    }
+
+    void stopEventLoop(PyObject* loop)
+    {
+        CPyObject stop = PyObject_GetAttrString(loop, "stop");
+        CPyObject stopped = stop ? PyObject_CallMethod(loop, "call_soon_threadsafe", "O", *stop) : nullptr;
+        PyErr_Clear();
     }
 }
 
-void PyInterpreter::reimport(const std::string& input)
+// starting the loop thread releases the GIL, so two threads can start a loop at the same time, the loser stops its own loop
+PyObject* PyInterpreter::getEventLoop()
 {
-    PyErr_Clear();
+    auto loop = m_loop.load();
+    if (loop)
+        return loop;
+
+    auto started = startEventLoop();
+    if (m_loop.compare_exchange_strong(loop, started))
+        return started;
 
-    std::vector<std::pair<PyObject*, std::string> > reloadThese;
-    auto directory = ::normalize(input);
+    stopEventLoop(started);
+    Py_DECREF(started);
+    return loop;
+}
+
+void PyInterpreter::runCoroutine(CPyObject& coroutine, napi_threadsafe_function tsfn)
+{
+    auto loop = getEventLoop();
 
-    auto sysModules = PySys_GetObject("modules");
-    if (!sysModules)
+    PyErr_Clear();
+    CPyObject future = PyObject_CallMethod(getAsyncio(), "run_coroutine_threadsafe", "OO", *coroutine, loop);
+    if (!future)
     {
         handleException();
         throw std::runtime_error("Unknown python error");
     }
 
-    PyObject *key, *pymodule;
-    Py_ssize_t pos = 0;
-    while (PyDict_Next(sysModules, &pos, &key, &pymodule))
+    CPyObject capsule = PyCapsule_New(tsfn, nullptr, nullptr);
+    CPyObject done = PyCFunction_New(&mlCoroutineDone, *capsule);
+    CPyObject result = PyObject_CallMethod(*future, "add_done_callback", "O", *done);
+    if (!result)
     {
-        if (PyModule_Check(pymodule))
-        {
-            CPyObject fileName = PyModule_GetFilenameObject(pymodule);
-            if (fileName)
-            {
-                Py_ssize_t size = 0;
-                auto str = PyUnicode_AsUTF8AndSize(*fileName, &size);
-                auto normalized = ::normalize(str);
-                if (normalized.find(directory) != std::string::npos)
-                {
-                    auto it = m_imports.find(pymodule);
-                    if (it != m_imports.end())
-                        reloadThese.push_back({ pymodule, it->second });
-                    else
-                        reloadThese.push_back({ pymodule, std::string() });
-                }
-            }
-        }
+        handleException();
+        throw std::runtime_error("Unknown python error");
     }
-    
+}
+
+CPyObject PyInterpreter::runCoroutineSync(CPyObject& coroutine)
+{
+    auto loop = getEventLoop();
+    CoroutineWait wait;
+
     PyErr_Clear();
-    for (auto& reloadThis : reloadThese)
+    CPyObject future = PyObject_CallMethod(getAsyncio(), "run_coroutine_threadsafe", "OO", *coroutine, loop);
+    if (!future)
     {
-        CPyObject reloaded = PyImport_ReloadModule(reloadThis.first);
-        if (!reloaded)
-        {
-            handleException();
-            return;
-        }
-        if (!reloadThis.second.empty())
-        {
-            m_imports[*reloaded] = reloadThis.second;
-            m_objs[reloadThis.second] = reloaded;
-        }
+        handleException();
+        throw std::runtime_error("Unknown python error");
+    }
+
+    return getCoroutineResult(*future);
+}
+
+CPyObject PyInterpreter::getCoroutineResult(PyObject* future)
+{
+    PyErr_Clear();
+    CPyObject result = PyObject_CallMethod(future, "result", nullptr);
+    if (!result)
+    {
+        handleException();
+        throw std::runtime_error("Unknown python error");
     }
+
+    return result;
 }
 
-void PyInterpreter::setSyncJsAndPyInCallback(bool syncJsAndPy)
+void PyInterpreter::setSyncJsAndPyInCallback(bool syncJsAndPy, bool awaitable)
 {
     m_syncJsAndPy = syncJsAndPy;
+    m_awaitableCallbacks = awaitable;
+}
+
+void PyInterpreter::setCallbackBatching(bool batch, bool asArray)
+{
+    m_batchCallbacks = batch;
+    m_batchCallbacksAsArray = asArray;
 }
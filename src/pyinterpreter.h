@@ -1,14 +1,26 @@
 #pragma once
 #include <node_api.h>
 #include "cpyobject.h"
+#include "handlertable.h"
 #include <vector>
 #include <string>
 #include <mutex>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include <iostream>
+#include <stdexcept>
 
 namespace nodecallspython
 {
+    // tags the JS objects returned for modules, instances and lazy results, so they can be passed back into python without conversion
+    static const napi_type_tag HANDLER_TYPE_TAG = { 0x6e6f646563616c6cULL, 0x7370797468616e64ULL };
+
+    // tags the JS objects returned for the instances created in a forked interpreter, they are only valid in that process
+    static const napi_type_tag FORK_HANDLER_TYPE_TAG = { 0x6e6f646563616c6cULL, 0x73666f726b68616eULL };
+
     class GIL
     {
         PyGILState_STATE m_gstate;
@@ -30,14 +42,108 @@ namespace nodecallspython
         GIL& operator=(GIL&&) = delete;
     };
 
-    class PyInterpreter
+    // a python exception, the exception object is kept so its traceback can be formatted later, only if it is needed
+    class PyError : public std::runtime_error
+    {
+        std::shared_ptr<PyObject> m_exception;
+        std::string m_type;
+        std::string m_message;
+        std::string m_traceback;
+    public:
+        // takes the ownership of exception, must be called holding the GIL
+        // traceback is the already formatted traceback of an exception raised in another process, it is empty otherwise
+        PyError(PyObject* exception, const std::string& type, const std::string& message, const std::string& traceback = std::string());
+
+        const std::shared_ptr<PyObject>& exception() const { return m_exception; }
+
+        const std::string& type() const { return m_type; }
+
+        const std::string& message() const { return m_message; }
+
+        const std::string& traceback() const { return m_traceback; }
+    };
+
+    // the class of the JS errors created from python exceptions, it inherits from Error
+    napi_value getPyErrorClass(napi_env env);
+
+    // creates a PyError with the name, args and attributes of the python exception, the traceback is formatted when stack or traceback is read
+    napi_value createJsError(napi_env env, const PyError& error);
+
+    struct PipelineStep
+    {
+        std::string handler;
+        size_t handlerStep = 0;
+        std::string func;
+        CPyObject args;
+        CPyObject kwargs;
+        std::vector<std::pair<size_t, size_t> > refs;
+    };
+
+    struct ForkedInterpreter
+    {
+        int pid;
+        int fd;
+        std::mutex mutex;
+
+        // the handlers released in JS, they are sent to the child with the next request
+        std::mutex releaseMutex;
+        std::vector<std::string> releaseQueue;
+
+        ForkedInterpreter(int pid, int fd) : pid(pid), fd(fd) {}
+
+        ~ForkedInterpreter();
+
+        void deferRelease(const std::string& handler)
+        {
+            std::lock_guard<std::mutex> l(releaseMutex);
+            releaseQueue.push_back(handler);
+        }
+    };
+
+    // while a scope is alive, sync calls pass their object and array arguments to python as lazy JsObject/JsArray proxies if setLazyArguments is on
+    // the proxies are invalidated when the scope ends, it must end before the JS values of the call go out of scope
+    class ProxyScope
+    {
+    public:
+        ProxyScope();
+
+        ~ProxyScope();
+
+        ProxyScope(const ProxyScope&) = delete;
+        ProxyScope& operator=(const ProxyScope&) = delete;
+    };
+
+    class PyInterpreter : public std::enable_shared_from_this<PyInterpreter>
     {
         PyThreadState* m_state;
-        std::unordered_map<std::string, CPyObject> m_objs;
+        HandlerTable m_objs;
+        std::mutex m_importMutex;
         std::unordered_map<PyObject*, std::string> m_imports;
-        bool m_syncJsAndPy;
+        CPyObject m_moduleIndex;
+        CPyObject m_reloader;
+        std::mutex m_forkMutex;
+        std::unordered_map<int, std::shared_ptr<ForkedInterpreter> > m_forks;
+        std::atomic<bool> m_syncJsAndPy;
+        std::atomic<bool> m_awaitableCallbacks;
+        std::atomic<bool> m_batchCallbacks;
+        std::atomic<bool> m_batchCallbacksAsArray;
+        std::atomic<bool> m_lazyArguments;
+        std::atomic<bool> m_preserveReferences;
+        std::atomic<int64_t> m_handlerMemory;
+        std::mutex m_releaseMutex;
+        std::condition_variable m_releaseCondition;
+        std::vector<std::string> m_releaseQueue;
+        std::thread m_releaseThread;
+        bool m_stopRelease;
         static std::mutex m_mutex;
         static bool m_inited;
+        static std::atomic<PyObject*> m_loop;
+
+        CPyObject call(PyObject* obj, const std::string& func, CPyObject& args, CPyObject& kwargs);
+
+        PyObject* getEventLoop();
+
+        [[noreturn]] void serveForked(int fd);
     public:
         PyInterpreter();
 
@@ -45,22 +151,87 @@ namespace nodecallspython
 
         std::pair<CPyObject, CPyObject> convert(napi_env env, const std::vector<napi_value>& args, bool isSync);
 
+        std::pair<CPyObject, CPyObject> convert(napi_env env, const napi_value* args, size_t argc, bool isSync);
+
         napi_value convert(napi_env env, PyObject* obj);
 
         std::string import(const std::string& modulename, bool allowReimport);
 
         std::string create(const std::string& handler, const std::string& name, CPyObject& args, CPyObject& kwargs);
 
+        std::string registerCallback(napi_env env, napi_value func);
+
         void release(const std::string& handler);
+
+        void deferRelease(const std::string& handler);
+
+        void releasePending();
+
+        CPyObject getObject(const std::string& handler);
+
+        int64_t getSize(const std::string& handler);
+
+        void trackHandlerMemory(int64_t size) { m_handlerMemory += size; }
+
+        CPyObject memoryStats();
+
+        CPyObject get(const std::string& handler, CPyObject& key);
         
         CPyObject call(const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs);
 
+        std::vector<CPyObject> pipeline(std::vector<PipelineStep>& steps);
+
         CPyObject exec(const std::string& handler, const std::string& code, bool eval);
 
+        bool isCoroutine(CPyObject& obj);
+
+        // coroutine functions run on the event loop thread, so their arguments are never lazy
+        bool isCoroutineFunction(const std::string& handler, const std::string& func);
+
+        void runCoroutine(CPyObject& coroutine, napi_threadsafe_function tsfn);
+
+        CPyObject runCoroutineSync(CPyObject& coroutine);
+
+        CPyObject getCoroutineResult(PyObject* future);
+
+        int fork();
+
+        std::shared_ptr<ForkedInterpreter> findFork(int pid);
+
+        CPyObject forkCall(int pid, bool isFunc, const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs);
+
+        CPyObject forkCall(const std::shared_ptr<ForkedInterpreter>& fork, bool isFunc, const std::string& handler, const std::string& func, CPyObject& args, CPyObject& kwargs);
+
+        void releaseFork(int pid);
+
         void addImportPath(const std::string& path);
 
-        void reimport(const std::string& directory);
+        void setModuleIndex(bool enabled);
+
+        // compiles the python files of directory into a bundle, returns the number of modules
+        int buildBundle(const std::string& directory, const std::string& output, bool namespacePackages);
+
+        // imports the modules of the bundle before the ones of sys.path
+        void addBundle(const std::string& path);
+
+        // reloads the modules with a file name containing one of paths and the modules importing them, dependencies first
+        // returns the names of the reloaded modules
+        std::vector<std::string> reimport(const std::vector<std::string>& paths);
+
+        void setSyncJsAndPyInCallback(bool syncJsAndPy, bool awaitable);
+
+        void setCallbackBatching(bool batch, bool asArray);
+
+        bool awaitableCallbacks() const { return m_awaitableCallbacks; }
+
+        bool batchCallbacks() const { return m_batchCallbacks; }
+
+        bool batchCallbacksAsArray() const { return m_batchCallbacksAsArray; }
+
+        void setLazyArguments(bool lazy) { m_lazyArguments = lazy; }
+
+        bool lazyArguments() const { return m_lazyArguments; }
 
-        void setSyncJsAndPyInCallback(bool syncJsAndPy);
+        void setPreserveReferences(bool preserve) { m_preserveReferences = preserve; }
     };
 }
@@ -0,0 +1,391 @@
+#include "wire.h"
+#include "depthguard.h"
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+using namespace nodecallspython;
+
+namespace
+{
+    enum TypedArray : int8_t
+    {
+        INT8 = 0,
+        UINT8,
+        UINT8_CLAMPED,
+        INT16,
+        UINT16,
+        INT32,
+        UINT32,
+        FLOAT32,
+        FLOAT64,
+        BIGINT64,
+        BIGUINT64
+    };
+
+    class Reader
+    {
+        const uint8_t* m_data;
+        size_t m_size;
+        size_t m_pos;
+
+        const uint8_t* take(size_t size)
+        {
+            if (m_size - m_pos < size)
+                throw std::runtime_error("Invalid binary payload: unexpected end of data");
+
+            auto result = m_data + m_pos;
+            m_pos += size;
+            return result;
+        }
+
+        template<class T>
+        T read()
+        {
+            auto data = take(sizeof(T));
+            uint8_t bytes[sizeof(T)];
+            for (auto i = 0u; i < sizeof(T); ++i)
+                bytes[i] = data[sizeof(T) - 1 - i];
+
+            T result;
+            memcpy(&result, bytes, sizeof(T));
+            return result;
+        }
+
+        PyObject* str(size_t size)
+        {
+            auto data = take(size);
+            return PyUnicode_DecodeUTF8(reinterpret_cast<const char*>(data), size, "surrogatepass");
+        }
+
+        PyObject* bin(size_t size)
+        {
+            auto data = take(size);
+            return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(data), size);
+        }
+
+        PyObject* array(size_t size)
+        {
+            DepthGuard guard("");
+            CPyObject list = PyList_New(size);
+            if (!list)
+                return nullptr;
+
+            for (auto i = 0u; i < size; ++i)
+            {
+                auto item = value();
+                if (!item)
+                    return nullptr;
+                PyList_SET_ITEM(*list, i, item);
+            }
+
+            Py_INCREF(*list);
+            return *list;
+        }
+
+        PyObject* map(size_t size)
+        {
+            DepthGuard guard("");
+            CPyObject dict = PyDict_New();
+            if (!dict)
+                return nullptr;
+
+            for (auto i = 0u; i < size; ++i)
+            {
+                CPyObject key = value();
+                CPyObject item = value();
+                if (!key || !item || PyDict_SetItem(*dict, *key, *item) != 0)
+                    return nullptr;
+            }
+
+            Py_INCREF(*dict);
+            return *dict;
+        }
+
+        // typed arrays are passed to python as bytes like in the default conversion
+        PyObject* ext(size_t size)
+        {
+            take(1);
+            return bin(size);
+        }
+
+    public:
+        Reader(const char* data, size_t size) : m_data(reinterpret_cast<const uint8_t*>(data)), m_size(size), m_pos(0) {}
+
+        bool done() const { return m_pos == m_size; }
+
+        // returns a new reference or nullptr with a python error set
+        PyObject* value()
+        {
+            auto type = *take(1);
+
+            if (type <= 0x7f)
+                return PyLong_FromLong(type);
+            else if (type >= 0xe0)
+                return PyLong_FromLong(static_cast<int8_t>(type));
+            else if (type >= 0xa0 && type <= 0xbf)
+                return str(type & 0x1f);
+            else if (type >= 0x90 && type <= 0x9f)
+                return array(type & 0x0f);
+            else if (type >= 0x80 && type <= 0x8f)
+                return map(type & 0x0f);
+
+            switch (type)
+            {
+            case 0xc0: Py_RETURN_NONE;
+            case 0xc2: Py_RETURN_FALSE;
+            case 0xc3: Py_RETURN_TRUE;
+            case 0xc4: return bin(read<uint8_t>());
+            case 0xc5: return bin(read<uint16_t>());
+            case 0xc6: return bin(read<uint32_t>());
+            case 0xc7: return ext(read<uint8_t>());
+            case 0xc8: return ext(read<uint16_t>());
+            case 0xc9: return ext(read<uint32_t>());
+            case 0xca: return PyFloat_FromDouble(read<float>());
+            case 0xcb: return PyFloat_FromDouble(read<double>());
+            case 0xcc: return PyLong_FromUnsignedLong(read<uint8_t>());
+            case 0xcd: return PyLong_FromUnsignedLong(read<uint16_t>());
+            case 0xce: return PyLong_FromUnsignedLong(read<uint32_t>());
+            case 0xcf: return PyLong_FromUnsignedLongLong(read<uint64_t>());
+            case 0xd0: return PyLong_FromLong(read<int8_t>());
+            case 0xd1: return PyLong_FromLong(read<int16_t>());
+            case 0xd2: return PyLong_FromLong(read<int32_t>());
+            case 0xd3: return PyLong_FromLongLong(read<int64_t>());
+            case 0xd9: return str(read<uint8_t>());
+            case 0xda: return str(read<uint16_t>());
+            case 0xdb: return str(read<uint32_t>());
+            case 0xdc: return array(read<uint16_t>());
+            case 0xdd: return array(read<uint32_t>());
+            case 0xde: return map(read<uint16_t>());
+            case 0xdf: return map(read<uint32_t>());
+            default:
+                throw std::runtime_error("Invalid binary payload: unknown type " + std::to_string(type));
+            }
+        }
+    };
+
+    class Writer
+    {
+        std::string& m_out;
+
+        template<class T>
+        void write(uint8_t type, T value)
+        {
+            uint8_t bytes[sizeof(T)];
+            memcpy(bytes, &value, sizeof(T));
+
+            m_out.push_back(static_cast<char>(type));
+            for (auto i = 0u; i < sizeof(T); ++i)
+                m_out.push_back(static_cast<char>(bytes[sizeof(T) - 1 - i]));
+        }
+
+        void header(size_t size, uint8_t fix, uint8_t fixMax, uint8_t type8, uint8_t type16, uint8_t type32)
+        {
+            if (fix && size <= fixMax)
+                m_out.push_back(static_cast<char>(fix | size));
+            else if (type8 && size <= 0xff)
+                write<uint8_t>(type8, static_cast<uint8_t>(size));
+            else if (size <= 0xffff)
+                write<uint16_t>(type16, static_cast<uint16_t>(size));
+            else
+                write<uint32_t>(type32, static_cast<uint32_t>(size));
+        }
+
+        void integer(long long value)
+        {
+            if (value >= 0 && value <= 0x7f)
+                m_out.push_back(static_cast<char>(value));
+            else if (value < 0 && value >= -32)
+                m_out.push_back(static_cast<char>(static_cast<int8_t>(value)));
+            else if (value >= INT32_MIN && value <= INT32_MAX)
+                write<int32_t>(0xd2, static_cast<int32_t>(value));
+            else
+                write<int64_t>(0xd3, value);
+        }
+
+        void str(const char* data, size_t size)
+        {
+            header(size, 0xa0, 31, 0xd9, 0xda, 0xdb);
+            m_out.append(data, size);
+        }
+
+        void bin(const char* data, size_t size)
+        {
+            header(size, 0, 0, 0xc4, 0xc5, 0xc6);
+            m_out.append(data, size);
+        }
+
+        void ext(int8_t type, const char* data, size_t size)
+        {
+            header(size, 0, 0, 0xc7, 0xc8, 0xc9);
+            m_out.push_back(static_cast<char>(type));
+            m_out.append(data, size);
+        }
+
+        void items(PyObject* obj)
+        {
+            DepthGuard guard("");
+            auto size = PySequence_Fast_GET_SIZE(obj);
+            auto items = PySequence_Fast_ITEMS(obj);
+
+            header(size, 0x90, 15, 0, 0xdc, 0xdd);
+            for (auto i = 0; i < size; ++i)
+                value(items[i]);
+        }
+
+        // 1 dimensional contiguous numeric buffers (e.g. numpy arrays) are sent as typed arrays
+        bool typedArray(PyObject* obj)
+        {
+            if (!PyObject_CheckBuffer(obj))
+                return false;
+
+            Py_buffer view;
+            if (PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0)
+            {
+                PyErr_Clear();
+                return false;
+            }
+
+            int type = -1;
+            if (view.ndim == 1 && view.format && strlen(view.format) == 1)
+            {
+                switch (view.format[0])
+                {
+                case 'b': type = INT8; break;
+                case 'B': type = UINT8; break;
+                case 'h': type = INT16; break;
+                case 'H': type = UINT16; break;
+                case 'i': type = INT32; break;
+                case 'I': type = UINT32; break;
+                case 'f': type = FLOAT32; break;
+                case 'd': type = FLOAT64; break;
+                case 'q': type = BIGINT64; break;
+                case 'Q': type = BIGUINT64; break;
+                case 'l': type = view.itemsize == 8 ? BIGINT64 : INT32; break;
+                case 'L': type = view.itemsize == 8 ? BIGUINT64 : UINT32; break;
+                default: break;
+                }
+            }
+
+            if (type >= 0)
+                ext(static_cast<int8_t>(type), static_cast<const char*>(view.buf), view.len);
+
+            PyBuffer_Release(&view);
+            return type >= 0;
+        }
+
+    public:
+        Writer(std::string& out) : m_out(out) {}
+
+        void value(PyObject* obj)
+        {
+            if (obj == Py_None)
+                m_out.push_back(static_cast<char>(0xc0));
+            else if (PyBool_Check(obj))
+                m_out.push_back(static_cast<char>(obj == Py_True ? 0xc3 : 0xc2));
+            else if (PyLong_Check(obj))
+            {
+                int overflow = 0;
+                auto value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+                if (overflow)
+                    write<double>(0xcb, PyLong_AsDouble(obj));
+                else
+                    integer(value);
+                PyErr_Clear();
+            }
+            else if (PyFloat_Check(obj))
+                write<double>(0xcb, PyFloat_AS_DOUBLE(obj));
+            else if (PyUnicode_Check(obj))
+            {
+                Py_ssize_t size;
+                auto data = PyUnicode_AsUTF8AndSize(obj, &size);
+                if (!data)
+                    throw std::runtime_error("Cannot encode string");
+                str(data, size);
+            }
+            else if (PyList_Check(obj) || PyTuple_Check(obj))
+                items(obj);
+            else if (PyDict_Check(obj))
+            {
+                DepthGuard guard("");
+                header(PyDict_Size(obj), 0x80, 15, 0, 0xde, 0xdf);
+
+                PyObject *key, *item;
+                Py_ssize_t pos = 0;
+                while (PyDict_Next(obj, &pos, &key, &item))
+                {
+                    value(key);
+                    value(item);
+                }
+            }
+            else if (PyBytes_Check(obj))
+                bin(PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj));
+            else if (PyByteArray_Check(obj))
+                bin(PyByteArray_AS_STRING(obj), PyByteArray_GET_SIZE(obj));
+            else if (typedArray(obj))
+                return;
+            else
+            {
+                CPyObject sequence = PySequence_Fast(obj, "");
+                if (sequence)
+                {
+                    items(*sequence);
+                    return;
+                }
+
+                // same fallbacks as the default conversion: numbers (e.g. numpy scalars), then strings
+                PyErr_Clear();
+                auto number = PyFloat_AsDouble(obj);
+                if (!PyErr_Occurred())
+                {
+                    write<double>(0xcb, number);
+                    return;
+                }
+
+                PyErr_Clear();
+                Py_ssize_t size;
+                auto data = PyUnicode_AsUTF8AndSize(obj, &size);
+                if (data)
+                    str(data, size);
+                else
+                {
+                    PyErr_Clear();
+                    m_out.push_back(static_cast<char>(0xc0));
+                }
+            }
+        }
+    };
+}
+
+std::pair<CPyObject, CPyObject> wire::decodeArguments(const char* data, size_t size)
+{
+    Reader reader(data, size);
+    CPyObject payload = reader.value();
+    if (!payload)
+    {
+        PyErr_Clear();
+        throw std::runtime_error("Invalid binary payload");
+    }
+
+    if (!reader.done() || !PyList_Check(*payload) || PyList_Size(*payload) != 2)
+        throw std::runtime_error("Invalid binary payload: expected [args, kwargs]");
+
+    auto args = PyList_GetItem(*payload, 0);
+    auto kwargs = PyList_GetItem(*payload, 1);
+    if (!PyList_Check(args) || (kwargs != Py_None && !PyDict_Check(kwargs)))
+        throw std::runtime_error("Invalid binary payload: expected [args, kwargs]");
+
+    CPyObject tuple = PyList_AsTuple(args);
+    if (kwargs == Py_None)
+        return { tuple, CPyObject() };
+
+    Py_INCREF(kwargs);
+    return { tuple, CPyObject(kwargs) };
+}
+
+void wire::encode(PyObject* obj, std::string& out)
+{
+    out.clear();
+    Writer writer(out);
+    writer.value(obj);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "cpyobject.h"
+#include <string>
+
+namespace nodecallspython
+{
+    // MessagePack based binary format used by callBinary/callBinarySync, the JS side lives in msgpack.js
+    // typed arrays are sent as ext types, the ext type is the index of the typed array in TYPED_ARRAYS of msgpack.js
+    namespace wire
+    {
+        // decodes the [args, kwargs] payload encoded by msgpack.js
+        std::pair<CPyObject, CPyObject> decodeArguments(const char* data, size_t size);
+
+        // must be called holding the GIL
+        void encode(PyObject* obj, std::string& out);
+    }
+}
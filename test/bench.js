@@ -0,0 +1,215 @@
+// conversion microbenchmarks, run with: node test/bench.js [filter]
+const nodecallspython = require("../");
+const path = require("path");
+
+const py = nodecallspython.interpreter;
+const pymodule = py.importSync(path.join(__dirname, "nodetest.py"));
+
+const range = (n, f) => [...Array(n).keys()].map(f);
+
+const payloads = {
+    "scalars": [1, 2.5, "text", true, null],
+    "numbers": [range(100000, i => i * 1.5)],
+    "integers": [range(100000, i => i)],
+    "strings": [range(50000, i => "item" + i)],
+    "mixed": [range(50000, i => i % 2 ? i : "item" + i)],
+    "records": [range(10000, i => ({ id: i, name: "name" + i, score: i / 3, tags: ["a", "b"], ok: true }))],
+    "buffers": [range(1000, () => Buffer.alloc(64))],
+    "text": ["lorem ipsum ".repeat(100000)],
+    "unicode text": ["lörem ipsüm 漢字 ".repeat(100000)]
+};
+
+function bench(name, fn)
+{
+    fn();
+    let iterations = 0;
+    const start = process.hrtime.bigint();
+    let elapsed = 0;
+    while (elapsed < 500)
+    {
+        fn();
+        ++iterations;
+        elapsed = Number(process.hrtime.bigint() - start) / 1e6;
+    }
+    console.log(name.padEnd(30) + (elapsed / iterations).toFixed(3).padStart(10) + " ms/op");
+}
+
+const filter = process.argv[2] || "";
+
+for (const [name, args] of Object.entries(payloads))
+{
+    if (!("js->py " + name).includes(filter))
+        continue;
+
+    bench("js->py " + name, () => py.callSync(pymodule, "consume", ...args));
+    bench("js->py " + name + " (binary)", () => py.callBinarySync(pymodule, "consume", ...args));
+}
+
+for (const n of [100, 10000])
+{
+    if (!("py->js bulkResults " + n).includes(filter))
+        continue;
+
+    bench("py->js bulkResults " + n, () => py.callSync(pymodule, "bulkResults", n));
+    bench("py->js bulkResults " + n + " (binary)", () => py.callBinarySync(pymodule, "bulkResults", n));
+}
+
+for (const [name, text] of [["text", payloads["text"][0]], ["unicode text", payloads["unicode text"][0]]])
+{
+    if (!("roundtrip " + name).includes(filter))
+        continue;
+
+    bench("roundtrip " + name, () => py.callSync(pymodule, "echo", text));
+}
+
+if ("lazy config".includes(filter))
+{
+    const config = { server: { port: 8080 }, records: payloads["records"][0] };
+    bench("lazy config (eager)", () => py.callSync(pymodule, "readProxy", config, [1]));
+    py.setLazyArguments(true);
+    bench("lazy config (lazy)", () => py.callSync(pymodule, "readProxy", config, [1]));
+    py.setLazyArguments(false);
+}
+
+if ("shared graph".includes(filter))
+{
+    const vocabulary = Object.fromEntries(range(1000, i => ["word" + i, i]));
+    const documents = range(200, i => ({ id: i, vocabulary }));
+    bench("shared graph (copies)", () => py.callSync(pymodule, "consume", documents));
+    py.setPreserveReferences(true);
+    bench("shared graph (references)", () => py.callSync(pymodule, "consume", documents));
+    py.setPreserveReferences(false);
+}
+
+if ("exceptions".includes(filter))
+{
+    bench("exceptions", () => {
+        try
+        {
+            py.callSync(pymodule, "validate", -1);
+        }
+        catch (e)
+        {
+        }
+    });
+}
+
+if ("imports".includes(filter))
+{
+    const fs = require("fs");
+    const os = require("os");
+
+    // every module lives in its own directory, the modules imported by name (like python code importing its siblings)
+    // are looked up in all the directories of sys.path in front of them
+    const importAll = (name, count) => {
+        const root = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-bench-"));
+        const files = range(count, i => {
+            const dir = path.join(root, "d" + i);
+            fs.mkdirSync(dir);
+            fs.writeFileSync(path.join(dir, name + i + ".py"), "value = " + i + "\n");
+            fs.writeFileSync(path.join(dir, name + "_sibling" + i + ".py"), "value = " + i + "\n");
+            return path.join(dir, name + i + ".py");
+        });
+
+        let start = process.hrtime.bigint();
+        files.forEach(file => py.importSync(file));
+        console.log(("imports " + name + " (paths)").padEnd(30) + (Number(process.hrtime.bigint() - start) / 1e6).toFixed(3).padStart(10) + " ms");
+
+        start = process.hrtime.bigint();
+        py.callSync(pymodule, "importModules", range(count, i => name + "_sibling" + i));
+        console.log(("imports " + name + " (names)").padEnd(30) + (Number(process.hrtime.bigint() - start) / 1e6).toFixed(3).padStart(10) + " ms");
+
+        fs.rmSync(root, { recursive: true, force: true });
+    };
+
+    importAll("scanned", 500);
+    py.setModuleIndex(true);
+    importAll("indexed", 500);
+    py.setModuleIndex(false);
+}
+
+if ("bundles".includes(filter))
+{
+    const fs = require("fs");
+    const os = require("os");
+    const { execFileSync } = require("child_process");
+
+    // a package tree imported from its files (with compiled __pycache__) and from a bundle of the same tree
+    const root = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-bench-"));
+    const createTree = name => {
+        range(20, i => {
+            const dir = path.join(root, name, name, "sub" + i);
+            fs.mkdirSync(dir, { recursive: true });
+            fs.writeFileSync(path.join(dir, "__init__.py"), range(10, j => "from . import m" + j).join("\n") + "\n");
+            range(10, j => fs.writeFileSync(path.join(dir, "m" + j + ".py"), "import json\nvalue = " + j + "\ndef f(x):\n    return x + value\n"));
+        });
+        fs.writeFileSync(path.join(root, name, name, "__init__.py"), range(20, i => "from . import sub" + i).join("\n") + "\n");
+        return path.join(root, name);
+    };
+
+    const report = (name, fn) => {
+        const start = process.hrtime.bigint();
+        const events = fn();
+        const elapsed = Number(process.hrtime.bigint() - start) / 1e6;
+        console.log(name.padEnd(30) + elapsed.toFixed(3).padStart(10) + " ms" + (events ? "  " + JSON.stringify(events) : ""));
+    };
+
+    const files = createTree("fromfiles");
+    py.callSync(pymodule, "compileTree", files);
+    py.addImportPath(files);
+    report("bundles import (files)", () => py.callSync(pymodule, "importCounted", ["fromfiles"]));
+
+    const bundle = path.join(root, "modules.bundle");
+    py.buildBundle(createTree("frombundle"), bundle);
+    py.addBundle(bundle);
+    report("bundles import (bundle)", () => py.callSync(pymodule, "importCounted", ["frombundle"]));
+
+    // a new process starting the interpreter and importing the tree
+    const startup = (name, module, env) => report(name, () => {
+        execFileSync(process.execPath, ["-e", `require(${JSON.stringify(path.join(__dirname, ".."))}).interpreter.importSync(process.argv[1], false)`, module], { env: { ...process.env, ...env } });
+    });
+    startup("bundles startup (files)", path.join(files, "fromfiles"), {});
+    startup("bundles startup (bundle)", "frombundle", { NODE_CALLS_PYTHON_BUNDLE: bundle });
+
+    fs.rmSync(root, { recursive: true, force: true });
+}
+
+if ("reimport".includes(filter))
+{
+    const fs = require("fs");
+    const os = require("os");
+
+    // 500 modules importing a shared base module, each one is imported by two others like a binary tree
+    const root = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-bench-"));
+    fs.writeFileSync(path.join(root, "reimportbench_base.py"), "VALUE = 1\n");
+    range(500, i => fs.writeFileSync(path.join(root, "reimportbench" + i + ".py"), "import reimportbench_base\n" + (i ? "import reimportbench" + ((i - 1) >> 1) + "\n" : "") + "value = " + i + "\n"));
+    py.addImportPath(root);
+    py.callSync(pymodule, "importModules", range(500, i => "reimportbench" + i));
+    const file = name => path.join(root, name + ".py");
+
+    const report = (name, fn) => {
+        const start = process.hrtime.bigint();
+        const result = fn();
+        console.log(name.padEnd(30) + (Number(process.hrtime.bigint() - start) / 1e6).toFixed(3).padStart(10) + " ms" + (result ? "  " + result.length + " modules" : ""));
+    };
+
+    report("reimport (first)", () => py.reimport(file("reimportbench499")));
+    report("reimport (leaf)", () => py.reimport(file("reimportbench499")));
+    report("reimport (subtree)", () => py.reimport(file("reimportbench7")));
+    report("reimport (base)", () => py.reimport(file("reimportbench_base")));
+
+    (async () => {
+        // the event loop is only blocked while the reimport is queued
+        const start = process.hrtime.bigint();
+        let modules = null;
+        report("reimportAsync (queued)", () => { py.reimportAsync(file("reimportbench7")).then(result => modules = result); });
+        let ticks = 0;
+        while (!modules)
+        {
+            await new Promise(resolve => setImmediate(resolve));
+            ++ticks;
+        }
+        console.log("reimportAsync (done)".padEnd(30) + (Number(process.hrtime.bigint() - start) / 1e6).toFixed(3).padStart(10) + " ms  " + modules.length + " modules, " + ticks + " event loop turns meanwhile");
+        fs.rmSync(root, { recursive: true, force: true });
+    })();
+}
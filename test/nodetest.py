@@ -1,6 +1,10 @@
 import numpy as np
+import asyncio
 import nodetestre
 import multiprocessing
+import os
+import time
+import collections.abc
 
 def hello():
     print("hello world")
@@ -48,6 +52,25 @@ def mergedict(a, b):
 def testException():
     raise RuntimeError("test")
 
+class ValidationError(ValueError):
+    def __init__(self, field, errorCode):
+        super().__init__("invalid " + field)
+        self.field = field
+        self.errorCode = errorCode
+
+def validate(age):
+    if age < 0:
+        raise ValidationError("age", 42)
+    return age
+
+def raiseUnconvertible():
+    cyclic = []
+    cyclic.append(cyclic)
+    error = ValueError("cyclic", cyclic)
+    error.items = cyclic
+    error.code = 5
+    raise error
+
 def undefined(un, n):    
     return (un, n, {1, 2, "www"})
 
@@ -111,3 +134,222 @@ def testMultiProcessing(len):
     with multiprocessing.Pool(processes=3) as pool:
         results = pool.map(compute, numbers)
     return sum(results)
+
+def bigdict(n):
+    return {"values": list(range(n)), "name": "big", "nested": {"a": 1}}
+
+class BrokenProperty:
+    value = 1
+
+    @property
+    def broken(self):
+        raise ValueError("broken property")
+
+def sumvalues(d):
+    return sum(d["values"])
+
+def preprocess(values):
+    return np.array(values) * 2
+
+def predict(features, bias = 0):
+    return features.sum() + bias
+
+def testFunctionProgress(count, function):
+    for i in range(count):
+        function(i, "row")
+    return count
+
+async def gatherCallbacks(function, count):
+    results = await asyncio.gather(*[function(i) for i in range(count)])
+    return sum(results)
+
+def testAwaitableCallbacks(function, count):
+    return asyncio.run(gatherCallbacks(function, count))
+
+async def callFromCoroutine(function):
+    return function(2)
+
+def testCallbackInLoop(function):
+    return asyncio.run(callFromCoroutine(function))
+
+def testCallbackError(function):
+    try:
+        function()
+    except RuntimeError as e:
+        return str(e)
+
+async def asyncSleep(value, delay):
+    await asyncio.sleep(delay)
+    return value * 2
+
+async def asyncError():
+    await asyncio.sleep(0)
+    raise RuntimeError("async error")
+
+trackedAlive = 0
+
+class Tracked:
+    def __init__(self):
+        global trackedAlive
+        trackedAlive += 1
+
+    def __del__(self):
+        global trackedAlive
+        trackedAlive -= 1
+
+def getTrackedAlive():
+    return trackedAlive
+
+warmState = {}
+
+def warmUp(key, value):
+    warmState[key] = value
+
+def getWarmState(key):
+    return (os.getpid(), warmState.get(key))
+
+def sumargs(*args, **kwargs):
+    return sum(args) + sum(kwargs.values())
+
+def bulkResults(n):
+    return {
+        "floats": [i / 2 for i in range(n)],
+        "ints": list(range(n)),
+        "mixed": [i if i % 2 else str(i) for i in range(n)],
+        "records": tuple({"id": i, "name": str(i), 1: True} for i in range(n)),
+    }
+
+def echo(*args, **kwargs):
+    return [list(args), kwargs]
+
+def numpyVector(n):
+    return np.arange(n, dtype=np.float64)
+
+def importModules(names):
+    import importlib
+    for name in names:
+        importlib.import_module(name)
+
+def consume(*args, **kwargs):
+    pass
+
+def codepoints(s):
+    return [len(s), [ord(c) for c in s[:8]]]
+
+def mapCallback(function, count):
+    return [function(i) for i in range(count)]
+
+batchSizes = []
+
+def predictRow(row, scale=1):
+    return row["x"] * scale
+
+def predictRows(rows, scales):
+    batchSizes.append(len(rows))
+    return [row["x"] * scale for row, scale in zip(rows, scales)]
+
+def firstRow(rows, *columns):
+    return rows[:1]
+
+def getBatchSizes():
+    sizes = list(batchSizes)
+    batchSizes.clear()
+    return sizes
+
+tokenizeCalls = 0
+
+def tokenize(text, *rest):
+    global tokenizeCalls
+    tokenizeCalls += 1
+    return text.split()
+
+def getTokenizeCalls():
+    return tokenizeCalls
+
+def slowCall(seconds):
+    time.sleep(seconds)
+    return seconds
+
+keptProxy = None
+
+def readProxy(config, items):
+    global keptProxy
+    keptProxy = config
+    return [type(config).__name__, isinstance(config, collections.abc.Mapping), config["server"]["port"], len(config),
+            type(items).__name__, isinstance(items, collections.abc.Sequence), items[-1], list(items[1:3]), len(items)]
+
+def readKeptProxy(*path):
+    value = keptProxy
+    for key in path:
+        value = value[key]
+    return value
+
+def identity(value):
+    return value
+
+def valueOf():
+    return "valueOf"
+
+def readProxyInThread(config):
+    import threading
+    result = []
+    def read():
+        try:
+            result.append(config["name"])
+        except RuntimeError as e:
+            result.append(str(e))
+    thread = threading.Thread(target=read)
+    thread.start()
+    thread.join()
+    return [type(config).__name__, result[0]]
+
+async def readProxyAsync(config):
+    return [type(config).__name__, config["name"]]
+
+def indexedOrigin(name):
+    import sys
+    for finder in sys.meta_path:
+        if type(finder).__name__ == "ModuleIndex":
+            spec = finder.find_spec(name)
+            return spec.origin if spec else None
+    return None
+
+def countImportPath(directory):
+    import sys
+    return sys.path.count(directory)
+
+_fileEvents = None
+_auditing = False
+
+def _countFileEvents(event, args):
+    if _fileEvents is not None and event in ("open", "os.listdir", "os.scandir"):
+        _fileEvents[event] = _fileEvents.get(event, 0) + 1
+
+def importCounted(names):
+    # audit hooks cannot be removed, the hook is added by the first call only
+    import importlib, sys
+    global _fileEvents, _auditing
+    if not _auditing:
+        sys.addaudithook(_countFileEvents)
+        _auditing = True
+
+    _fileEvents = {}
+    try:
+        for name in names:
+            importlib.import_module(name)
+        return _fileEvents
+    finally:
+        _fileEvents = None
+
+def compileTree(directory):
+    import compileall
+    return compileall.compile_dir(directory, quiet=1)
+
+def sameObjects(items, other):
+    return [items[0] is items[1], items[0] is other, items[0]["self"] is items[0]]
+
+def sharedGraph():
+    shared = {"x": 1}
+    graph = {"a": shared, "b": shared, "list": []}
+    graph["list"].append(graph)
+    return graph
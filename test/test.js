@@ -1,5 +1,7 @@
 const nodecallspython = require("../");
 const path = require("path");
+const fs = require("fs");
+const os = require("os");
 const { Worker } = require('worker_threads');
 
 let py = nodecallspython.interpreter;
@@ -128,32 +130,34 @@ it("nodecallspython async import", () => {
 });
 
 it("nodecallspython errors", async () => {
-    await expect(py.call(pymodule, "error")).rejects.toEqual("module 'nodetest' has no attribute 'error'");
+    await expect(py.call(pymodule, "error")).rejects.toThrow("module 'nodetest' has no attribute 'error'");
+    await expect(py.call(pymodule, "error")).rejects.toMatchObject({ name: "AttributeError", code: "py" });
     expect(() => py.callSync(pymodule, "error")).toThrow("module 'nodetest' has no attribute 'error'");
 
     expect(() => py.callSync(pymodule, function(){})).toThrow("Wrong type of arguments");
 
-    await expect(py.call(pymodule, "dump")).rejects.toEqual("dump() missing 2 required positional arguments: 'a' and 'b'");
+    await expect(py.call(pymodule, "dump")).rejects.toThrow("dump() missing 2 required positional arguments: 'a' and 'b'");
     expect(() => py.callSync(pymodule, "dump")).toThrow("dump() missing 2 required positional arguments: 'a' and 'b'");
 
-    await expect(py.call(pymodule, "dump", "a")).rejects.toEqual("dump() missing 1 required positional argument: 'b'");
+    await expect(py.call(pymodule, "dump", "a")).rejects.toThrow("dump() missing 1 required positional argument: 'b'");
     expect(() => py.callSync(pymodule, "dump", "a")).toThrow("dump() missing 1 required positional argument: 'b'");
 
-    await expect(py.call(pymodule, "testException")).rejects.toMatch(/.+nodetest.py.+RuntimeError: test.*/s);
-    expect(() => py.callSync(pymodule, "testException")).toThrow(/.+nodetest.py.+RuntimeError: test.*/s);
+    await expect(py.call(pymodule, "testException")).rejects.toMatchObject({ name: "RuntimeError", message: "test" });
+    expect(() => py.callSync(pymodule, "testException")).toThrow("test");
+    expect((await py.call(pymodule, "testException").catch(e => e)).traceback).toMatch(/.+nodetest.py.+RuntimeError: test.*/s);
 
-    await expect(py.create(pymodule, "Calculator2")).rejects.toEqual("module 'nodetest' has no attribute 'Calculator2'");
+    await expect(py.create(pymodule, "Calculator2")).rejects.toThrow("module 'nodetest' has no attribute 'Calculator2'");
     expect(() => py.createSync(pymodule, "Calculator2")).toThrow("module 'nodetest' has no attribute 'Calculator2'");
 
-    await expect(py.import(path.join(__dirname, "error.py"))).rejects.toEqual("No module named 'error'");
+    await expect(py.import(path.join(__dirname, "error.py"))).rejects.toThrow("No module named 'error'");
     expect(() => py.importSync(path.join(__dirname, "error.py"))).toThrow("No module named 'error'");
 
-    await expect(py.exec(pymodule, "dump(12)")).rejects.toMatch("dump() missing 1 required positional argument: 'b'");
+    await expect(py.exec(pymodule, "dump(12)")).rejects.toThrow("dump() missing 1 required positional argument: 'b'");
     expect(() => py.execSync(pymodule, "dump(12)")).toThrow("dump() missing 1 required positional argument: 'b'");
     await expect(py.exec(pymodule, function(){})).rejects.toThrow("Wrong type of arguments");
     expect(() => py.execSync(pymodule, function(){})).toThrow("Wrong type of arguments");
 
-    await expect(py.eval(pymodule, "dump(12)")).rejects.toMatch("dump() missing 1 required positional argument: 'b'");
+    await expect(py.eval(pymodule, "dump(12)")).rejects.toThrow("dump() missing 1 required positional argument: 'b'");
     expect(() => py.evalSync(pymodule, "dump(12)")).toThrow("dump() missing 1 required positional argument: 'b'");
     await expect(py.eval(pymodule, function(){})).rejects.toThrow("Wrong type of arguments");
     expect(() => py.evalSync(pymodule, function(){})).toThrow("Wrong type of arguments");
@@ -223,6 +227,35 @@ it("nodecallspython import", async () => {
     await expect(py.import(pyfile, true)).resolves.not.toEqual(pymodule);
 });
 
+it("nodecallspython preload", async () => {
+    const times = await py.preload(["json", pyfile]);
+    expect(Object.keys(times)).toEqual(["json", pyfile]);
+    expect(times.json).toBeGreaterThanOrEqual(0);
+    expect(times[pyfile]).toBeGreaterThanOrEqual(0);
+
+    await expect(py.preload(["nonexistingmodule"])).rejects.toThrow(/nonexistingmodule/);
+    await expect(py.preloaded).resolves.toEqual({});
+});
+
+it("nodecallspython startup cache", () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-"));
+    const cacheFile = path.join(dir, "startup.json");
+    try
+    {
+        py.writeStartupCache(cacheFile, { libs: [], executable: process.execPath });
+        expect(fs.statSync(cacheFile).mode & 0o777).toEqual(0o600);
+        expect(py.readStartupCache(cacheFile)).toEqual({ libs: [], executable: process.execPath });
+
+        // files others can write are not trusted
+        fs.chmodSync(cacheFile, 0o666);
+        expect(py.readStartupCache(cacheFile)).toEqual(undefined);
+    }
+    finally
+    {
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+});
+
 it("nodecallspython reimport", () => {
     expect(py.callSync(pymodule, "testReimport")).toEqual(6);
     expect(py.callSync(pymodule, "testReimport")).toEqual(7);
@@ -237,6 +270,57 @@ it("nodecallspython reimport", () => {
     }
 });
 
+it("nodecallspython dependency reimport", async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-"));
+    fs.writeFileSync(path.join(dir, "reimportbase.py"), "VALUE = 1\n");
+    fs.writeFileSync(path.join(dir, "reimportother.py"), "OTHER = 1\n");
+    fs.writeFileSync(path.join(dir, "reimportmiddle.py"), "from reimportbase import VALUE\nimport reimportother\ndef get():\n    return VALUE + reimportother.OTHER\n");
+    fs.writeFileSync(path.join(dir, "reimporttop.py"), "import reimportmiddle\ndef get():\n    return reimportmiddle.get()\n");
+    fs.writeFileSync(path.join(dir, "reimportunrelated.py"), "import reimportother\n");
+
+    try
+    {
+        const top = py.importSync(path.join(dir, "reimporttop.py"));
+        py.importSync(path.join(dir, "reimportunrelated.py"));
+        expect(py.callSync(top, "get")).toEqual(2);
+
+        // only the changed module and the ones importing it are reloaded, after the modules they import
+        fs.writeFileSync(path.join(dir, "reimportbase.py"), "VALUE = 10\n");
+        await expect(py.reimportAsync(path.join(dir, "reimportbase.py"))).resolves.toEqual(["reimportbase", "reimportmiddle", "reimporttop"]);
+        expect(py.callSync(top, "get")).toEqual(11);
+        expect(py.reimport(path.join(dir, "nothing.py"))).toEqual([]);
+
+        // the changes of a burst are reimported together
+        const reimported = [];
+        let reimportDone = null;
+        const done = new Promise(resolve => reimportDone = resolve);
+        const reimporter = py.createReimporter({ debounce: 50, onReimport: (error, modules) => { reimported.push(error || modules); reimportDone(); } });
+
+        fs.writeFileSync(path.join(dir, "reimportother.py"), "OTHER = 100\n");
+        reimporter.changed(path.join(dir, "reimportother.py"));
+        fs.writeFileSync(path.join(dir, "reimportbase.py"), "VALUE = 1000\n");
+        reimporter.changed(path.join(dir, "reimportbase.py"));
+        await done;
+        expect(reimported.length).toEqual(1);
+        const order = reimported[0];
+        expect([...order].sort()).toEqual(["reimportbase", "reimportmiddle", "reimportother", "reimporttop", "reimportunrelated"]);
+        expect(order.indexOf("reimportbase") < order.indexOf("reimportmiddle") && order.indexOf("reimportother") < order.indexOf("reimportmiddle")).toEqual(true);
+        expect(order.indexOf("reimportmiddle") < order.indexOf("reimporttop") && order.indexOf("reimportother") < order.indexOf("reimportunrelated")).toEqual(true);
+        expect(py.callSync(top, "get")).toEqual(1100);
+
+        // a closed reimporter drops the pending changes
+        reimporter.changed(path.join(dir, "reimportbase.py"));
+        reimporter.close();
+        reimporter.changed(path.join(dir, "reimportother.py"));
+        await new Promise(resolve => setTimeout(resolve, 100));
+        expect(reimported.length).toEqual(1);
+    }
+    finally
+    {
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+});
+
 it("nodecallspython buffers", () => {
     const float32 = new Float32Array(4);
     float32[0] = 1.0;
@@ -369,3 +453,595 @@ it("nodecallspython multiprocessing", async () => {
     expect(py.callSync(pymodule, "testMultiProcessing", 5)).toEqual(30);
     expect(await py.call(pymodule, "testMultiProcessing", 5)).toEqual(30);
 });
+
+it("nodecallspython lazy results", async () => {
+    const lazy = await py.callLazy(pymodule, "bigdict", 1000);
+    expect(lazy.name).toEqual("big");
+    expect(lazy.nested).toEqual({ a: 1 });
+    expect(lazy.values.length).toEqual(1000);
+    expect(lazy.missing).toEqual(undefined);
+
+    await expect(py.call(pymodule, "sumvalues", lazy)).resolves.toEqual(499500);
+    expect(py.callSync(pymodule, "sumvalues", lazy)).toEqual(499500);
+    expect(py.callSync(pymodule, "sumvalues", py.callLazySync(pymodule, "bigdict", 10))).toEqual(45);
+
+    const tuple = py.callLazySync(pymodule, "createtuple");
+    expect(tuple[0]).toEqual("aaa");
+    expect(tuple[2]).toEqual(2.3);
+    expect(tuple.length).toEqual(3);
+    expect(py.materialize(tuple)).toEqual(["aaa", 1, 2.3]);
+    expect(py.materialize(tuple, 1)).toEqual(1);
+
+    // keys named like the wrapper properties are read from python, errors other than missing keys are thrown
+    const keyed = py.callLazySync(pymodule, "identity", { handler: 5, then: 6 });
+    expect(keyed.handler).toEqual(5);
+    expect(py.callSync(keyed, "get", "then")).toEqual(6);
+
+    const broken = py.callLazySync(pymodule, "BrokenProperty");
+    expect(broken.value).toEqual(1);
+    expect(broken.missing).toEqual(undefined);
+    expect(() => broken.broken).toThrow("broken property");
+});
+
+it("nodecallspython pipeline", async () => {
+    const steps = [
+        { handler: pymodule, func: "preprocess", args: [[1, 2, 3]] },
+        { handler: pymodule, func: "predict", args: [py.step(0), { bias: 1, __kwargs: true }] },
+        { handler: py.step(0), func: "tolist" }
+    ];
+
+    await expect(py.pipeline(steps.slice(0, 2))).resolves.toEqual(13);
+    expect(py.pipelineSync(steps.slice(0, 2))).toEqual(13);
+
+    await expect(py.pipeline(steps, [1, 2])).resolves.toEqual([13, [2, 4, 6]]);
+    expect(py.pipelineSync(steps, [2])).toEqual([[2, 4, 6]]);
+
+    const lazy = py.callLazySync(pymodule, "preprocess", [1, 1]);
+    expect(py.pipelineSync([{ handler: pymodule, func: "predict", args: [lazy] }])).toEqual(4);
+
+    await expect(py.pipeline([{ handler: pymodule, func: "predict", args: [py.step(0)] }])).rejects.toThrow("previous steps");
+    await expect(py.pipeline([{ handler: pymodule, func: "error" }])).rejects.toThrow("module 'nodetest' has no attribute 'error'");
+    expect(() => py.pipelineSync([{ handler: pymodule, func: "error" }])).toThrow("module 'nodetest' has no attribute 'error'");
+    expect(() => py.pipelineSync([{ handler: pymodule, func: "predict", args: "x" }])).toThrow("Wrong type of arguments");
+});
+
+it("nodecallspython callback batching", async () => {
+    py.setSyncJsAndPyInCallback(false);
+    py.setCallbackBatching(true);
+
+    let rows = [];
+    await expect(py.call(pymodule, "testFunctionProgress", 1000, (i, name) => rows.push([i, name]))).resolves.toEqual(1000);
+    await new Promise(resolve => setTimeout(resolve, 100));
+    expect(rows.length).toEqual(1000);
+    expect(rows[999]).toEqual([999, "row"]);
+
+    py.setCallbackBatching(true, true);
+
+    rows = [];
+    let batches = 0;
+    await expect(py.call(pymodule, "testFunctionProgress", 1000, (invocations) => { ++batches; rows.push(...invocations); })).resolves.toEqual(1000);
+    await new Promise(resolve => setTimeout(resolve, 100));
+    expect(rows.length).toEqual(1000);
+    expect(rows[10]).toEqual([10, "row"]);
+    expect(batches).toBeLessThan(1000);
+
+    py.setCallbackBatching(false);
+    py.setSyncJsAndPyInCallback(true);
+});
+
+it("nodecallspython awaitable callbacks", async () => {
+    // callbacks block in coroutines too unless they are awaitable
+    py.setSyncJsAndPyInCallback(true);
+    await expect(py.call(pymodule, "testCallbackInLoop", (i) => 2 * i)).resolves.toEqual(4);
+
+    py.setSyncJsAndPyInCallback(true, true);
+
+    const delayed = (i) => new Promise(resolve => setTimeout(() => resolve(2 * i), 10));
+    await expect(py.call(pymodule, "testAwaitableCallbacks", delayed, 100)).resolves.toEqual(9900);
+    await expect(py.call(pymodule, "testAwaitableCallbacks", (i) => i, 100)).resolves.toEqual(4950);
+
+    await expect(py.call(pymodule, "testFunctionPromise", 0, async () => 4)).resolves.toEqual(4);
+    await expect(py.call(pymodule, "testCallbackError", () => { throw new Error("js error"); })).resolves.toMatch("js error");
+    await expect(py.call(pymodule, "testCallbackError", () => Promise.reject(new Error("js reject")))).resolves.toMatch("js reject");
+
+    py.setSyncJsAndPyInCallback(true);
+});
+
+it("nodecallspython coroutines", async () => {
+    await expect(py.call(pymodule, "asyncSleep", 21, 0.01)).resolves.toEqual(42);
+    expect(py.callSync(pymodule, "asyncSleep", 21, 0)).toEqual(42);
+
+    const start = Date.now();
+    const results = await Promise.all([...Array(50).keys()].map(i => py.call(pymodule, "asyncSleep", i, 0.2)));
+    expect(results[49]).toEqual(98);
+    expect(Date.now() - start).toBeLessThan(5000);
+
+    await expect(py.call(pymodule, "asyncError")).rejects.toMatchObject({ name: "RuntimeError", message: "async error" });
+    expect(() => py.callSync(pymodule, "asyncError")).toThrow("async error");
+
+    // the JS thread is blocked while a sync call awaits a coroutine, so it cannot run JS functions
+    const registered = py.registerCallback((i) => 2 * i);
+    expect(() => py.callSync(pymodule, "callFromCoroutine", (i) => 2 * i)).toThrow(/cannot be called from a coroutine awaited by a sync call/);
+    expect(() => py.callSync(pymodule, "callFromCoroutine", registered)).toThrow(/cannot be called from a coroutine awaited by a sync call/);
+    await expect(py.call(pymodule, "callFromCoroutine", registered)).resolves.toEqual(4);
+    py.release(registered);
+});
+
+it("nodecallspython fork", async () => {
+    py.callSync(pymodule, "warmUp", "model", 42);
+    const calculator = py.createSync(pymodule, "Calculator", [1.4, 5.5, 1.2, 4.4]);
+
+    const workers = [py.fork(), py.fork()];
+    py.callSync(pymodule, "warmUp", "model", 43);
+
+    for (const worker of workers)
+    {
+        expect(worker.pid).not.toEqual(process.pid);
+        expect(worker.callSync(pymodule, "getWarmState", "model")).toEqual([worker.pid, 42]);
+        await expect(worker.call(pymodule, "getWarmState", "model")).resolves.toEqual([worker.pid, 42]);
+        expect(worker.callSync(calculator, "multiply", 2, [1, 1, 1, 1])).toEqual(py.callSync(calculator, "multiply", 2, [1, 1, 1, 1]));
+
+        const forked = await worker.create(pymodule, "Calculator", [1, 2]);
+        expect(worker.callSync(forked, "multiply", 3, [1, 1])).toEqual([4, 7]);
+        expect(() => py.callSync(forked, "multiply", 3, [1, 1])).toThrow(/Cannot find handler/);
+
+        // the objects of the child are released with the next request to it
+        const tracked = worker.createSync(pymodule, "Tracked");
+        expect(worker.callSync(pymodule, "getTrackedAlive")).toEqual(1);
+        worker.release(tracked);
+        worker.release(tracked);
+        expect(worker.callSync(pymodule, "getTrackedAlive")).toEqual(0);
+        expect(() => worker.callSync(tracked, "__init__")).toThrow(/Cannot find handler/);
+
+        await expect(worker.call(pymodule, "testException")).rejects.toMatchObject({ name: "RuntimeError", message: "test", args: ["test"] });
+        const error = await worker.call(pymodule, "testException").catch(e => e);
+        expect(error instanceof nodecallspython.PyError).toEqual(true);
+        expect(error.traceback).toMatch(/in testException/);
+        expect(worker.callSync(pymodule, "asyncSleep", 21, 0)).toEqual(42);
+    }
+
+    const results = await Promise.all([...Array(20).keys()].map(i => workers[i % 2].call(pymodule, "multiple", i, 2)));
+    expect(results[19]).toEqual(38);
+
+    // a release does not wait for a running call, the child exits after it and is reaped
+    const running = workers[1].call(pymodule, "asyncSleep", 21, 0.2);
+    const start = Date.now();
+    workers.forEach(worker => worker.release());
+    expect(Date.now() - start).toBeLessThan(100);
+    await expect(running).resolves.toEqual(42);
+    expect(() => workers[0].callSync(pymodule, "getWarmState", "model")).toThrow(/Cannot find forked interpreter/);
+
+    const alive = pid => { try { process.kill(pid, 0); return true; } catch (e) { return false; } };
+    for (let i = 0; i < 100 && workers.some(worker => alive(worker.pid)); ++i)
+        await new Promise(resolve => setTimeout(resolve, 20));
+    expect(workers.some(worker => alive(worker.pid))).toEqual(false);
+});
+
+it("nodecallspython memory accounting", () => {
+    const before = py.memoryStats();
+    expect(before.handles).toBeGreaterThan(0);
+    expect(before.allocatedBlocks).toBeGreaterThan(0);
+    expect(before.tracemalloc).toBeUndefined();
+
+    const array = py.callLazySync(pymodule, "multipleNp", [...Array(100000).keys()], 1);
+    const stats = py.memoryStats();
+    expect(stats.bytes - before.bytes).toBeGreaterThanOrEqual(800000);
+
+    py.release(array);
+    py.release(array);
+    const after = py.memoryStats();
+    expect(stats.handles - after.handles).toBeGreaterThanOrEqual(1);
+    expect(stats.bytes - after.bytes).toBeGreaterThanOrEqual(800000);
+    expect(() => py.materialize(array, 0)).toThrow(/Cannot find handler/);
+
+    py.execSync(pymodule, "import tracemalloc; tracemalloc.start()");
+    expect(py.memoryStats().tracemalloc.current).toBeGreaterThan(0);
+    py.execSync(pymodule, "import tracemalloc; tracemalloc.stop()");
+});
+
+it("nodecallspython deferred release", async () => {
+    require("v8").setFlagsFromString("--expose-gc");
+    const gc = require("vm").runInNewContext("gc");
+
+    const create = () => {
+        for (let i = 0; i < 100; ++i)
+            py.createSync(pymodule, "Calculator", [i]);
+    };
+
+    create();
+    const before = py.memoryStats().handles;
+    gc();
+
+    for (let i = 0; i < 100 && py.memoryStats().handles > before - 100; ++i)
+        await new Promise(resolve => setTimeout(resolve, 10));
+
+    expect(py.memoryStats().handles).toBeLessThan(before - 99);
+    expect(py.callSync(pymodule, "multiple", 2, 3)).toEqual(6);
+});
+
+it("nodecallspython many arguments", async () => {
+    const args = Array(200).fill(1);
+    expect(py.callSync(pymodule, "sumargs", ...args)).toEqual(200);
+    await expect(py.call(pymodule, "sumargs", ...args)).resolves.toEqual(200);
+    expect(py.callSync(pymodule, "sumargs", 1, {a: 5, __kwargs: true}, 2)).toEqual(8);
+    await expect(py.call(pymodule, "sumargs", ...args, {a: 5, __kwargs: true})).resolves.toEqual(205);
+});
+
+it("nodecallspython bulk results", () => {
+    for (const n of [3, 100, 20000])
+    {
+        const result = py.callSync(pymodule, "bulkResults", n);
+        expect(result.floats).toEqual([...Array(n).keys()].map(i => i / 2));
+        expect(result.ints).toEqual([...Array(n).keys()]);
+        expect(result.mixed).toEqual([...Array(n).keys()].map(i => i % 2 ? i : String(i)));
+        expect(result.records).toEqual([...Array(n).keys()].map(i => ({ id: i, name: String(i), 1: true })));
+        expect(Array.isArray(result.floats)).toEqual(true);
+    }
+});
+
+it("nodecallspython binary mode", async () => {
+    const payload = {
+        int: 1, negative: -5, big: 2 ** 40, float: 1.5, text: "hello \u00e9\u4e2d", long: "x".repeat(70000),
+        flags: [true, false], nothing: null, nested: [{ a: [1, 2, { b: "c" }] }], empty: {}
+    };
+    const expected = Object.assign({}, payload, { nothing: undefined });
+
+    expect(py.callBinarySync(pymodule, "echo", payload, 2, { key: "value", __kwargs: true })).toEqual([[expected, 2], { key: "value" }]);
+    await expect(py.callBinary(pymodule, "echo", payload)).resolves.toEqual([[expected], {}]);
+
+    const bytes = py.callBinarySync(pymodule, "echo", new Float64Array([1.5, 2.5]), Buffer.from("abc"))[0];
+    expect(new Float64Array(bytes[0])).toEqual(new Float64Array([1.5, 2.5]));
+    expect(Buffer.from(bytes[1]).toString()).toEqual("abc");
+
+    expect(py.callBinarySync(pymodule, "numpyVector", 4)).toEqual(new Float64Array([0, 1, 2, 3]));
+    expect(py.callBinarySync(pymodule, "bulkResults", 20)).toEqual(py.callSync(pymodule, "bulkResults", 20));
+    expect(py.callBinarySync(pymodule, "asyncSleep", 21, 0)).toEqual(42);
+
+    expect(() => py.callBinarySync(pymodule, "testException")).toThrow("test");
+    await expect(py.callBinary(pymodule, "testException")).rejects.toMatchObject({ name: "RuntimeError", message: "test" });
+    expect(() => py.callBinarySync(pymodule, "echo", () => 1)).toThrow(/Cannot encode function/);
+
+    // a __proto__ key is an own property of the decoded object
+    const proto = py.callBinarySync(pymodule, "identity", JSON.parse('{"__proto__": {"polluted": true}}'));
+    expect(Object.keys(proto)).toEqual(["__proto__"]);
+    expect(Object.getPrototypeOf(proto) === Object.prototype).toEqual(true);
+    expect(proto.polluted).toEqual(undefined);
+
+    // cyclic results and deeply nested payloads fail instead of overflowing the stack
+    expect(() => py.callBinarySync(pymodule, "sharedGraph")).toThrow(/nested deeper than 1000 levels/);
+    let deep = [];
+    for (let i = 0; i < 1500; ++i)
+        deep = [deep];
+    expect(() => py.callBinarySync(pymodule, "echo", deep)).toThrow(/nested deeper than 1000 levels/);
+});
+
+it("nodecallspython strings", async () => {
+    const texts = ["", "ascii", "latin1 éàü", "bmp őű 漢字", "astral 😀 𝄞", "nul \0 inside", "x".repeat(5000), "é".repeat(3000), "漢".repeat(2 * 1024 * 1024), "😀".repeat(1000)];
+    for (const text of texts)
+    {
+        expect(py.callSync(pymodule, "echo", text)[0][0]).toEqual(text);
+        await expect(py.call(pymodule, "echo", text)).resolves.toEqual([[text], {}]);
+    }
+
+    expect(py.callSync(pymodule, "codepoints", "a😀é\0")).toEqual([4, [97, 0x1F600, 0xE9, 0]]);
+    expect(py.callSync(pymodule, "echo", { "kéy😀": 1 })[0][0]).toEqual({ "kéy😀": 1 });
+
+    // lone surrogates are replaced the same way in short and long strings
+    expect(py.callSync(pymodule, "codepoints", "a\uD800b")).toEqual([3, [97, 0xFFFD, 98]]);
+    expect(py.callSync(pymodule, "echo", "a".repeat(5000) + "\uDC00")[0][0]).toEqual("a".repeat(5000) + "\uFFFD");
+});
+
+it("nodecallspython registered callbacks", async () => {
+    py.setSyncJsAndPyInCallback(true, true);
+
+    let calls = 0;
+    const callback = py.registerCallback((value) => { ++calls; return value * 2; });
+
+    expect(py.callSync(pymodule, "mapCallback", callback, 3)).toEqual([0, 2, 4]);
+    await expect(py.call(pymodule, "mapCallback", callback, 3)).resolves.toEqual([0, 2, 4]);
+    await expect(py.call(pymodule, "testAwaitableCallbacks", callback, 10)).resolves.toEqual(90);
+    await expect(Promise.all([1, 2, 3].map(i => py.call(pymodule, "testFunctionPromise", 0, py.registerCallback(() => i))))).resolves.toEqual([1, 2, 3]);
+    expect(calls).toEqual(16);
+
+    const rows = [];
+    py.setSyncJsAndPyInCallback(false);
+    const progress = py.registerCallback((i, name) => rows.push(name + i));
+    py.setSyncJsAndPyInCallback(true);
+
+    await expect(py.call(pymodule, "testFunctionProgress", 3, progress)).resolves.toEqual(3);
+    await expect(py.call(pymodule, "testFunctionProgress", 2, progress)).resolves.toEqual(2);
+    await new Promise(resolve => setImmediate(resolve));
+    expect(rows).toEqual(["row0", "row1", "row2", "row0", "row1"]);
+
+    py.release(callback);
+    py.release(progress);
+    expect(() => py.callSync(pymodule, "testFunctionProgress", 1, callback)).toThrow();
+    expect(() => py.registerCallback(1)).toThrow(/Wrong type/);
+    py.setSyncJsAndPyInCallback(true);
+});
+
+it("nodecallspython call batching", async () => {
+    py.setCallBatching(pymodule, "predictRow", { maxBatchSize: 4, maxWaitUs: 2000, batchFunc: "predictRows" });
+
+    const rows = [...Array(10).keys()].map(x => ({ x }));
+    await expect(Promise.all(rows.map(row => py.call(pymodule, "predictRow", row, 2)))).resolves.toEqual(rows.map(row => row.x * 2));
+    expect(py.callSync(pymodule, "getBatchSizes")).toEqual([4, 4, 2]);
+
+    await expect(py.call(pymodule, "predictRow", { x: 3 }, { scale: 3, __kwargs: true })).resolves.toEqual(9);
+    expect(py.callSync(pymodule, "getBatchSizes")).toEqual([]);
+
+    await expect(Promise.all([py.call(pymodule, "predictRow", {}, 1), py.call(pymodule, "predictRow", { x: 1 }, 1)])).rejects.toMatchObject({ name: "KeyError" });
+    expect(py.callSync(pymodule, "getBatchSizes")).toEqual([2]);
+
+    // functions named like Object.prototype members are not batchers
+    await expect(py.call(pymodule, "valueOf")).resolves.toEqual("valueOf");
+
+    py.setCallBatching(pymodule, "predictRow", null);
+    await expect(py.call(pymodule, "predictRow", { x: 3 })).resolves.toEqual(3);
+    expect(py.callSync(pymodule, "getBatchSizes")).toEqual([]);
+
+    // a lazy proxy shares the batcher of its handler, a wrong number of results rejects with an Error
+    py.setCallBatching(py.lazy(pymodule), "predictRow", { maxBatchSize: 2, batchFunc: "firstRow" });
+    const error = await Promise.all([py.call(pymodule, "predictRow", { x: 1 }, 1), py.call(pymodule, "predictRow", { x: 2 }, 1)]).catch(e => e);
+    expect(error instanceof Error).toEqual(true);
+    expect(error.message).toEqual("Batch function firstRow returned 1 results for 2 calls");
+    py.setCallBatching(pymodule, "predictRow", null);
+});
+
+it("nodecallspython memoize", async () => {
+    py.memoize(pymodule, "tokenize", { maxEntries: 2 });
+
+    const calls = py.callSync(pymodule, "getTokenizeCalls");
+    expect(py.callSync(pymodule, "tokenize", "a b c")).toEqual(["a", "b", "c"]);
+    expect(py.callSync(pymodule, "tokenize", "a b c")).toEqual(["a", "b", "c"]);
+    await expect(py.call(pymodule, "tokenize", "a b c")).resolves.toEqual(["a", "b", "c"]);
+    await expect(Promise.all([py.call(pymodule, "tokenize", "d e"), py.call(pymodule, "tokenize", "d e")])).resolves.toEqual([["d", "e"], ["d", "e"]]);
+    expect(py.callSync(pymodule, "getTokenizeCalls")).toEqual(calls + 2);
+
+    // arguments are compared exactly, not by their python value
+    py.callSync(pymodule, "tokenize", "a b c", { x: [1, 2] });
+    py.callSync(pymodule, "tokenize", "a b c", { x: [1, 3] });
+    py.callSync(pymodule, "tokenize", "a b c", new Float64Array([1]));
+    expect(py.callSync(pymodule, "getTokenizeCalls")).toEqual(calls + 5);
+
+    // callbacks and python objects are never cached
+    py.callSync(pymodule, "tokenize", "a", () => 1);
+    py.callSync(pymodule, "tokenize", "a", pymodule);
+    expect(py.callSync(pymodule, "getTokenizeCalls")).toEqual(calls + 7);
+
+    expect(py.memoizeStats(pymodule, "tokenize")).toEqual({ hits: 3, misses: 5, evictions: 3, expirations: 0, entries: 2, bytes: py.memoizeStats(pymodule, "tokenize").bytes });
+
+    py.memoize(pymodule, "tokenize", { ttl: 20 });
+    py.callSync(pymodule, "tokenize", "a");
+    py.callSync(pymodule, "tokenize", "a");
+    await new Promise(resolve => setTimeout(resolve, 30));
+    py.callSync(pymodule, "tokenize", "a");
+    expect(py.memoizeStats(pymodule, "tokenize")).toEqual({ hits: 1, misses: 2, evictions: 0, expirations: 1, entries: 1, bytes: py.memoizeStats(pymodule, "tokenize").bytes });
+
+    py.memoize(pymodule, "tokenize", { maxBytes: 1 });
+    py.callSync(pymodule, "tokenize", "a");
+    expect(py.memoizeStats(pymodule, "tokenize").entries).toEqual(0);
+
+    // the callers get copies, functions named like Object.prototype members are not memoizers
+    py.memoize(pymodule, "tokenize", {});
+    py.callSync(pymodule, "tokenize", "x y").push("z");
+    (await py.call(pymodule, "tokenize", "x y")).push("z");
+    expect(py.callSync(pymodule, "tokenize", "x y")).toEqual(["x", "y"]);
+    expect(py.callSync(pymodule, "valueOf")).toEqual("valueOf");
+    await expect(py.call(pymodule, "valueOf")).resolves.toEqual("valueOf");
+
+    py.memoize(pymodule, "tokenize", null);
+    expect(py.memoizeStats(pymodule, "tokenize")).toEqual(undefined);
+});
+
+it("nodecallspython adaptive dispatch", async () => {
+    py.setAdaptiveDispatch(true, { minSamples: 4 });
+
+    for (let i = 0; i < 20; ++i)
+        await expect(py.call(pymodule, "tokenize", "a b")).resolves.toEqual(["a", "b"]);
+
+    const fast = py.dispatchStats(pymodule, "tokenize");
+    expect(fast.mode).toEqual("inline");
+    expect(fast.inline > 0).toEqual(true);
+    expect(fast.inline + fast.offloaded).toEqual(20);
+
+    for (let i = 0; i < 5; ++i)
+        await expect(py.call(pymodule, "slowCall", 0.002)).resolves.toEqual(0.002);
+
+    const slow = py.dispatchStats(pymodule, "slowCall");
+    expect(slow.mode).toEqual("offload");
+    expect(slow.inline).toEqual(0);
+    expect(slow.ewmaUs > 1000).toEqual(true);
+
+    // fast calls are offloaded while other calls are running
+    const running = py.call(pymodule, "slowCall", 0.05);
+    await expect(py.call(pymodule, "tokenize", "a")).resolves.toEqual(["a"]);
+    expect(py.dispatchStats(pymodule, "tokenize").offloaded).toEqual(fast.offloaded + 1);
+    await running;
+
+    // other async work counts as running too
+    const executing = py.exec(pymodule, "import time; time.sleep(0.05)");
+    await expect(py.call(pymodule, "tokenize", "a")).resolves.toEqual(["a"]);
+    expect(py.dispatchStats(pymodule, "tokenize").offloaded).toEqual(fast.offloaded + 2);
+    await executing;
+
+    await expect(py.call(pymodule, "tokenize", 1)).rejects.toMatchObject({ name: "AttributeError" });
+
+    // functions named like Object.prototype members get their own statistics
+    expect(py.dispatchStats(pymodule, "valueOf")).toEqual(undefined);
+    await expect(py.call(pymodule, "valueOf")).resolves.toEqual("valueOf");
+    expect(py.dispatchStats(pymodule, "valueOf").offloaded).toEqual(1);
+
+    py.setAdaptiveDispatch(false);
+    await py.call(pymodule, "tokenize", "a");
+    expect(py.dispatchStats(pymodule, "tokenize").mode).toEqual("offload");
+});
+
+it("nodecallspython lazy arguments", async () => {
+    py.setLazyArguments(true);
+
+    const config = { server: { port: 8080, host: "localhost" }, name: "test", values: [...Array(1000).keys()] };
+    expect(py.callSync(pymodule, "readProxy", config, [1, 2, 3, { x: 4 }])).toEqual(["JsObject", true, 8080, 3, "JsArray", true, { x: 4 }, [2, 3], 4]);
+
+    // fields read during the call are cached, everything else is gone with the call
+    expect(py.callSync(pymodule, "readKeptProxy", "server", "port")).toEqual(8080);
+    expect(() => py.callSync(pymodule, "readKeptProxy", "server")).toThrow(/not available anymore/);
+    expect(py.callSync(pymodule, "identity", config) === config).toEqual(true);
+    expect(() => py.callSync(pymodule, "readKeptProxy", "name")).toThrow(/not available anymore/);
+
+    // other threads cannot read the proxies, coroutine functions get converted arguments
+    expect(py.callSync(pymodule, "readProxyInThread", config)).toEqual(["JsObject", "JavaScript object can only be used on the thread of the sync call it was passed to"]);
+    expect(py.callSync(pymodule, "readProxyAsync", config)).toEqual(["dict", "test"]);
+
+    // kwargs and async calls are converted as before
+    expect(py.callSync(pymodule, "kwargstestvalue", 1, { obj1: [1], "__kwargs": true })).toEqual({ obj1: [1], test: 1 });
+    await expect(py.call(pymodule, "echo", { b: [1] })).resolves.toEqual([[{ b: [1] }], {}]);
+
+    py.setLazyArguments(false);
+    expect(py.callSync(pymodule, "readProxy", config, [1, 2])).toEqual(["dict", true, 8080, 3, "list", true, 2, [2], 2]);
+});
+
+it("nodecallspython preserve references", async () => {
+    const cyclic = { name: "root" };
+    cyclic.self = cyclic;
+
+    // cyclic values cannot be converted without references
+    expect(() => py.callSync(pymodule, "identity", cyclic)).toThrow(/nested deeper than 1000 levels/);
+    expect(() => py.callSync(pymodule, "sharedGraph")).toThrow(/nested deeper than 1000 levels/);
+
+    py.setPreserveReferences(true);
+
+    expect(py.callSync(pymodule, "sameObjects", [cyclic, cyclic], cyclic)).toEqual([true, true, true]);
+    await expect(py.call(pymodule, "sameObjects", [cyclic, cyclic], cyclic)).resolves.toEqual([true, true, true]);
+
+    const graph = py.callSync(pymodule, "sharedGraph");
+    expect(graph.a).toEqual({ x: 1 });
+    expect(graph.a === graph.b).toEqual(true);
+    expect(graph.list[0] === graph).toEqual(true);
+
+    const result = await py.call(pymodule, "identity", cyclic);
+    expect(result.name).toEqual("root");
+    expect(result.self === result).toEqual(true);
+
+    // everything else is converted as before
+    expect(py.callSync(pymodule, "kwargstestvalue", 1, { obj1: [1, "a", null], "__kwargs": true })).toEqual({ obj1: [1, "a", undefined], test: 1 });
+    expect(py.callSync(pymodule, "mapCallback", x => x * 2, 3)).toEqual([0, 2, 4]);
+    expect(new Uint8Array(py.callSync(pymodule, "identity", [new Uint8Array([1, 2])])[0])).toEqual(new Uint8Array([1, 2]));
+
+    py.setPreserveReferences(false);
+});
+
+it("nodecallspython structured exceptions", async () => {
+    const check = (error) => {
+        expect(error instanceof Error).toEqual(true);
+        expect(error instanceof nodecallspython.PyError).toEqual(true);
+        expect(error.name).toEqual("nodetest.ValidationError");
+        expect(error.message).toEqual("invalid age");
+        expect(error.args).toEqual(["invalid age"]);
+        expect(error.field).toEqual("age");
+        expect(error.errorCode).toEqual(42);
+        expect(error.traceback).toMatch(/Traceback.+nodetest.py.+nodetest.ValidationError: invalid age/s);
+        expect(error.stack).toEqual(error.traceback);
+    };
+
+    try
+    {
+        py.callSync(pymodule, "validate", -1);
+        expect(true).toEqual(false);
+    }
+    catch (e)
+    {
+        check(e);
+    }
+
+    check(await py.call(pymodule, "validate", -1).catch(e => e));
+
+    // unconvertible values are passed as their repr, the PyError properties take precedence over the attributes
+    const unconvertible = await py.call(pymodule, "raiseUnconvertible").catch(e => e);
+    expect(unconvertible instanceof nodecallspython.PyError).toEqual(true);
+    expect(unconvertible.args).toEqual(["cyclic", "[[...]]"]);
+    expect(unconvertible.items).toEqual("[[...]]");
+    expect(unconvertible.code).toEqual("py");
+
+    // errors which are not python exceptions are reported as before
+    await expect(py.call(pymodule, function(){})).rejects.toThrow("Wrong type of arguments");
+});
+
+it("nodecallspython module index", async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-"));
+    fs.writeFileSync(path.join(dir, "indexedmodule.py"), "def value():\n    return 1\n");
+    fs.mkdirSync(path.join(dir, "indexedpackage"));
+    fs.writeFileSync(path.join(dir, "indexedpackage", "__init__.py"), "from .sub import value\n");
+    fs.writeFileSync(path.join(dir, "indexedpackage", "sub.py"), "def value():\n    return 2\n");
+
+    try
+    {
+        py.setModuleIndex(true);
+
+        const module = py.importSync(path.join(dir, "indexedmodule.py"));
+        expect(py.callSync(module, "value")).toEqual(1);
+        expect(py.callSync(pymodule, "indexedOrigin", "indexedpackage")).toEqual(path.join(dir, "indexedpackage", "__init__.py"));
+        expect(py.callSync(py.importSync(path.join(dir, "indexedpackage")), "value")).toEqual(2);
+
+        // the directory is in sys.path once, however many times it is used
+        py.importSync(path.join(dir, "indexedmodule.py"), true);
+        await py.import(path.join(dir, "indexedmodule.py"), true);
+        py.addImportPath(dir);
+        expect(py.callSync(pymodule, "countImportPath", dir)).toEqual(1);
+
+        py.setModuleIndex(false);
+        expect(py.callSync(pymodule, "indexedOrigin", "indexedpackage")).toEqual(undefined);
+    }
+    finally
+    {
+        py.setModuleIndex(false);
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+});
+
+it("nodecallspython bundles", async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), "nodecallspython-"));
+    const source = path.join(dir, "source");
+    fs.mkdirSync(path.join(source, "bundledpackage", "sub"), { recursive: true });
+    fs.writeFileSync(path.join(source, "bundledmodule.py"), "import bundledpackage\ndef value():\n    return bundledpackage.value() + 1\n");
+    fs.writeFileSync(path.join(source, "bundledpackage", "__init__.py"), "from .sub.deep import value\n");
+    fs.writeFileSync(path.join(source, "bundledpackage", "sub", "deep.py"), "def value():\n    return 2\n");
+    const bundle = path.join(dir, "modules.bundle");
+
+    try
+    {
+        // directories without __init__.py are packages only when asked for
+        expect(py.buildBundle(source, bundle)).toEqual(2);
+        expect(py.buildBundle(source, bundle, { namespacePackages: true })).toEqual(4);
+        fs.renameSync(source, source + "-moved");
+
+        // the modules are imported from the bundle, even though their files are gone
+        py.addBundle(bundle);
+        expect(py.callSync(pymodule, "importCounted", ["bundledmodule"])).toEqual({});
+        const module = py.importSync("bundledmodule", false);
+        expect(py.callSync(module, "value")).toEqual(3);
+
+        expect(() => py.addBundle(path.join(source + "-moved", "bundledmodule.py"))).toThrow("is not a bundle");
+
+        // changed sources are reimported from the files, the unchanged ones from the bundle
+        fs.renameSync(source + "-moved", source);
+        const deep = path.join(source, "bundledpackage", "sub", "deep.py");
+        fs.writeFileSync(deep, "def value():\n    return 5\n");
+        fs.utimesSync(deep, new Date(), new Date(Date.now() + 10000));
+        expect(py.reimport(deep).sort()).toEqual(["bundledmodule", "bundledpackage", "bundledpackage.sub.deep"]);
+        expect(py.callSync(module, "value")).toEqual(6);
+    }
+    finally
+    {
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+});
+
+it("nodecallspython parallel handlers", async () => {
+    const objects = await Promise.all([...Array(32).keys()].map(i => py.create(pymodule, "Calculator", [i], { value: i, __kwargs: true })));
+    await expect(Promise.all(objects.map(obj => py.call(obj, "multiply", 2, [1])))).resolves.toEqual(objects.map((obj, i) => [2 * i * i + 1]));
+
+    const handlers = py.memoryStats().handles;
+    objects.forEach(obj => py.release(obj));
+    expect(py.memoryStats().handles).toEqual(handlers - 32);
+});